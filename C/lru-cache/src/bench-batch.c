@@ -0,0 +1,162 @@
+/**
+ * Spiral scans of the circular walk done one key at a time with
+ * lru_cache_get/lru_cache_put against lru_cache_get_many/lru_cache_put_many.
+ * The scans rotate over several caches, like one per player or dimension,
+ * so the caches do not all stay in the CPU caches and the prefetching in the
+ * batched calls has latency to hide.
+ *
+ * Usage: bench batch [render distance]
+ */
+
+#include "bench.h"
+#include "lru-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BATCH_BENCH_FRAMES		2000
+#define BATCH_BENCH_MAX_CACHES 32
+
+static const size_t cache_counts[] = {1, BATCH_BENCH_MAX_CACHES};
+
+struct BatchScratch {
+	struct Coord *frame;
+	struct LRUCacheKey *keys;
+	void **values;
+	struct LRUCacheKey *missKeys;
+	void **missValues;
+};
+
+static double batch_scan_single(LRUCACHE *cache, const struct Coord *frame, size_t count, size_t *hits) {
+	static int value;
+
+	double start = bench_now_ns();
+	for (size_t i = 0; i < count; i++) {
+		if (lru_cache_get(cache, frame[i].x, frame[i].z) != NULL) {
+			(*hits)++;
+		} else {
+			lru_cache_put(cache, frame[i].x, frame[i].z, &value);
+		}
+	}
+
+	return bench_now_ns() - start;
+}
+
+static double batch_scan_many(LRUCACHE *cache, struct BatchScratch *scratch, size_t count, size_t *hits) {
+	static int value;
+
+	for (size_t i = 0; i < count; i++) {
+		scratch->keys[i].x = scratch->frame[i].x;
+		scratch->keys[i].z = scratch->frame[i].z;
+	}
+
+	double start = bench_now_ns();
+	*hits += lru_cache_get_many(cache, scratch->keys, count, scratch->values);
+
+	size_t misses = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (scratch->values[i] == NULL) {
+			scratch->missKeys[misses] = scratch->keys[i];
+			scratch->missValues[misses] = &value;
+			misses++;
+		}
+	}
+
+	lru_cache_put_many(cache, scratch->missKeys, misses, scratch->missValues);
+	return bench_now_ns() - start;
+}
+
+static int batch_run(bool many, size_t cacheCount, int renderDistance, struct BatchScratch *scratch) {
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+
+	LRUCACHE *caches[BATCH_BENCH_MAX_CACHES];
+	for (size_t c = 0; c < cacheCount; c++) {
+		caches[c] = lru_cache_create(diameter * diameter);
+		if (caches[c] == NULL) {
+			fprintf(stderr, "Failed to allocate cache\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t ops = 0;
+	size_t hits = 0;
+	double ns = 0.0;
+
+	for (int t = 0; t < BATCH_BENCH_FRAMES; t++) {
+		// Every cache follows its own walk, offset in time
+		size_t c = (size_t)t % cacheCount;
+		size_t count = bench_orbit_frame(t / (int)cacheCount + (int)c * 7, renderDistance, scratch->frame);
+
+		if (many) {
+			ns += batch_scan_many(caches[c], scratch, count, &hits);
+		} else {
+			ns += batch_scan_single(caches[c], scratch->frame, count, &hits);
+		}
+		ops += count;
+	}
+
+	printf("%-6s %8d %6zu %9.2f%% %10.1f\n", many ? "many" : "single", renderDistance, cacheCount,
+		(double)hits * 100.0 / (double)ops, ns / (double)ops);
+
+	for (size_t c = 0; c < cacheCount; c++) {
+		lru_cache_destroy(caches[c]);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int bench_batch(int argc, char **argv) {
+	int distances[] = {8, 16, 24, 32};
+	size_t distance_count = sizeof(distances) / sizeof(distances[0]);
+
+	if (argc > 0) {
+		distances[0] = atoi(argv[0]);
+		distance_count = 1;
+
+		if (distances[0] <= 0) {
+			fprintf(stderr, "Usage: bench batch [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%-6s %8s %6s %10s %10s\n", "mode", "distance", "caches", "hit rate", "ns/op");
+
+	for (size_t d = 0; d < distance_count; d++) {
+		size_t side = (size_t)distances[d] * 2 + 1;
+		size_t count = side * side;
+
+		struct BatchScratch scratch = {
+			.frame = malloc(count * sizeof(struct Coord)),
+			.keys = malloc(count * sizeof(struct LRUCacheKey)),
+			.values = malloc(count * sizeof(void *)),
+			.missKeys = malloc(count * sizeof(struct LRUCacheKey)),
+			.missValues = malloc(count * sizeof(void *)),
+		};
+
+		int status = EXIT_SUCCESS;
+		if (scratch.frame == NULL || scratch.keys == NULL || scratch.values == NULL || scratch.missKeys == NULL ||
+			scratch.missValues == NULL) {
+			fprintf(stderr, "Failed to allocate frame\n");
+			status = EXIT_FAILURE;
+		}
+
+		for (size_t c = 0; c < sizeof(cache_counts) / sizeof(cache_counts[0]) && status == EXIT_SUCCESS; c++) {
+			status = batch_run(false, cache_counts[c], distances[d], &scratch);
+			if (status == EXIT_SUCCESS) {
+				status = batch_run(true, cache_counts[c], distances[d], &scratch);
+			}
+		}
+
+		free(scratch.frame);
+		free(scratch.keys);
+		free(scratch.values);
+		free(scratch.missKeys);
+		free(scratch.missValues);
+
+		if (status != EXIT_SUCCESS) {
+			return status;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
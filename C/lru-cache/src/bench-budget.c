@@ -0,0 +1,136 @@
+/**
+ * Entry count against byte budget on chunks of very different sizes: most
+ * chunks are all air and nearly free, some hold a full block array and a few
+ * also carry a mesh. The entry limited cache and the budgeted one are given
+ * the same expected memory. Hit rate and peak memory are measured over the
+ * first half of the walk, then the limit is halved with lru_cache_resize,
+ * like a reaction to memory pressure, and the peak after it is reported.
+ *
+ * Usage: bench budget [render distance]
+ */
+
+#include "bench.h"
+#include "lru-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BUDGET_BENCH_FRAMES		 20000
+#define BUDGET_BENCH_AIR_COST	 256
+#define BUDGET_BENCH_CHUNK_COST (16 * 16 * 128 * 4) // struct Chunk block array
+#define BUDGET_BENCH_MESH_COST	(2 * 1024 * 1024)
+#define BUDGET_BENCH_POOL_MULT	 4 // Entry capacity of the budgeted cache over the entry limited one
+
+/** Half the chunks are air, 40% full chunks and 10% full chunks with a mesh, fixed per coordinate */
+static size_t budget_chunk_cost(int x, int z) {
+	uint64_t state = ((uint64_t)(uint32_t)x << 32 | (uint32_t)z) ^ 0x9E3779B97F4A7C15ULL;
+	uint64_t roll = bench_rand(&state) % 10;
+
+	if (roll < 5) {
+		return BUDGET_BENCH_AIR_COST;
+	}
+
+	return roll < 9 ? BUDGET_BENCH_CHUNK_COST : BUDGET_BENCH_CHUNK_COST + BUDGET_BENCH_MESH_COST;
+}
+
+static int budget_run(const char *name, BenchFrameFn walk, bool budgeted, int renderDistance, struct Coord *frame) {
+	static int value;
+
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+	size_t entries = diameter * diameter;
+	size_t average = (BUDGET_BENCH_AIR_COST * 5 + BUDGET_BENCH_CHUNK_COST * 4 + BUDGET_BENCH_MESH_COST) / 10;
+
+	struct LRUCacheConfig config = {
+		.capacity = budgeted ? entries * BUDGET_BENCH_POOL_MULT : entries,
+		.budget = budgeted ? entries * average : 0,
+	};
+
+	LRUCACHE *cache = lru_cache_create_with(&config);
+	if (cache == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t ops = 0;
+	size_t hits = 0;
+	size_t peak = 0;
+	size_t peak_after = 0;
+	double resize_ns = 0.0;
+	size_t resize_evicted = 0;
+
+	for (int t = 0; t < BUDGET_BENCH_FRAMES; t++) {
+		if (t == BUDGET_BENCH_FRAMES / 2) {
+			size_t before = lru_cache_size(cache);
+			double start = bench_now_ns();
+			if (budgeted) {
+				lru_cache_resize(cache, config.capacity, config.budget / 2);
+			} else {
+				lru_cache_resize(cache, config.capacity / 2, 0);
+			}
+			resize_ns = bench_now_ns() - start;
+			resize_evicted = before - lru_cache_size(cache);
+		}
+
+		bool shrunk = t >= BUDGET_BENCH_FRAMES / 2;
+		size_t count = walk(t, renderDistance, frame);
+		for (size_t i = 0; i < count; i++) {
+			if (lru_cache_get(cache, frame[i].x, frame[i].z) != NULL) {
+				hits += !shrunk;
+			} else {
+				lru_cache_put_cost(cache, frame[i].x, frame[i].z, &value, budget_chunk_cost(frame[i].x, frame[i].z));
+			}
+		}
+
+		size_t cost = lru_cache_cost(cache);
+		if (shrunk) {
+			peak_after = cost > peak_after ? cost : peak_after;
+		} else {
+			ops += count;
+			peak = cost > peak ? cost : peak;
+		}
+	}
+
+	printf("%-7s %-8s %8d %9.2f%% %10.1f %10zu %10.1f %10.1f\n", name, budgeted ? "budget" : "entries", renderDistance,
+		(double)hits * 100.0 / (double)ops, (double)peak / (1024.0 * 1024.0), resize_evicted, resize_ns / 1000.0,
+		(double)peak_after / (1024.0 * 1024.0));
+
+	lru_cache_destroy(cache);
+	return EXIT_SUCCESS;
+}
+
+int bench_budget(int argc, char **argv) {
+	int renderDistance = 8;
+
+	if (argc > 0) {
+		renderDistance = atoi(argv[0]);
+
+		if (renderDistance <= 0) {
+			fprintf(stderr, "Usage: bench budget [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+	if (frame == NULL) {
+		fprintf(stderr, "Failed to allocate frame\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-7s %-8s %8s %10s %10s %10s %10s %10s\n", "walk", "limit", "distance", "hit rate", "peak MiB", "shrunk by",
+		"resize us", "after MiB");
+
+	int status = budget_run("orbit", bench_orbit_frame, false, renderDistance, frame);
+	if (status == EXIT_SUCCESS) {
+		status = budget_run("orbit", bench_orbit_frame, true, renderDistance, frame);
+	}
+	if (status == EXIT_SUCCESS) {
+		status = budget_run("flight", bench_flight_frame, false, renderDistance, frame);
+	}
+	if (status == EXIT_SUCCESS) {
+		status = budget_run("flight", bench_flight_frame, true, renderDistance, frame);
+	}
+
+	free(frame);
+	return status;
+}
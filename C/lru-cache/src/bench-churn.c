@@ -0,0 +1,104 @@
+/**
+ * Long running put/evict churn through a fixed size hashmap, the way the LRU
+ * cache drives it: every cycle misses on a new key, inserts it and removes
+ * the oldest live key. Probe lengths are sampled as the run goes on so
+ * tombstone build-up (or the lack of it) is visible.
+ *
+ * Usage: bench churn [cycles]
+ */
+
+#include "bench.h"
+#include "hashmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHURN_BENCH_LIVE	1024
+#define CHURN_BENCH_CYCLES	2000000
+#define CHURN_BENCH_SAMPLES 8
+
+static int churn(const char *name, enum HashmapProbe probe, size_t cycles) {
+	static int value;
+
+	struct HashmapConfig config = {
+		.capacity = CHURN_BENCH_LIVE * 2,
+		.probe = probe,
+	};
+
+	HASHMAP *hashmap = hashmap_create_with(&config);
+	struct Coord *live = malloc(CHURN_BENCH_LIVE * sizeof(struct Coord));
+	if (hashmap == NULL || live == NULL) {
+		fprintf(stderr, "Failed to allocate churn state\n");
+		free(live);
+		if (hashmap != NULL) {
+			hashmap_destroy(hashmap);
+		}
+		return EXIT_FAILURE;
+	}
+
+	uint64_t rng = 0x5EEDULL;
+	int next = 0;
+	for (size_t i = 0; i < CHURN_BENCH_LIVE; i++) {
+		live[i].x = next++;
+		live[i].z = (int)(bench_rand(&rng) & 0xFFFF);
+		hashmap_insert(hashmap, live[i].x, live[i].z, &value);
+	}
+
+	size_t interval = cycles / CHURN_BENCH_SAMPLES;
+	if (interval == 0) {
+		interval = 1;
+	}
+
+	size_t found = 0;
+	double start = bench_now_ns();
+
+	for (size_t cycle = 1; cycle <= cycles; cycle++) {
+		struct Coord *slot = &live[cycle % CHURN_BENCH_LIVE];
+
+		hashmap_remove(hashmap, slot->x, slot->z);
+
+		slot->x = next++;
+		slot->z = (int)(bench_rand(&rng) & 0xFFFF);
+		found += hashmap_get(hashmap, slot->x, slot->z) != NULL;
+		hashmap_insert(hashmap, slot->x, slot->z, &value);
+
+		if (cycle % interval == 0) {
+			double elapsed = bench_now_ns() - start;
+
+			struct HashmapProbeStats stats;
+			hashmap_probe_stats(hashmap, &stats);
+
+			printf("%-10s %10zu %10.2f %10zu %10.2f %10zu %10.1f\n",
+				name, cycle, stats.average_probe, stats.max_probe,
+				stats.average_miss_probe, stats.tombstones, elapsed / (double)interval);
+
+			start = bench_now_ns();
+		}
+	}
+
+	if (found != 0) {
+		fprintf(stderr, "Churn found %zu keys that were never inserted\n", found);
+	}
+
+	free(live);
+	hashmap_destroy(hashmap);
+	return found == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int bench_churn(int argc, char **argv) {
+	size_t cycles = argc > 0 ? (size_t)strtoull(argv[0], NULL, 10) : CHURN_BENCH_CYCLES;
+	if (cycles == 0) {
+		fprintf(stderr, "Usage: bench churn [cycles]\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-10s %10s %10s %10s %10s %10s %10s\n",
+		"probe", "cycle", "avg", "max", "avg miss", "tombstones", "ns/cycle");
+
+	if (churn("linear", HASHMAP_PROBE_LINEAR, cycles) != EXIT_SUCCESS ||
+		churn("group", HASHMAP_PROBE_GROUP, cycles) != EXIT_SUCCESS ||
+		churn("backshift", HASHMAP_PROBE_BACKSHIFT, cycles) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
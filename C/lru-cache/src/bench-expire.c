@@ -0,0 +1,133 @@
+/**
+ * A player who orbits and then stands still. The cache is sized for four
+ * times the view, so while moving it keeps the trail behind the player.
+ * Every frame stamps the accesses with the frame number and expires
+ * entries idle for two seconds with a fixed budget. Reports how many frames
+ * after stopping the trail is gone and the slowest single expire call,
+ * against an unbounded call that drops the whole trail in one frame.
+ *
+ * Usage: bench expire [render distance]
+ */
+
+#include "bench.h"
+#include "lru-cache.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define EXPIRE_BENCH_MOVING	  2000
+#define EXPIRE_BENCH_STANDING 1200
+#define EXPIRE_BENCH_IDLE	  120 // Frames, two seconds at 60 frames a second
+#define EXPIRE_BENCH_VIEWS	  4	  // Cache capacity in multiples of the chunks in view
+
+static const size_t budgets[] = {8, 32, 128, SIZE_MAX};
+
+static const struct {
+	const char *name;
+	enum LRUCachePolicy policy;
+} policies[] = {
+	{"lru", LRU_CACHE_POLICY_LRU},
+	{"clock", LRU_CACHE_POLICY_CLOCK},
+	{"2q", LRU_CACHE_POLICY_2Q},
+	{"tinylfu", LRU_CACHE_POLICY_TINYLFU},
+};
+
+/** Standing still at the orbit position of the last moving frame */
+static size_t expire_frame(int t, int renderDistance, struct Coord *out) {
+	return bench_orbit_frame(t < EXPIRE_BENCH_MOVING ? t : EXPIRE_BENCH_MOVING - 1, renderDistance, out);
+}
+
+static int expire_run(size_t p, size_t budget, int renderDistance, struct Coord *frame) {
+	static int value;
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	struct LRUCacheConfig config = {
+		.capacity = side * side * EXPIRE_BENCH_VIEWS,
+		.policy = policies[p].policy,
+	};
+
+	LRUCACHE *cache = lru_cache_create_with(&config);
+	if (cache == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t stopped_size = 0;
+	int drained = -1;
+	size_t calls = 0;
+	double total_ns = 0.0;
+	double max_ns = 0.0;
+
+	for (int t = 0; t < EXPIRE_BENCH_MOVING + EXPIRE_BENCH_STANDING; t++) {
+		lru_cache_set_epoch(cache, (uint32_t)t);
+
+		size_t count = expire_frame(t, renderDistance, frame);
+		for (size_t i = 0; i < count; i++) {
+			if (lru_cache_get(cache, frame[i].x, frame[i].z) == NULL) {
+				lru_cache_put(cache, frame[i].x, frame[i].z, &value);
+			}
+		}
+
+		if (t == EXPIRE_BENCH_MOVING) {
+			stopped_size = lru_cache_size(cache);
+		}
+
+		if (t >= EXPIRE_BENCH_IDLE) {
+			double start = bench_now_ns();
+			lru_cache_expire_older_than(cache, (uint32_t)(t - EXPIRE_BENCH_IDLE), budget);
+			double ns = bench_now_ns() - start;
+
+			if (t >= EXPIRE_BENCH_MOVING) {
+				calls++;
+				total_ns += ns;
+				max_ns = ns > max_ns ? ns : max_ns;
+			}
+		}
+
+		if (t >= EXPIRE_BENCH_MOVING && drained < 0 && lru_cache_size(cache) <= count) {
+			drained = t - EXPIRE_BENCH_MOVING;
+		}
+	}
+
+	char budget_text[32];
+	snprintf(budget_text, sizeof(budget_text), budget == SIZE_MAX ? "all" : "%zu", budget);
+
+	printf("%-8s %6s %8zu %9zu %10zu %9d %10.2f %10.2f\n", policies[p].name, budget_text, config.capacity, stopped_size,
+		lru_cache_size(cache), drained, total_ns / (double)calls / 1000.0, max_ns / 1000.0);
+
+	lru_cache_destroy(cache);
+	return EXIT_SUCCESS;
+}
+
+int bench_expire(int argc, char **argv) {
+	int renderDistance = 8;
+
+	if (argc > 0) {
+		renderDistance = atoi(argv[0]);
+
+		if (renderDistance <= 0) {
+			fprintf(stderr, "Usage: bench expire [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+	if (frame == NULL) {
+		fprintf(stderr, "Failed to allocate frame\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-8s %6s %8s %9s %10s %9s %10s %10s\n", "policy", "budget", "capacity", "stopped", "standing", "drained",
+		"avg us", "max us");
+
+	int status = EXIT_SUCCESS;
+	for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]) && status == EXIT_SUCCESS; p++) {
+		for (size_t b = 0; b < sizeof(budgets) / sizeof(budgets[0]) && status == EXIT_SUCCESS; b++) {
+			status = expire_run(p, budgets[b], renderDistance, frame);
+		}
+	}
+
+	free(frame);
+	return status;
+}
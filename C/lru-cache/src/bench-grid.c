@@ -0,0 +1,146 @@
+/**
+ * The toroidal chunk grid against the LRU cache and the fused map on the
+ * spiral loop. All three hold the same number of chunks: the render
+ * distance plus the cache margin all around. The grid is recentered on the
+ * player's chunk every frame, which is timed along with the lookups, and
+ * drops chunks as soon as they leave that square where the caches keep the
+ * most recent ones wherever they are.
+ *
+ * Usage: bench grid [render distance]
+ */
+
+#include "bench.h"
+#include "chunk-grid.h"
+#include "lru-cache.h"
+#include "lru-map.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define GRID_BENCH_FRAMES 20000
+
+enum GridContainer {
+	GRID_BENCH_LRU,
+	GRID_BENCH_FUSED,
+	GRID_BENCH_GRID,
+	GRID_BENCH_CONTAINERS
+};
+
+static const char *const containers[GRID_BENCH_CONTAINERS] = {"lru", "fused", "grid"};
+
+static const struct {
+	const char *name;
+	BenchFrameFn frame;
+} workloads[] = {
+	{"orbit", bench_orbit_frame},
+	{"flight", bench_flight_frame},
+	{"teleport", bench_teleport_frame},
+};
+
+static int grid_run(size_t w, enum GridContainer container, int renderDistance, struct Coord *frame) {
+	static int value;
+
+	int radius = renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = (size_t)radius * 2 + 1;
+	struct LRUCacheConfig config = {
+		.capacity = diameter * diameter,
+	};
+
+	LRUCACHE *cache = container == GRID_BENCH_LRU ? lru_cache_create_with(&config) : NULL;
+	LRUMAP *map = container == GRID_BENCH_FUSED ? lru_map_create(&config) : NULL;
+	CHUNKGRID *grid = container == GRID_BENCH_GRID ? chunk_grid_create(radius, NULL, NULL) : NULL;
+	if (cache == NULL && map == NULL && grid == NULL) {
+		fprintf(stderr, "Failed to allocate %s\n", containers[container]);
+		return EXIT_FAILURE;
+	}
+
+	size_t ops = 0;
+	size_t hits = 0;
+	double ns = 0.0;
+
+	for (int t = 0; t < GRID_BENCH_FRAMES; t++) {
+		size_t count = workloads[w].frame(t, renderDistance, frame);
+
+		// The spiral starts at the player's chunk
+		double start = bench_now_ns();
+		switch (container) {
+		case GRID_BENCH_LRU:
+			for (size_t i = 0; i < count; i++) {
+				if (lru_cache_get(cache, frame[i].x, frame[i].z) != NULL) {
+					hits++;
+				} else {
+					lru_cache_put(cache, frame[i].x, frame[i].z, &value);
+				}
+			}
+			break;
+		case GRID_BENCH_FUSED:
+			for (size_t i = 0; i < count; i++) {
+				bool found;
+				void **entry = lru_map_entry(map, frame[i].x, frame[i].z, &found);
+				hits += found;
+				*entry = &value;
+			}
+			break;
+		case GRID_BENCH_GRID:
+			chunk_grid_recenter(grid, frame[0].x, frame[0].z);
+			for (size_t i = 0; i < count; i++) {
+				if (chunk_grid_get(grid, frame[i].x, frame[i].z) != NULL) {
+					hits++;
+				} else {
+					chunk_grid_put(grid, frame[i].x, frame[i].z, &value);
+				}
+			}
+			break;
+		default:
+			break;
+		}
+		ns += bench_now_ns() - start;
+		ops += count;
+	}
+
+	printf("%-9s %-6s %10zu %9.2f%% %10.2f\n", workloads[w].name, containers[container], ops,
+		(double)hits * 100.0 / (double)ops, ns / (double)ops);
+
+	if (cache != NULL) {
+		lru_cache_destroy(cache);
+	}
+	if (map != NULL) {
+		lru_map_destroy(map);
+	}
+	if (grid != NULL) {
+		chunk_grid_destroy(grid);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int bench_grid(int argc, char **argv) {
+	int renderDistance = 8;
+
+	if (argc > 0) {
+		renderDistance = atoi(argv[0]);
+
+		if (renderDistance <= 0) {
+			fprintf(stderr, "Usage: bench grid [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+	if (frame == NULL) {
+		fprintf(stderr, "Failed to allocate frame\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-9s %-6s %10s %10s %10s\n", "trace", "cache", "ops", "hit rate", "ns/op");
+
+	int status = EXIT_SUCCESS;
+	for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]) && status == EXIT_SUCCESS; w++) {
+		for (int c = 0; c < GRID_BENCH_CONTAINERS && status == EXIT_SUCCESS; c++) {
+			status = grid_run(w, (enum GridContainer)c, renderDistance, frame);
+		}
+	}
+
+	free(frame);
+	return status;
+}
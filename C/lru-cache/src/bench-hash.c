@@ -0,0 +1,204 @@
+/**
+ * Compares the coordinate mixer with power-of-two masking against the
+ * original FNV-1a hash with modulo indexing.
+ *
+ * Collision rate is the share of keys whose home slot was already claimed by
+ * an earlier key. Lookups are timed through the real hashmap for hits and
+ * misses.
+ *
+ * The probe benchmark fills a fixed table to increasing load factors and
+ * compares linear probing against group probing over the control bytes.
+ */
+
+#include "bench.h"
+#include "hashmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_BENCH_RADIUS	 64
+#define HASH_BENCH_LOOKUPS	 (1 << 24)
+#define HASH_BENCH_RANDOM_RANGE 4096
+#define PROBE_BENCH_CAPACITY	(1 << 16)
+
+static double collision_rate(const struct Coord *keys, size_t count, enum HashmapHash hash, size_t capacity) {
+	uint8_t *claimed = calloc(capacity, 1);
+	if (claimed == NULL) {
+		return -1.0;
+	}
+
+	size_t collisions = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint64_t h = hash == HASHMAP_HASH_COORDS
+			? hashmap_hash_coords(keys[i].x, keys[i].z) & (capacity - 1)
+			: hashmap_hash_coords_fnv1a(keys[i].x, keys[i].z) % capacity;
+
+		if (claimed[h]) {
+			collisions++;
+		}
+		claimed[h] = 1;
+	}
+
+	free(claimed);
+	return (double)collisions / (double)count;
+}
+
+static double lookups_per_sec(HASHMAP *hashmap, const struct Coord *keys, size_t count, int offset) {
+	size_t found = 0;
+
+	double start = bench_now_ns();
+	for (size_t i = 0; i < HASH_BENCH_LOOKUPS; i++) {
+		const struct Coord *key = &keys[i % count];
+		found += hashmap_get(hashmap, key->x + offset, key->z) != NULL;
+	}
+	double elapsed = bench_now_ns() - start;
+
+	// Keep the loop from being optimised away
+	if (found == SIZE_MAX) {
+		printf("!");
+	}
+
+	return (double)HASH_BENCH_LOOKUPS / (elapsed / 1e9);
+}
+
+static int run_workload(const char *workload, const struct Coord *keys, size_t count) {
+	static int value;
+
+	// Same slot count for both so only the hash and indexing differ
+	size_t slots = 1;
+	while (slots < count * 2) {
+		slots <<= 1;
+	}
+
+	struct {
+		const char *name;
+		enum HashmapHash hash;
+	} variants[] = {
+		{"fnv1a-mod", HASHMAP_HASH_FNV1A},
+		{"coords-mask", HASHMAP_HASH_COORDS},
+	};
+
+	for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+		struct HashmapConfig config = {
+			.capacity = slots,
+			.hash = variants[v].hash,
+		};
+
+		HASHMAP *hashmap = hashmap_create_with(&config);
+		if (hashmap == NULL) {
+			fprintf(stderr, "Failed to allocate hashmap\n");
+			return EXIT_FAILURE;
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			hashmap_insert(hashmap, keys[i].x, keys[i].z, &value);
+		}
+
+		size_t capacity = hashmap_capacity(hashmap);
+
+		// Misses shift every key far outside the populated area
+		double hits = lookups_per_sec(hashmap, keys, count, 0);
+		double misses = lookups_per_sec(hashmap, keys, count, 1 << 20);
+
+		printf("%-8s %-12s %8zu %8zu %6.3f %10.2f%% %12.2f %12.2f\n",
+			workload, variants[v].name, hashmap_size(hashmap), capacity,
+			(double)hashmap_size(hashmap) / (double)capacity,
+			collision_rate(keys, count, variants[v].hash, capacity) * 100.0,
+			hits / 1e6, misses / 1e6);
+
+		hashmap_destroy(hashmap);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int bench_hash(int argc, char **argv) {
+	int radius = argc > 0 ? atoi(argv[0]) : HASH_BENCH_RADIUS;
+	if (radius <= 0) {
+		fprintf(stderr, "Usage: bench hash [radius]\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t side = (size_t)radius * 2 + 1;
+	size_t count = side * side;
+
+	struct Coord *keys = malloc(count * sizeof(struct Coord));
+	if (keys == NULL) {
+		fprintf(stderr, "Failed to allocate keys\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-8s %-12s %8s %8s %6s %11s %12s %12s\n",
+		"workload", "hash", "keys", "slots", "load", "collisions", "hit Mops/s", "miss Mops/s");
+
+	bench_spiral(0, 0, radius, keys);
+	int status = run_workload("spiral", keys, count);
+
+	if (status == EXIT_SUCCESS) {
+		bench_random_coords(0x9E3779B97F4A7C15ULL, HASH_BENCH_RANDOM_RANGE, count, keys);
+		status = run_workload("random", keys, count);
+	}
+
+	free(keys);
+	return status;
+}
+
+int bench_probe(int argc, char **argv) {
+	(void)argc;
+	(void)argv;
+
+	static int value;
+	static const float loads[] = {0.25F, 0.5F, 0.75F, 0.875F, 0.95F};
+
+	struct Coord *keys = malloc(PROBE_BENCH_CAPACITY * sizeof(struct Coord));
+	if (keys == NULL) {
+		fprintf(stderr, "Failed to allocate keys\n");
+		return EXIT_FAILURE;
+	}
+
+	bench_random_coords(0xC0FFEEULL, HASH_BENCH_RANDOM_RANGE, PROBE_BENCH_CAPACITY, keys);
+
+	struct {
+		const char *name;
+		enum HashmapProbe probe;
+	} variants[] = {
+		{"linear", HASHMAP_PROBE_LINEAR},
+		{"group", HASHMAP_PROBE_GROUP},
+	};
+
+	printf("%-8s %6s %12s %12s\n", "probe", "load", "hit Mops/s", "miss Mops/s");
+
+	for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+		size_t count = (size_t)(loads[l] * (float)PROBE_BENCH_CAPACITY);
+
+		for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+			struct HashmapConfig config = {
+				.capacity = PROBE_BENCH_CAPACITY,
+				.probe = variants[v].probe,
+			};
+
+			HASHMAP *hashmap = hashmap_create_with(&config);
+			if (hashmap == NULL) {
+				fprintf(stderr, "Failed to allocate hashmap\n");
+				free(keys);
+				return EXIT_FAILURE;
+			}
+
+			for (size_t i = 0; i < count; i++) {
+				hashmap_insert(hashmap, keys[i].x, keys[i].z, &value);
+			}
+
+			double hits = lookups_per_sec(hashmap, keys, count, 0);
+			double misses = lookups_per_sec(hashmap, keys, count, 1 << 20);
+
+			printf("%-8s %6.3f %12.2f %12.2f\n", variants[v].name,
+				(double)hashmap_size(hashmap) / (double)hashmap_capacity(hashmap),
+				hits / 1e6, misses / 1e6);
+
+			hashmap_destroy(hashmap);
+		}
+	}
+
+	free(keys);
+	return EXIT_SUCCESS;
+}
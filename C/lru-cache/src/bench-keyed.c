@@ -0,0 +1,218 @@
+/**
+ * The macro generated caches against the hand written ones. A chunk cache
+ * generated for struct LRUCacheKey runs the circular walk next to
+ * lru-cache.c, the section cache runs the same walk over every section of
+ * each column, and the 64 bit handle map is looked up next to a HASHMAP
+ * keyed by the handle split into two ints.
+ *
+ * Usage: bench keyed [render distance]
+ */
+
+#include "bench.h"
+#include "hashmap.h"
+#include "keyed-caches.h"
+#include "lru-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define KEYED_BENCH_FRAMES	   20000
+#define KEYED_BENCH_SECTIONS   8 // Sections per column the walk keeps loaded
+#define KEYED_BENCH_HANDLES	   (1 << 16)
+#define KEYED_BENCH_HANDLE_OPS (1 << 22)
+
+static inline uint64_t chunk_key_hash(struct LRUCacheKey key) {
+	return hashmap_hash_coords(key.x, key.z);
+}
+
+static inline bool chunk_key_equal(struct LRUCacheKey a, struct LRUCacheKey b) {
+	return a.x == b.x && a.z == b.z;
+}
+
+KEYED_LRU_DECLARE(CHUNKCACHE, chunk_cache, struct LRUCacheKey)
+KEYED_LRU_DEFINE(CHUNKCACHE, chunk_cache, struct LRUCacheKey, chunk_key_hash, chunk_key_equal)
+
+static void keyed_print(const char *name, size_t ops, size_t hits, double ns) {
+	printf("%-16s %12zu %9.2f%% %10.2f\n", name, ops, (double)hits * 100.0 / (double)ops, ns / (double)ops);
+}
+
+static int keyed_chunks(int renderDistance, struct Coord *frame) {
+	static int value;
+
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+
+	LRUCACHE *cache = lru_cache_create(diameter * diameter);
+	CHUNKCACHE *generated = chunk_cache_create(diameter * diameter, NULL, NULL);
+	if (cache == NULL || generated == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		if (cache != NULL) {
+			lru_cache_destroy(cache);
+		}
+		if (generated != NULL) {
+			chunk_cache_destroy(generated);
+		}
+		return EXIT_FAILURE;
+	}
+
+	size_t ops = 0;
+	size_t hits = 0;
+	size_t generated_hits = 0;
+	double ns = 0.0;
+	double generated_ns = 0.0;
+
+	for (int t = 0; t < KEYED_BENCH_FRAMES; t++) {
+		size_t count = bench_orbit_frame(t, renderDistance, frame);
+
+		double start = bench_now_ns();
+		for (size_t i = 0; i < count; i++) {
+			if (lru_cache_get(cache, frame[i].x, frame[i].z) != NULL) {
+				hits++;
+			} else {
+				lru_cache_put(cache, frame[i].x, frame[i].z, &value);
+			}
+		}
+		double middle = bench_now_ns();
+		for (size_t i = 0; i < count; i++) {
+			struct LRUCacheKey key = {frame[i].x, frame[i].z};
+			if (chunk_cache_get(generated, key) != NULL) {
+				generated_hits++;
+			} else {
+				chunk_cache_put(generated, key, &value);
+			}
+		}
+
+		ns += middle - start;
+		generated_ns += bench_now_ns() - middle;
+		ops += count;
+	}
+
+	keyed_print("lru-cache.c", ops, hits, ns);
+	keyed_print("chunk_cache", ops, generated_hits, generated_ns);
+
+	lru_cache_destroy(cache);
+	chunk_cache_destroy(generated);
+	return EXIT_SUCCESS;
+}
+
+static int keyed_sections(int renderDistance, struct Coord *frame) {
+	static int value;
+
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+
+	SECTIONCACHE *cache = section_cache_create(diameter * diameter * KEYED_BENCH_SECTIONS, NULL, NULL);
+	if (cache == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t ops = 0;
+	size_t hits = 0;
+	double ns = 0.0;
+
+	for (int t = 0; t < KEYED_BENCH_FRAMES; t++) {
+		size_t count = bench_orbit_frame(t, renderDistance, frame);
+
+		double start = bench_now_ns();
+		for (size_t i = 0; i < count; i++) {
+			for (int y = 0; y < KEYED_BENCH_SECTIONS; y++) {
+				struct SectionKey key = {frame[i].x, y, frame[i].z};
+				if (section_cache_get(cache, key) != NULL) {
+					hits++;
+				} else {
+					section_cache_put(cache, key, &value);
+				}
+			}
+		}
+		ns += bench_now_ns() - start;
+		ops += count * KEYED_BENCH_SECTIONS;
+	}
+
+	keyed_print("section_cache", ops, hits, ns);
+
+	section_cache_destroy(cache);
+	return EXIT_SUCCESS;
+}
+
+static int keyed_handles(void) {
+	static int value;
+
+	uint64_t *handles = malloc(KEYED_BENCH_HANDLES * sizeof(uint64_t));
+	HANDLEMAP *map = handle_map_create(KEYED_BENCH_HANDLES * 2);
+	HASHMAP *split = hashmap_create(KEYED_BENCH_HANDLES * 2);
+	int status = EXIT_SUCCESS;
+
+	if (handles == NULL || map == NULL || split == NULL) {
+		fprintf(stderr, "Failed to allocate handle map\n");
+		status = EXIT_FAILURE;
+	}
+
+	uint64_t state = 0x2545F4914F6CDD1DULL;
+	for (size_t i = 0; i < KEYED_BENCH_HANDLES && status == EXIT_SUCCESS; i++) {
+		handles[i] = bench_rand(&state);
+		handle_map_insert(map, handles[i], &value);
+		hashmap_insert(split, (int)(uint32_t)(handles[i] >> 32), (int)(uint32_t)handles[i], &value);
+	}
+
+	if (status == EXIT_SUCCESS) {
+		size_t hits = 0;
+		size_t split_hits = 0;
+
+		double start = bench_now_ns();
+		for (size_t i = 0; i < KEYED_BENCH_HANDLE_OPS; i++) {
+			hits += handle_map_get(map, handles[(i * 7919) & (KEYED_BENCH_HANDLES - 1)]) != NULL;
+		}
+		double middle = bench_now_ns();
+		for (size_t i = 0; i < KEYED_BENCH_HANDLE_OPS; i++) {
+			uint64_t handle = handles[(i * 7919) & (KEYED_BENCH_HANDLES - 1)];
+			split_hits += hashmap_get(split, (int)(uint32_t)(handle >> 32), (int)(uint32_t)handle) != NULL;
+		}
+		double end = bench_now_ns();
+
+		keyed_print("handle_map", KEYED_BENCH_HANDLE_OPS, hits, middle - start);
+		keyed_print("hashmap split", KEYED_BENCH_HANDLE_OPS, split_hits, end - middle);
+	}
+
+	free(handles);
+	if (map != NULL) {
+		handle_map_destroy(map);
+	}
+	if (split != NULL) {
+		hashmap_destroy(split);
+	}
+
+	return status;
+}
+
+int bench_keyed(int argc, char **argv) {
+	int renderDistance = 8;
+
+	if (argc > 0) {
+		renderDistance = atoi(argv[0]);
+
+		if (renderDistance <= 0) {
+			fprintf(stderr, "Usage: bench keyed [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+	if (frame == NULL) {
+		fprintf(stderr, "Failed to allocate frame\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-16s %12s %10s %10s\n", "cache", "ops", "hit rate", "ns/op");
+
+	int status = keyed_chunks(renderDistance, frame);
+	if (status == EXIT_SUCCESS) {
+		status = keyed_sections(renderDistance, frame);
+	}
+	if (status == EXIT_SUCCESS) {
+		status = keyed_handles();
+	}
+
+	free(frame);
+	return status;
+}
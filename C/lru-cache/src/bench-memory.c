@@ -0,0 +1,289 @@
+/**
+ * Random lookups into a large cache and a large static hashmap, once per
+ * allocation mode:
+ *
+ * - default: plain malloc, nodes and entries fall wherever the block starts
+ * - aligned: every array starts on a cache line and nodes are padded so none
+ *   straddles two lines
+ * - huge: aligned, and the block is mapped on 2 MiB boundaries with
+ *   MADV_HUGEPAGE so transparent huge pages can back it
+ *
+ * Lookup keys are picked at random from the keys that were put, so every
+ * lookup lands on a cold slot and node. dTLB load misses and last level cache
+ * misses are counted in user space through perf_event_open. They show n/a
+ * when the kernel refuses the counters, e.g. with a perf_event_paranoid above
+ * 2 or in a VM without a virtual PMU. huge MiB is how much of the process was
+ * backed by transparent huge pages after the fill, from
+ * /proc/self/smaps_rollup.
+ *
+ * Usage: bench memory [capacity]
+ */
+
+// syscall and the perf ioctls are not part of -std=c11
+#define _DEFAULT_SOURCE
+
+#include "bench.h"
+#include "block-memory.h"
+#include "hashmap.h"
+#include "lru-cache.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define MEMORY_BENCH_CAPACITY (1 << 20)
+#define MEMORY_BENCH_LOOKUPS  (1 << 22)
+#define MEMORY_BENCH_SEED	  0x9E3779B97F4A7C15ULL
+
+static const struct {
+	const char *name;
+	enum BlockMemory memory;
+} modes[] = {
+	{"default", BLOCK_MEMORY_DEFAULT},
+	{"aligned", BLOCK_MEMORY_ALIGNED},
+	{"huge", BLOCK_MEMORY_HUGE},
+};
+
+enum MemoryCounter {
+	MEMORY_COUNTER_DTLB,
+	MEMORY_COUNTER_CACHE,
+	MEMORY_COUNTER_COUNT
+};
+
+/** Counter file descriptors, -1 for a counter the kernel refused */
+struct MemoryCounters {
+	int fds[MEMORY_COUNTER_COUNT];
+};
+
+#ifdef __linux__
+static int memory_counter_open(uint32_t type, uint64_t config) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1; // Allowed up to perf_event_paranoid 2
+	attr.exclude_hv = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void memory_counters_open(struct MemoryCounters *counters) {
+#ifdef __linux__
+	counters->fds[MEMORY_COUNTER_DTLB] = memory_counter_open(PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	counters->fds[MEMORY_COUNTER_CACHE] = memory_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#else
+	for (int i = 0; i < MEMORY_COUNTER_COUNT; i++) {
+		counters->fds[i] = -1;
+	}
+#endif
+}
+
+static void memory_counters_close(struct MemoryCounters *counters) {
+#ifdef __linux__
+	for (int i = 0; i < MEMORY_COUNTER_COUNT; i++) {
+		if (counters->fds[i] >= 0) {
+			close(counters->fds[i]);
+		}
+	}
+#else
+	(void)counters;
+#endif
+}
+
+static void memory_counters_start(struct MemoryCounters *counters) {
+#ifdef __linux__
+	for (int i = 0; i < MEMORY_COUNTER_COUNT; i++) {
+		if (counters->fds[i] >= 0) {
+			ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#else
+	(void)counters;
+#endif
+}
+
+/** Stops the counters and reads them, a counter that could not be read is left at -1 */
+static void memory_counters_stop(struct MemoryCounters *counters, double counts[MEMORY_COUNTER_COUNT]) {
+	for (int i = 0; i < MEMORY_COUNTER_COUNT; i++) {
+		counts[i] = -1.0;
+#ifdef __linux__
+		uint64_t count;
+		if (counters->fds[i] >= 0 && ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0) == 0 &&
+			read(counters->fds[i], &count, sizeof(count)) == (ssize_t)sizeof(count)) {
+			counts[i] = (double)count;
+		}
+#endif
+	}
+}
+
+/** AnonHugePages of the whole process in MiB, -1 when it cannot be read */
+static double memory_huge_mib(void) {
+	FILE *file = fopen("/proc/self/smaps_rollup", "r");
+	if (file == NULL) {
+		return -1.0;
+	}
+
+	char line[256];
+	double mib = -1.0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		unsigned long kib;
+		if (sscanf(line, "AnonHugePages: %lu kB", &kib) == 1) {
+			mib = (double)kib / 1024.0;
+			break;
+		}
+	}
+
+	fclose(file);
+	return mib;
+}
+
+/** Key i of the fill, spread over a range far larger than the capacity so neighbouring keys share nothing */
+static inline struct Coord memory_key(size_t i) {
+	uint64_t h = hashmap_hash_coords((int)i, (int)(MEMORY_BENCH_SEED >> 32));
+	struct Coord key = {(int)(h & 0xFFFFF) - 0x80000, (int)((h >> 20) & 0xFFFFF) - 0x80000};
+	return key;
+}
+
+static void memory_format(char *out, size_t size, double count) {
+	if (count < 0.0) {
+		snprintf(out, size, "n/a");
+	} else {
+		snprintf(out, size, "%.3f", count / MEMORY_BENCH_LOOKUPS);
+	}
+}
+
+static void memory_report(const char *structure, const char *mode, double ns, const double counts[MEMORY_COUNTER_COUNT],
+	double huge) {
+	char dtlb[32];
+	char cache[32];
+	memory_format(dtlb, sizeof(dtlb), counts[MEMORY_COUNTER_DTLB]);
+	memory_format(cache, sizeof(cache), counts[MEMORY_COUNTER_CACHE]);
+
+	char hugeText[32];
+	if (huge < 0.0) {
+		snprintf(hugeText, sizeof(hugeText), "n/a");
+	} else {
+		snprintf(hugeText, sizeof(hugeText), "%.0f", huge);
+	}
+
+	printf("%-8s %-8s %10.1f %12s %12s %10s\n", structure, mode, ns / MEMORY_BENCH_LOOKUPS, dtlb, cache, hugeText);
+}
+
+static int memory_run_cache(size_t m, size_t capacity, struct MemoryCounters *counters) {
+	struct LRUCacheConfig config = {
+		.capacity = capacity,
+		.memory = modes[m].memory,
+	};
+
+	LRUCACHE *cache = lru_cache_create_with(&config);
+	if (cache == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		return EXIT_FAILURE;
+	}
+
+	static int value;
+	for (size_t i = 0; i < capacity; i++) {
+		struct Coord key = memory_key(i);
+		lru_cache_put(cache, key.x, key.z, &value);
+	}
+
+	double huge = memory_huge_mib();
+	uint64_t state = MEMORY_BENCH_SEED;
+	size_t found = 0;
+	double counts[MEMORY_COUNTER_COUNT];
+
+	memory_counters_start(counters);
+	double start = bench_now_ns();
+	for (size_t i = 0; i < MEMORY_BENCH_LOOKUPS; i++) {
+		struct Coord key = memory_key(bench_rand(&state) % capacity);
+		found += lru_cache_get(cache, key.x, key.z) != NULL;
+	}
+	double ns = bench_now_ns() - start;
+	memory_counters_stop(counters, counts);
+
+	memory_report("cache", modes[m].name, ns, counts, huge);
+	lru_cache_destroy(cache);
+
+	// Keeps the lookups from being optimised away
+	return found > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int memory_run_hashmap(size_t m, size_t capacity, struct MemoryCounters *counters) {
+	// Twice the slots so the static map ends up half full
+	struct HashmapConfig config = {
+		.capacity = capacity * 2,
+		.memory = modes[m].memory,
+	};
+
+	HASHMAP *hashmap = hashmap_create_with(&config);
+	if (hashmap == NULL) {
+		fprintf(stderr, "Failed to allocate hashmap\n");
+		return EXIT_FAILURE;
+	}
+
+	static int value;
+	for (size_t i = 0; i < capacity; i++) {
+		struct Coord key = memory_key(i);
+		hashmap_insert(hashmap, key.x, key.z, &value);
+	}
+
+	double huge = memory_huge_mib();
+	uint64_t state = MEMORY_BENCH_SEED;
+	size_t found = 0;
+	double counts[MEMORY_COUNTER_COUNT];
+
+	memory_counters_start(counters);
+	double start = bench_now_ns();
+	for (size_t i = 0; i < MEMORY_BENCH_LOOKUPS; i++) {
+		struct Coord key = memory_key(bench_rand(&state) % capacity);
+		found += hashmap_get(hashmap, key.x, key.z) != NULL;
+	}
+	double ns = bench_now_ns() - start;
+	memory_counters_stop(counters, counts);
+
+	memory_report("hashmap", modes[m].name, ns, counts, huge);
+	hashmap_destroy(hashmap);
+
+	return found > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int bench_memory(int argc, char **argv) {
+	int capacity = MEMORY_BENCH_CAPACITY;
+
+	if (argc > 0) {
+		capacity = atoi(argv[0]);
+
+		if (capacity <= 1) {
+			fprintf(stderr, "Usage: bench memory [capacity]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	struct MemoryCounters counters;
+	memory_counters_open(&counters);
+
+	printf("%-8s %-8s %10s %12s %12s %10s\n", "table", "memory", "ns/lookup", "dTLB/lookup", "LLC/lookup", "huge MiB");
+
+	int status = EXIT_SUCCESS;
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]) && status == EXIT_SUCCESS; m++) {
+		status = memory_run_cache(m, (size_t)capacity, &counters);
+	}
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]) && status == EXIT_SUCCESS; m++) {
+		status = memory_run_hashmap(m, (size_t)capacity, &counters);
+	}
+
+	memory_counters_close(&counters);
+	return status;
+}
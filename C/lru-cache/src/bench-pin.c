@@ -0,0 +1,162 @@
+/**
+ * Circular walk where every chunk loaded in a frame is handed to a mesher
+ * that pins it and its four neighbors, like mesh_chunk in voxel-terrain, and
+ * only unpins them a few frames later. Reports how many puts had to pass
+ * over pinned values to find a victim. Like a bounded job queue, the mesher
+ * stops taking jobs while half the cache is pinned.
+ *
+ * Usage: bench pin [render distance]
+ */
+
+#include "bench.h"
+#include "lru-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PIN_BENCH_FRAMES	 20000
+#define PIN_BENCH_MAX_LATENCY 16
+
+static const int latencies[] = {1, 4, PIN_BENCH_MAX_LATENCY};
+
+static const int neighbors[5][2] = {{0, 0}, {0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+
+static const struct {
+	const char *name;
+	enum LRUCachePolicy policy;
+} policies[] = {
+	{"lru", LRU_CACHE_POLICY_LRU},
+	{"clock", LRU_CACHE_POLICY_CLOCK},
+	{"2q", LRU_CACHE_POLICY_2Q},
+	{"tinylfu", LRU_CACHE_POLICY_TINYLFU},
+};
+
+/** Pins taken by the mesh jobs started in one frame */
+struct PinFrame {
+	struct Coord *pinned;
+	size_t count;
+};
+
+static int pin_run(size_t p, int latency, int renderDistance, struct Coord *frame, struct PinFrame *jobs) {
+	static int value;
+
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+
+	struct LRUCacheConfig config = {
+		.capacity = diameter * diameter,
+		.policy = policies[p].policy,
+	};
+
+	LRUCACHE *cache = lru_cache_create_with(&config);
+	if (cache == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t puts = 0;
+	size_t max_pinned = 0;
+
+	for (int t = 0; t < PIN_BENCH_FRAMES; t++) {
+		// Jobs started latency frames ago are done
+		struct PinFrame *job = &jobs[t % latency];
+		for (size_t i = 0; i < job->count; i++) {
+			lru_cache_unpin(cache, job->pinned[i].x, job->pinned[i].z);
+		}
+		job->count = 0;
+
+		size_t count = bench_orbit_frame(t, renderDistance, frame);
+		for (size_t i = 0; i < count; i++) {
+			if (lru_cache_get(cache, frame[i].x, frame[i].z) != NULL) {
+				continue;
+			}
+
+			lru_cache_put(cache, frame[i].x, frame[i].z, &value);
+			puts++;
+
+			struct LRUCachePinStats stats;
+			lru_cache_pin_stats(cache, &stats);
+			if (stats.pinned + 5 > config.capacity / 2) {
+				continue;
+			}
+
+			// The mesher needs the chunk and whichever neighbors are loaded
+			for (int n = 0; n < 5; n++) {
+				int x = frame[i].x + neighbors[n][0];
+				int z = frame[i].z + neighbors[n][1];
+				if (lru_cache_pin(cache, x, z) != NULL) {
+					job->pinned[job->count].x = x;
+					job->pinned[job->count].z = z;
+					job->count++;
+				}
+			}
+		}
+
+		struct LRUCachePinStats stats;
+		lru_cache_pin_stats(cache, &stats);
+		max_pinned = stats.pinned > max_pinned ? stats.pinned : max_pinned;
+	}
+
+	struct LRUCachePinStats stats;
+	lru_cache_pin_stats(cache, &stats);
+
+	printf("%-7s %8d %7d %8zu %10zu %10zu %10zu %8.2f%%\n", policies[p].name, renderDistance, latency,
+		config.capacity, max_pinned, stats.skipped, stats.skipping_puts,
+		puts == 0 ? 0.0 : (double)stats.skipping_puts * 100.0 / (double)puts);
+
+	for (int i = 0; i < latency; i++) {
+		struct PinFrame *pending = &jobs[i];
+		for (size_t j = 0; j < pending->count; j++) {
+			lru_cache_unpin(cache, pending->pinned[j].x, pending->pinned[j].z);
+		}
+		pending->count = 0;
+	}
+
+	lru_cache_destroy(cache);
+	return EXIT_SUCCESS;
+}
+
+int bench_pin(int argc, char **argv) {
+	int renderDistance = 8;
+
+	if (argc > 0) {
+		renderDistance = atoi(argv[0]);
+
+		if (renderDistance <= 0) {
+			fprintf(stderr, "Usage: bench pin [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	size_t count = side * side;
+
+	struct Coord *frame = malloc(count * sizeof(struct Coord));
+	struct Coord *pinned = malloc(PIN_BENCH_MAX_LATENCY * count * 5 * sizeof(struct Coord));
+	struct PinFrame jobs[PIN_BENCH_MAX_LATENCY];
+
+	int status = EXIT_SUCCESS;
+	if (frame == NULL || pinned == NULL) {
+		fprintf(stderr, "Failed to allocate frame\n");
+		status = EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < PIN_BENCH_MAX_LATENCY && pinned != NULL; i++) {
+		jobs[i].pinned = pinned + (size_t)i * count * 5;
+		jobs[i].count = 0;
+	}
+
+	if (status == EXIT_SUCCESS) {
+		printf("%-7s %8s %7s %8s %10s %10s %10s %9s\n", "policy", "distance", "latency", "capacity", "max pinned",
+			"skipped", "skip puts", "of puts");
+	}
+
+	for (size_t l = 0; l < sizeof(latencies) / sizeof(latencies[0]) && status == EXIT_SUCCESS; l++) {
+		for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]) && status == EXIT_SUCCESS; p++) {
+			status = pin_run(p, latencies[l], renderDistance, frame, jobs);
+		}
+	}
+
+	free(frame);
+	free(pinned);
+	return status;
+}
@@ -0,0 +1,193 @@
+/**
+ * Replays movement traces through the cache with each replacement policy:
+ * the circular walk from main.c, a straight flight back and forth, and the
+ * circular walk interrupted by trips away from home. Every frame looks up
+ * the spiral around the player and puts on a miss, like the game loop. A
+ * second pass over the same frame is all hits and gives the hit latency on
+ * its own.
+ *
+ * The fused row runs the same walk through lru_map_entry, so a put on miss
+ * costs a single probe.
+ *
+ * Usage: bench policy [render distance]
+ */
+
+#include "bench.h"
+#include "lru-cache.h"
+#include "lru-map.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define POLICY_BENCH_FRAMES 20000
+
+struct PolicyWorkload {
+	const char *name;
+	BenchFrameFn frame;
+};
+
+static const struct PolicyWorkload workloads[] = {
+	{"orbit", bench_orbit_frame},
+	{"flight", bench_flight_frame},
+	{"excursion", bench_excursion_frame},
+};
+
+struct PolicyRow {
+	const char *name;
+	enum LRUCachePolicy policy;
+};
+
+static const struct PolicyRow policies[] = {
+	{"lru", LRU_CACHE_POLICY_LRU},
+	{"clock", LRU_CACHE_POLICY_CLOCK},
+	{"2q", LRU_CACHE_POLICY_2Q},
+	{"tinylfu", LRU_CACHE_POLICY_TINYLFU},
+};
+
+static int policy_run(const struct PolicyWorkload *workload, const struct PolicyRow *row, int renderDistance, struct Coord *frame) {
+	static int value;
+
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+
+	struct LRUCacheConfig config = {
+		.capacity = diameter * diameter,
+		.policy = row->policy,
+	};
+
+	LRUCACHE *cache = lru_cache_create_with(&config);
+	if (cache == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t ops = 0;
+	size_t hits = 0;
+	size_t rehits = 0;
+	double replay_ns = 0.0;
+	double hit_ns = 0.0;
+
+	for (int t = 0; t < POLICY_BENCH_FRAMES; t++) {
+		size_t count = workload->frame(t, renderDistance, frame);
+
+		double start = bench_now_ns();
+		for (size_t i = 0; i < count; i++) {
+			if (lru_cache_get(cache, frame[i].x, frame[i].z) != NULL) {
+				hits++;
+			} else {
+				lru_cache_put(cache, frame[i].x, frame[i].z, &value);
+			}
+		}
+		double middle = bench_now_ns();
+		for (size_t i = 0; i < count; i++) {
+			rehits += lru_cache_get(cache, frame[i].x, frame[i].z) != NULL;
+		}
+		double end = bench_now_ns();
+
+		ops += count;
+		replay_ns += middle - start;
+		hit_ns += end - middle;
+	}
+
+	printf("%-9s %-7s %8d %8zu %9.2f%% %10.1f %10.1f\n", workload->name, row->name, renderDistance, config.capacity,
+		(double)hits * 100.0 / (double)ops, replay_ns / (double)ops, hit_ns / (double)rehits);
+
+	lru_cache_destroy(cache);
+	return EXIT_SUCCESS;
+}
+
+static int fused_run(const struct PolicyWorkload *workload, int renderDistance, struct Coord *frame) {
+	static int value;
+
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+
+	struct LRUCacheConfig config = {
+		.capacity = diameter * diameter,
+	};
+
+	LRUMAP *map = lru_map_create(&config);
+	if (map == NULL) {
+		fprintf(stderr, "Failed to allocate map\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t ops = 0;
+	size_t hits = 0;
+	size_t rehits = 0;
+	double replay_ns = 0.0;
+	double hit_ns = 0.0;
+
+	for (int t = 0; t < POLICY_BENCH_FRAMES; t++) {
+		size_t count = workload->frame(t, renderDistance, frame);
+
+		double start = bench_now_ns();
+		for (size_t i = 0; i < count; i++) {
+			bool found = false;
+			void **entry = lru_map_entry(map, frame[i].x, frame[i].z, &found);
+			if (found) {
+				hits++;
+			} else {
+				*entry = &value;
+			}
+		}
+		double middle = bench_now_ns();
+		for (size_t i = 0; i < count; i++) {
+			rehits += lru_map_get(map, frame[i].x, frame[i].z) != NULL;
+		}
+		double end = bench_now_ns();
+
+		ops += count;
+		replay_ns += middle - start;
+		hit_ns += end - middle;
+	}
+
+	printf("%-9s %-7s %8d %8zu %9.2f%% %10.1f %10.1f\n", workload->name, "fused", renderDistance, config.capacity,
+		(double)hits * 100.0 / (double)ops, replay_ns / (double)ops, hit_ns / (double)rehits);
+
+	lru_map_destroy(map);
+	return EXIT_SUCCESS;
+}
+
+int bench_policy(int argc, char **argv) {
+	int distances[] = {1, 8, 16};
+	size_t distance_count = sizeof(distances) / sizeof(distances[0]);
+
+	if (argc > 0) {
+		distances[0] = atoi(argv[0]);
+		distance_count = 1;
+
+		if (distances[0] <= 0) {
+			fprintf(stderr, "Usage: bench policy [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%-9s %-7s %8s %8s %10s %10s %10s\n", "workload", "policy", "distance", "capacity", "hit rate", "ns/op",
+		"ns/hit");
+
+	for (size_t d = 0; d < distance_count; d++) {
+		size_t side = (size_t)distances[d] * 2 + 1;
+		struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+		if (frame == NULL) {
+			fprintf(stderr, "Failed to allocate frame\n");
+			return EXIT_FAILURE;
+		}
+
+		int status = EXIT_SUCCESS;
+		for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]) && status == EXIT_SUCCESS; w++) {
+			for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]) && status == EXIT_SUCCESS; p++) {
+				status = policy_run(&workloads[w], &policies[p], distances[d], frame);
+			}
+			if (status == EXIT_SUCCESS) {
+				status = fused_run(&workloads[w], distances[d], frame);
+			}
+		}
+
+		free(frame);
+		if (status != EXIT_SUCCESS) {
+			return status;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,208 @@
+/**
+ * Misses at the edge of the spiral with and without velocity prefetching.
+ * Chunk generation is simulated: a claimed chunk is published a fixed number
+ * of frames later, and only so many chunks can be started per frame. Every
+ * frame scans the spiral through lru_cache_get_state, counting each chunk
+ * that is not Ready as a miss and claiming the unloaded ones first. With
+ * prefetch, the generation slots left over go to the chunks
+ * chunk_prefetch_plan expects the player to see next, claimed cold with
+ * lru_cache_prefetch. Edge misses are the misses on the outermost ring of
+ * the spiral, the chunks that just came into view.
+ *
+ * Usage: bench prefetch [render distance]
+ */
+
+#include "bench.h"
+#include "chunk-prefetch.h"
+#include "lru-cache.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PREFETCH_BENCH_FRAMES	 20000
+#define PREFETCH_BENCH_LATENCY	 6 // Frames from claiming a chunk until it is published
+#define PREFETCH_BENCH_LOOKAHEAD 8 // Frames ahead the prefetcher predicts, a little past the latency
+#define PREFETCH_BENCH_SLOTS	 2 // Chunks started per frame, in view widths
+
+struct PrefetchJob {
+	uint32_t ticket;
+	int due;
+};
+
+static const struct {
+	const char *name;
+	BenchFrameFn frame;
+} workloads[] = {
+	{"orbit", bench_orbit_frame},
+	{"flight", bench_flight_frame},
+	{"excursion", bench_excursion_frame},
+};
+
+static const struct {
+	const char *name;
+	enum LRUCachePolicy policy;
+} policies[] = {
+	{"lru", LRU_CACHE_POLICY_LRU},
+	{"clock", LRU_CACHE_POLICY_CLOCK},
+	{"2q", LRU_CACHE_POLICY_2Q},
+	{"tinylfu", LRU_CACHE_POLICY_TINYLFU},
+};
+
+/** Generation jobs in flight, a FIFO since they all take the same number of frames */
+struct PrefetchQueue {
+	struct PrefetchJob *jobs;
+	size_t capacity;
+	size_t head;
+	size_t count;
+};
+
+static void prefetch_enqueue(struct PrefetchQueue *queue, uint32_t ticket, int due) {
+	assert(queue->count < queue->capacity);
+
+	queue->jobs[(queue->head + queue->count) % queue->capacity] = (struct PrefetchJob){ticket, due};
+	queue->count++;
+}
+
+static int prefetch_run(size_t w, size_t p, bool prefetching, int renderDistance, struct Coord *frame,
+	struct LRUCacheKey *planned, struct PrefetchQueue *queue) {
+	static int value;
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+	size_t slots = side * PREFETCH_BENCH_SLOTS;
+
+	struct LRUCacheConfig config = {
+		.capacity = diameter * diameter,
+		.policy = policies[p].policy,
+	};
+
+	LRUCACHE *cache = lru_cache_create_with(&config);
+	CHUNKPREFETCH *prefetch = chunk_prefetch_create(PREFETCH_BENCH_LOOKAHEAD);
+	if (cache == NULL || prefetch == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		if (cache != NULL) {
+			lru_cache_destroy(cache);
+		}
+		if (prefetch != NULL) {
+			chunk_prefetch_destroy(prefetch);
+		}
+		return EXIT_FAILURE;
+	}
+
+	queue->head = 0;
+	queue->count = 0;
+
+	size_t ops = 0;
+	size_t misses = 0;
+	size_t edge_ops = 0;
+	size_t edge_misses = 0;
+	size_t prefetched = 0;
+
+	for (int t = 0; t < PREFETCH_BENCH_FRAMES; t++) {
+		while (queue->count > 0 && queue->jobs[queue->head].due <= t) {
+			lru_cache_publish(cache, queue->jobs[queue->head].ticket);
+			queue->head = (queue->head + 1) % queue->capacity;
+			queue->count--;
+		}
+
+		size_t budget = slots;
+		size_t count = workloads[w].frame(t, renderDistance, frame);
+
+		// The spiral starts at the player's chunk
+		int centerX = frame[0].x;
+		int centerZ = frame[0].z;
+
+		for (size_t i = 0; i < count; i++) {
+			int dx = abs(frame[i].x - centerX);
+			int dz = abs(frame[i].z - centerZ);
+			bool edge = (dx > dz ? dx : dz) == renderDistance;
+
+			enum LRUCacheState state = lru_cache_get_state(cache, frame[i].x, frame[i].z, NULL);
+			if (state == LRU_CACHE_READY || state == LRU_CACHE_DIRTY) {
+				edge_ops += edge;
+				continue;
+			}
+
+			misses++;
+			edge_ops += edge;
+			edge_misses += edge;
+
+			if (state == LRU_CACHE_UNLOADED && budget > 0) {
+				prefetch_enqueue(queue, lru_cache_claim(cache, frame[i].x, frame[i].z, &value),
+					t + PREFETCH_BENCH_LATENCY);
+				budget--;
+			}
+		}
+		ops += count;
+
+		if (!prefetching) {
+			continue;
+		}
+
+		chunk_prefetch_observe(prefetch, (float)centerX, (float)centerZ);
+		size_t plans = chunk_prefetch_plan(prefetch, renderDistance, planned, side * side);
+
+		for (size_t i = 0; i < plans && budget > 0; i++) {
+			uint32_t ticket = lru_cache_prefetch(cache, planned[i].x, planned[i].z, &value);
+			if (ticket != LRU_CACHE_NO_TICKET) {
+				prefetch_enqueue(queue, ticket, t + PREFETCH_BENCH_LATENCY);
+				prefetched++;
+				budget--;
+			}
+		}
+	}
+
+	printf("%-9s %-8s %-8s %11.2f%% %9.2f%% %10zu\n", workloads[w].name, policies[p].name, prefetching ? "on" : "off",
+		(double)edge_misses * 100.0 / (double)edge_ops, (double)misses * 100.0 / (double)ops, prefetched);
+
+	lru_cache_destroy(cache);
+	chunk_prefetch_destroy(prefetch);
+	return EXIT_SUCCESS;
+}
+
+int bench_prefetch(int argc, char **argv) {
+	int renderDistance = 8;
+
+	if (argc > 0) {
+		renderDistance = atoi(argv[0]);
+
+		if (renderDistance <= 0) {
+			fprintf(stderr, "Usage: bench prefetch [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+	struct LRUCacheKey *planned = malloc(side * side * sizeof(struct LRUCacheKey));
+
+	// Every job is published after the same number of frames, so this many are in flight at most
+	struct PrefetchQueue queue = {
+		.capacity = side * PREFETCH_BENCH_SLOTS * (PREFETCH_BENCH_LATENCY + 1),
+	};
+	queue.jobs = malloc(queue.capacity * sizeof(struct PrefetchJob));
+
+	int status = EXIT_SUCCESS;
+	if (frame == NULL || planned == NULL || queue.jobs == NULL) {
+		fprintf(stderr, "Failed to allocate frame\n");
+		status = EXIT_FAILURE;
+	} else {
+		printf("%-9s %-8s %-8s %12s %10s %10s\n", "trace", "policy", "prefetch", "edge misses", "misses", "prefetched");
+	}
+
+	for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]) && status == EXIT_SUCCESS; w++) {
+		for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]) && status == EXIT_SUCCESS; p++) {
+			status = prefetch_run(w, p, false, renderDistance, frame, planned, &queue);
+			if (status == EXIT_SUCCESS) {
+				status = prefetch_run(w, p, true, renderDistance, frame, planned, &queue);
+			}
+		}
+	}
+
+	free(frame);
+	free(planned);
+	free(queue.jobs);
+	return status;
+}
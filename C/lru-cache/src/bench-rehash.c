@@ -0,0 +1,133 @@
+/**
+ * Random inserts, updates, removes and gets on a resizable hashmap checked
+ * against a plain array of the expected values. The map starts small, so
+ * growth and the rebuilds caused by tombstones keep an incremental rehash
+ * running for most of the operations, each of which has to see every key in
+ * exactly one of the two tables.
+ *
+ * Reports wrong results per operation and fails if there was any.
+ *
+ * Usage: bench rehash [operations]
+ */
+
+#include "bench.h"
+#include "hashmap.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REHASH_BENCH_KEYS		4096
+#define REHASH_BENCH_CAPACITY	256
+#define REHASH_BENCH_OPERATIONS 2000000
+#define REHASH_BENCH_VALUES		251 // Prime, so successive updates of a key give different values
+
+enum RehashOp {
+	REHASH_OP_PUT, // Insert or update
+	REHASH_OP_REMOVE,
+	REHASH_OP_GET,
+	REHASH_OP_COUNT
+};
+
+static const char *const op_names[REHASH_OP_COUNT] = {"bad put", "bad remove", "bad get"};
+
+static char values[REHASH_BENCH_VALUES];
+
+static int rehash_run(const char *name, enum HashmapProbe probe, size_t operations) {
+	struct HashmapConfig config = {
+		.capacity = REHASH_BENCH_CAPACITY,
+		.max_load_factor = 0.75F,
+		.probe = probe,
+	};
+
+	HASHMAP *hashmap = hashmap_create_with(&config);
+	void **expected = calloc(REHASH_BENCH_KEYS, sizeof(void *));
+	if (hashmap == NULL || expected == NULL) {
+		fprintf(stderr, "Failed to allocate rehash state\n");
+		free(expected);
+		if (hashmap != NULL) {
+			hashmap_destroy(hashmap);
+		}
+		return EXIT_FAILURE;
+	}
+
+	uint64_t rng = 0x5EEDULL;
+	size_t live = 0;
+	size_t wrong[REHASH_OP_COUNT] = {0};
+	double start = bench_now_ns();
+
+	for (size_t i = 0; i < operations; i++) {
+		uint64_t r = bench_rand(&rng);
+		int key = (int)(r % REHASH_BENCH_KEYS);
+		void **slot = &expected[key];
+
+		// Puts win twice as often early on so the map keeps growing, after that the mix holds the size steady
+		enum RehashOp op = (enum RehashOp)((r >> 32) % 4);
+		op = op == REHASH_OP_COUNT ? (i < operations / 4 ? REHASH_OP_PUT : REHASH_OP_REMOVE) : op;
+
+		switch (op) {
+		case REHASH_OP_PUT: {
+			void *value = &values[(r >> 40) % REHASH_BENCH_VALUES];
+			if (!hashmap_insert(hashmap, key, -key, value)) {
+				wrong[op]++;
+				break;
+			}
+			live += *slot == NULL;
+			*slot = value;
+			break;
+		}
+		case REHASH_OP_REMOVE:
+			wrong[op] += hashmap_remove(hashmap, key, -key) != *slot;
+			live -= *slot != NULL;
+			*slot = NULL;
+			break;
+		default:
+			wrong[op] += hashmap_get(hashmap, key, -key) != *slot;
+			break;
+		}
+	}
+
+	double ns = bench_now_ns() - start;
+
+	// Whatever the last operations left behind has to read back too
+	for (int key = 0; key < REHASH_BENCH_KEYS; key++) {
+		wrong[REHASH_OP_GET] += hashmap_get(hashmap, key, -key) != expected[key];
+	}
+
+	size_t total = 0;
+	printf("%-10s %10zu %10zu %10zu", name, hashmap_capacity(hashmap), hashmap_size(hashmap), live);
+	for (int op = 0; op < REHASH_OP_COUNT; op++) {
+		printf(" %10zu", wrong[op]);
+		total += wrong[op];
+	}
+	printf(" %10.1f\n", ns / (double)operations);
+
+	if (total != 0 || hashmap_size(hashmap) != live) {
+		fprintf(stderr, "%s: %zu wrong results, size %zu with %zu live keys\n", name, total, hashmap_size(hashmap), live);
+	}
+
+	bool failed = total != 0 || hashmap_size(hashmap) != live;
+	free(expected);
+	hashmap_destroy(hashmap);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int bench_rehash(int argc, char **argv) {
+	size_t operations = argc > 0 ? (size_t)strtoull(argv[0], NULL, 10) : REHASH_BENCH_OPERATIONS;
+	if (operations == 0) {
+		fprintf(stderr, "Usage: bench rehash [operations]\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-10s %10s %10s %10s", "probe", "capacity", "size", "expected");
+	for (int op = 0; op < REHASH_OP_COUNT; op++) {
+		printf(" %10s", op_names[op]);
+	}
+	printf(" %10s\n", "ns/op");
+
+	int status = EXIT_SUCCESS;
+	status |= rehash_run("linear", HASHMAP_PROBE_LINEAR, operations);
+	status |= rehash_run("group", HASHMAP_PROBE_GROUP, operations);
+	status |= rehash_run("backshift", HASHMAP_PROBE_BACKSHIFT, operations);
+
+	return status;
+}
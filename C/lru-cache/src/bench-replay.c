@@ -0,0 +1,288 @@
+/**
+ * Recording and replaying access logs.
+ *
+ * bench record walks the circle through a cache that logs every access and
+ * through one that does not, and reports the cost of recording and the size
+ * of the log. It needs make bench TRACE=1.
+ *
+ * bench replay decodes a log into memory and runs it through every
+ * replacement policy at the capacity and budget it was recorded with, or at
+ * the given capacity. Pins the recorded run took on chunks that are not
+ * cached under another policy are skipped along with their unpins.
+ *
+ * Usage: bench record <log> [render distance]
+ *        bench replay <log> [capacity]
+ */
+
+#include "bench.h"
+#include "hashmap.h"
+#include "lru-cache.h"
+#include "lru-trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REPLAY_BENCH_FRAMES 20000
+
+static const struct {
+	const char *name;
+	enum LRUCachePolicy policy;
+} policies[] = {
+	{"lru", LRU_CACHE_POLICY_LRU},
+	{"clock", LRU_CACHE_POLICY_CLOCK},
+	{"2q", LRU_CACHE_POLICY_2Q},
+	{"tinylfu", LRU_CACHE_POLICY_TINYLFU},
+};
+
+/** Orbits through the cache, returns the ns per access */
+static double record_walk(LRUCACHE *cache, int renderDistance, struct Coord *frame, size_t *ops) {
+	static int value;
+
+	double ns = 0.0;
+	*ops = 0;
+
+	for (int t = 0; t < REPLAY_BENCH_FRAMES; t++) {
+		size_t count = bench_orbit_frame(t, renderDistance, frame);
+
+		double start = bench_now_ns();
+		for (size_t i = 0; i < count; i++) {
+			if (lru_cache_get(cache, frame[i].x, frame[i].z) == NULL) {
+				lru_cache_put(cache, frame[i].x, frame[i].z, &value);
+				(*ops)++;
+			}
+		}
+		ns += bench_now_ns() - start;
+		*ops += count;
+	}
+
+	return ns / (double)*ops;
+}
+
+int bench_record(int argc, char **argv) {
+	// Running every benchmark passes no arguments, there is no log to work with then
+	if (argc < 1) {
+		printf("Usage: bench record <log> [render distance]\n");
+		return EXIT_SUCCESS;
+	}
+
+	const char *path = argv[0];
+	int renderDistance = argc > 1 ? atoi(argv[1]) : 8;
+	if (renderDistance <= 0) {
+		fprintf(stderr, "Usage: bench record <log> [render distance]\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+	size_t side = (size_t)renderDistance * 2 + 1;
+
+	struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+	LRUCACHE *plain = lru_cache_create(diameter * diameter);
+	LRUCACHE *traced = lru_cache_create(diameter * diameter);
+
+	int status = EXIT_SUCCESS;
+	if (frame == NULL || plain == NULL || traced == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		status = EXIT_FAILURE;
+	} else if (!lru_cache_trace_start(traced, path)) {
+		fprintf(stderr, "Failed to start recording to %s (make bench TRACE=1)\n", path);
+		status = EXIT_FAILURE;
+	}
+
+	if (status == EXIT_SUCCESS) {
+		size_t ops;
+		double plain_ns = record_walk(plain, renderDistance, frame, &ops);
+		double traced_ns = record_walk(traced, renderDistance, frame, &ops);
+
+		if (!lru_cache_trace_stop(traced)) {
+			fprintf(stderr, "Failed to write %s\n", path);
+			status = EXIT_FAILURE;
+		}
+
+		FILE *file = fopen(path, "rb");
+		long bytes = -1;
+		if (file != NULL && fseek(file, 0, SEEK_END) == 0) {
+			bytes = ftell(file);
+		}
+		if (file != NULL) {
+			fclose(file);
+		}
+
+		printf("%-8s %10s %10s %12s %12s\n", "distance", "ns/op", "traced", "log bytes", "bytes/op");
+		printf("%-8d %10.2f %10.2f %12ld %12.3f\n", renderDistance, plain_ns, traced_ns, bytes,
+			(double)bytes / (double)ops);
+	}
+
+	free(frame);
+	if (plain != NULL) {
+		lru_cache_destroy(plain);
+	}
+	if (traced != NULL) {
+		lru_cache_destroy(traced);
+	}
+
+	return status;
+}
+
+/** Decodes the whole log so replaying is not slowed by reading it */
+static struct LRUTraceRecord *replay_load(LRUTRACE *trace, size_t *count) {
+	size_t capacity = 1024;
+	struct LRUTraceRecord *records = malloc(capacity * sizeof(struct LRUTraceRecord));
+	*count = 0;
+
+	while (records != NULL && lru_trace_next(trace, &records[*count])) {
+		if (++*count == capacity) {
+			capacity *= 2;
+			struct LRUTraceRecord *grown = realloc(records, capacity * sizeof(struct LRUTraceRecord));
+			if (grown == NULL) {
+				free(records);
+				return NULL;
+			}
+			records = grown;
+		}
+	}
+
+	return records;
+}
+
+/** Replays the log through one cache, returns the number of gets that hit */
+static size_t replay_run(LRUCACHE *cache, size_t capacity, HASHMAP *pins, const struct LRUTraceRecord *records,
+	size_t count, size_t *gets) {
+	static int value;
+
+	size_t hits = 0;
+	*gets = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		const struct LRUTraceRecord *record = &records[i];
+		uintptr_t pinned;
+
+		switch (record->op) {
+		case LRU_TRACE_GET:
+			hits += lru_cache_get(cache, record->x, record->z) != NULL;
+			(*gets)++;
+			break;
+		case LRU_TRACE_PUT:
+			if (record->cost != 0) {
+				lru_cache_put_cost(cache, record->x, record->z, &value, record->cost);
+			} else {
+				lru_cache_put(cache, record->x, record->z, &value);
+			}
+			break;
+		case LRU_TRACE_PIN:
+			if (lru_cache_pin(cache, record->x, record->z) != NULL) {
+				pinned = (uintptr_t)hashmap_get(pins, record->x, record->z);
+				hashmap_insert(pins, record->x, record->z, (void *)(pinned + 1));
+			}
+			break;
+		case LRU_TRACE_UNPIN:
+			pinned = (uintptr_t)hashmap_get(pins, record->x, record->z);
+			if (pinned == 0) {
+				break;
+			}
+
+			if (pinned == 1) {
+				hashmap_remove(pins, record->x, record->z);
+			} else {
+				hashmap_insert(pins, record->x, record->z, (void *)(pinned - 1));
+			}
+			lru_cache_unpin(cache, record->x, record->z);
+			break;
+		case LRU_TRACE_RESIZE: {
+			size_t resized = record->capacity < capacity ? record->capacity : capacity;
+			lru_cache_resize(cache, resized < 2 ? 2 : resized, record->cost);
+			break;
+		}
+		}
+	}
+
+	return hits;
+}
+
+int bench_replay(int argc, char **argv) {
+	// Running every benchmark passes no arguments, there is no log to work with then
+	if (argc < 1) {
+		printf("Usage: bench replay <log> [capacity]\n");
+		return EXIT_SUCCESS;
+	}
+
+	LRUTRACE *trace = lru_trace_open(argv[0]);
+	if (trace == NULL) {
+		fprintf(stderr, "Failed to open access log %s\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct LRUTraceHeader header = *lru_trace_header(trace);
+	size_t count;
+	struct LRUTraceRecord *records = replay_load(trace, &count);
+	bool failed = lru_trace_failed(trace);
+	lru_trace_close(trace);
+
+	if (records == NULL || failed) {
+		fprintf(stderr, records == NULL ? "Failed to allocate records\n" : "Malformed access log %s\n", argv[0]);
+		free(records);
+		return EXIT_FAILURE;
+	}
+
+	// Room for every capacity the log resizes to, unless a capacity was given
+	size_t capacity = header.capacity;
+	if (argc > 1) {
+		capacity = (size_t)atol(argv[1]);
+		if (capacity < 2) {
+			fprintf(stderr, "Usage: bench replay <log> [capacity]\n");
+			free(records);
+			return EXIT_FAILURE;
+		}
+	} else {
+		for (size_t i = 0; i < count; i++) {
+			if (records[i].op == LRU_TRACE_RESIZE && records[i].capacity > capacity) {
+				capacity = records[i].capacity;
+			}
+		}
+	}
+
+	printf("%zu records, recorded at capacity %zu, budget %zu\n", count, header.capacity, header.budget);
+	printf("%-8s %9s %10s %10s\n", "policy", "capacity", "hit rate", "ns/op");
+
+	int status = EXIT_SUCCESS;
+	for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]) && status == EXIT_SUCCESS; p++) {
+		struct LRUCacheConfig config = {
+			.capacity = capacity,
+			.policy = policies[p].policy,
+			.budget = header.budget,
+		};
+
+		struct HashmapConfig pinConfig = {
+			.capacity = 64,
+			.max_load_factor = 0.75F,
+		};
+
+		LRUCACHE *cache = lru_cache_create_with(&config);
+		HASHMAP *pins = hashmap_create_with(&pinConfig);
+		if (cache == NULL || pins == NULL) {
+			fprintf(stderr, "Failed to allocate cache\n");
+			status = EXIT_FAILURE;
+		} else {
+			if (argc < 2 && header.capacity < capacity) {
+				lru_cache_resize(cache, header.capacity, header.budget);
+			}
+
+			size_t gets;
+			double start = bench_now_ns();
+			size_t hits = replay_run(cache, capacity, pins, records, count, &gets);
+			double ns = bench_now_ns() - start;
+
+			printf("%-8s %9zu %9.2f%% %10.2f\n", policies[p].name, capacity,
+				gets == 0 ? 0.0 : (double)hits * 100.0 / (double)gets, ns / (double)count);
+		}
+
+		if (cache != NULL) {
+			lru_cache_destroy(cache);
+		}
+		if (pins != NULL) {
+			hashmap_destroy(pins);
+		}
+	}
+
+	free(records);
+	return status;
+}
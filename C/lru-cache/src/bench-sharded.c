@@ -0,0 +1,124 @@
+/**
+ * Multi-threaded mixed get/put traffic against the sharded cache. Each thread
+ * looks up random chunks around the origin and puts on a miss, with an extra
+ * share of unconditional puts, like generation workers publishing chunks.
+ * Hits are pinned while in use and unpinned again, the way a worker reading a
+ * neighbour has to.
+ *
+ * Usage: bench sharded [ops per thread]
+ */
+
+#include "bench.h"
+#include "sharded-cache.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SHARDED_BENCH_OPS		1000000
+#define SHARDED_BENCH_CAPACITY	4096
+#define SHARDED_BENCH_RANGE		48
+#define SHARDED_BENCH_PUT_SHARE 10 // Percent of operations that are puts regardless of a hit
+
+struct ShardedWorker {
+	pthread_t thread;
+	SHARDEDCACHE *cache;
+	uint64_t seed;
+	size_t ops;
+	size_t hits;
+};
+
+static void *sharded_worker(void *arg) {
+	static int value;
+	struct ShardedWorker *worker = arg;
+
+	uint64_t rng = worker->seed;
+	for (size_t i = 0; i < worker->ops; i++) {
+		uint64_t r = bench_rand(&rng);
+		int x = (int)(r % (SHARDED_BENCH_RANGE * 2)) - SHARDED_BENCH_RANGE;
+		int z = (int)((r >> 16) % (SHARDED_BENCH_RANGE * 2)) - SHARDED_BENCH_RANGE;
+
+		if ((r >> 32) % 100 < SHARDED_BENCH_PUT_SHARE) {
+			sharded_cache_put(worker->cache, x, z, &value);
+		} else if (sharded_cache_pin(worker->cache, x, z) != NULL) {
+			worker->hits++;
+			sharded_cache_unpin(worker->cache, x, z);
+		} else {
+			sharded_cache_put(worker->cache, x, z, &value);
+		}
+	}
+
+	return NULL;
+}
+
+static int sharded_run(size_t shard_count, size_t thread_count, size_t ops) {
+	struct LRUCacheConfig config = {
+		.capacity = SHARDED_BENCH_CAPACITY,
+	};
+
+	SHARDEDCACHE *cache = sharded_cache_create(shard_count, &config);
+	struct ShardedWorker *workers = calloc(thread_count, sizeof(struct ShardedWorker));
+	if (cache == NULL || workers == NULL) {
+		fprintf(stderr, "Failed to allocate sharded cache\n");
+		free(workers);
+		if (cache != NULL) {
+			sharded_cache_destroy(cache);
+		}
+		return EXIT_FAILURE;
+	}
+
+	double start = bench_now_ns();
+
+	size_t started = 0;
+	for (; started < thread_count; started++) {
+		workers[started].cache = cache;
+		workers[started].seed = 0x1234567ULL * (started + 1);
+		workers[started].ops = ops;
+
+		if (pthread_create(&workers[started].thread, NULL, sharded_worker, &workers[started]) != 0) {
+			fprintf(stderr, "Failed to start worker %zu\n", started);
+			break;
+		}
+	}
+
+	size_t hits = 0;
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		hits += workers[i].hits;
+	}
+
+	double elapsed = bench_now_ns() - start;
+
+	int status = started == thread_count ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (status == EXIT_SUCCESS) {
+		size_t total = ops * thread_count;
+		printf("%6zu %7zu %12.2f %9.2f%%\n", sharded_cache_shard_count(cache), thread_count,
+			(double)total / (elapsed / 1e9) / 1e6, (double)hits * 100.0 / (double)total);
+	}
+
+	free(workers);
+	sharded_cache_destroy(cache);
+	return status;
+}
+
+int bench_sharded(int argc, char **argv) {
+	size_t ops = argc > 0 ? (size_t)strtoull(argv[0], NULL, 10) : SHARDED_BENCH_OPS;
+	if (ops == 0) {
+		fprintf(stderr, "Usage: bench sharded [ops per thread]\n");
+		return EXIT_FAILURE;
+	}
+
+	static const size_t shard_counts[] = {1, 16};
+	static const size_t thread_counts[] = {1, 2, 4, 8, 16};
+
+	printf("%6s %7s %12s %10s\n", "shards", "threads", "Mops/s", "hit rate");
+
+	for (size_t s = 0; s < sizeof(shard_counts) / sizeof(shard_counts[0]); s++) {
+		for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+			if (sharded_run(shard_counts[s], thread_counts[t], ops) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
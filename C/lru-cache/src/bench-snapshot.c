@@ -0,0 +1,219 @@
+/**
+ * Startup with the chunks around spawn, three ways. The chunks are the
+ * first ones of the spiral around the origin and fill the cache exactly.
+ *
+ * - generate: every chunk is generated again and put, the cold start
+ * - region: every chunk is copied out of a chunk-store region file
+ * - snapshot: lru_cache_load maps a snapshot written by lru_cache_save
+ *
+ * Startup is the time until the cache holds every chunk, scan the time of
+ * the first pass that reads one byte of every page of every chunk, which is
+ * where the snapshot pays for the pages it did not touch while loading. The
+ * files were just written, so they are read from the page cache: this is
+ * the work startup does, not the disk.
+ *
+ * Usage: bench snapshot [chunks] [snapshot file]
+ */
+
+#include "bench.h"
+#include "chunk-store.h"
+#include "lru-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SNAPSHOT_BENCH_CHUNKS	10000
+#define SNAPSHOT_BENCH_PAGE		4096
+#define SNAPSHOT_BENCH_TEMPLATE "/tmp/bench-snapshot-XXXXXX"
+
+static void snapshot_free(int x, int z, void *value, void *userdata) {
+	(void)x;
+	(void)z;
+	(void)userdata;
+
+	free(value);
+}
+
+/** Reads a byte of every page of every chunk, returns their sum so both the reads and the contents are checked */
+static uint64_t snapshot_scan(LRUCACHE *cache, const struct Coord *coords, size_t count, double *ms) {
+	double start = bench_now_ns();
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		const unsigned char *chunk = lru_cache_get(cache, coords[i].x, coords[i].z);
+		if (chunk == NULL) {
+			continue;
+		}
+
+		for (size_t offset = 0; offset < sizeof(struct BenchChunk); offset += SNAPSHOT_BENCH_PAGE) {
+			sum += chunk[offset];
+		}
+	}
+
+	*ms = (bench_now_ns() - start) / 1e6;
+	return sum;
+}
+
+/** Puts every chunk, generated or copied out of the store. Returns false if a chunk cannot be allocated. */
+static bool snapshot_fill(LRUCACHE *cache, CHUNKSTORE *store, const struct Coord *coords, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		struct BenchChunk *chunk = malloc(sizeof(struct BenchChunk));
+		if (chunk == NULL) {
+			return false;
+		}
+
+		if (store == NULL || !chunk_store_load(store, coords[i].x, coords[i].z, chunk)) {
+			bench_chunk_generate(chunk, coords[i].x, coords[i].z);
+		}
+
+		lru_cache_put(cache, coords[i].x, coords[i].z, chunk);
+	}
+
+	return true;
+}
+
+static void snapshot_report(const char *method, double startup, double scan, size_t size) {
+	printf("%-9s %12.2f %10.2f %10zu\n", method, startup, scan, size);
+}
+
+static int snapshot_run(const char *path, const struct Coord *coords, size_t count) {
+	CHUNKSTORE *store = chunk_store_open(NULL, sizeof(struct BenchChunk), snapshot_free, NULL);
+	if (store == NULL) {
+		fprintf(stderr, "Failed to open region file\n");
+		return EXIT_FAILURE;
+	}
+
+	// Evictions never happen, chunk_store_evict only runs from destroy and writes the region file
+	struct LRUCacheConfig config = {
+		.capacity = count,
+		.on_evict = chunk_store_evict,
+		.userdata = store,
+	};
+
+	LRUCACHE *generated = lru_cache_create_with(&config);
+	if (generated == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		chunk_store_close(store);
+		return EXIT_FAILURE;
+	}
+
+	double start = bench_now_ns();
+	bool filled = snapshot_fill(generated, NULL, coords, count);
+	double startup = (bench_now_ns() - start) / 1e6;
+
+	double scan;
+	uint64_t sum = snapshot_scan(generated, coords, count, &scan);
+
+	start = bench_now_ns();
+	bool saved = filled && lru_cache_save(generated, path, sizeof(struct BenchChunk));
+	double save = (bench_now_ns() - start) / 1e6;
+
+	lru_cache_destroy(generated);
+	chunk_store_flush(store);
+
+	if (!saved) {
+		fprintf(stderr, filled ? "Failed to write %s\n" : "Failed to allocate chunks\n", path);
+		chunk_store_close(store);
+		return EXIT_FAILURE;
+	}
+
+	snapshot_report("generate", startup, scan, count);
+
+	LRUCACHE *region = lru_cache_create_with(&config);
+	if (region == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		chunk_store_close(store);
+		return EXIT_FAILURE;
+	}
+
+	start = bench_now_ns();
+	filled = snapshot_fill(region, store, coords, count);
+	startup = (bench_now_ns() - start) / 1e6;
+
+	int status = EXIT_SUCCESS;
+	if (!filled || snapshot_scan(region, coords, count, &scan) != sum) {
+		fprintf(stderr, "Region file did not give back the chunks\n");
+		status = EXIT_FAILURE;
+	} else {
+		snapshot_report("region", startup, scan, lru_cache_size(region));
+	}
+
+	lru_cache_destroy(region);
+	chunk_store_close(store);
+
+	// Nothing the snapshot restores is allocated, and nothing is put afterwards
+	struct LRUCacheConfig mapped = {
+		.capacity = count,
+	};
+
+	start = bench_now_ns();
+	LRUCACHE *snapshot = status == EXIT_SUCCESS ? lru_cache_load(path, &mapped) : NULL;
+	startup = (bench_now_ns() - start) / 1e6;
+
+	if (status == EXIT_SUCCESS && (snapshot == NULL || snapshot_scan(snapshot, coords, count, &scan) != sum)) {
+		fprintf(stderr, "Snapshot did not give back the chunks\n");
+		status = EXIT_FAILURE;
+	} else if (status == EXIT_SUCCESS) {
+		snapshot_report("snapshot", startup, scan, lru_cache_size(snapshot));
+		printf("\nsnapshot written in %.2f ms\n", save);
+	}
+
+	if (snapshot != NULL) {
+		lru_cache_destroy(snapshot);
+	}
+
+	return status;
+}
+
+int bench_snapshot(int argc, char **argv) {
+	int chunks = SNAPSHOT_BENCH_CHUNKS;
+
+	if (argc > 0) {
+		chunks = atoi(argv[0]);
+
+		if (chunks <= 1) {
+			fprintf(stderr, "Usage: bench snapshot [chunks] [snapshot file]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	char temporary[] = SNAPSHOT_BENCH_TEMPLATE;
+	const char *path = argc > 1 ? argv[1] : temporary;
+
+	if (argc <= 1) {
+		int fd = mkstemp(temporary);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to create %s\n", temporary);
+			return EXIT_FAILURE;
+		}
+		close(fd);
+	}
+
+	// The smallest spiral holding every chunk
+	int radius = 0;
+	while ((size_t)(radius * 2 + 1) * (size_t)(radius * 2 + 1) < (size_t)chunks) {
+		radius++;
+	}
+
+	size_t side = (size_t)radius * 2 + 1;
+	struct Coord *coords = malloc(side * side * sizeof(struct Coord));
+	if (coords == NULL) {
+		fprintf(stderr, "Failed to allocate chunks\n");
+		if (argc <= 1) {
+			remove(temporary);
+		}
+		return EXIT_FAILURE;
+	}
+
+	bench_spiral(0, 0, radius, coords);
+
+	printf("%-9s %12s %10s %10s\n", "method", "startup ms", "scan ms", "chunks");
+	int status = snapshot_run(path, coords, (size_t)chunks);
+
+	if (argc <= 1) {
+		remove(temporary);
+	}
+
+	free(coords);
+	return status;
+}
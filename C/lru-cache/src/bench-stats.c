@@ -0,0 +1,153 @@
+/**
+ * Polls the cache and hashmap counters the way a game would once a second:
+ * the circular walk runs at 60 frames a second and every 60 frames a
+ * snapshot is printed and the counters are reset. A hashmap under insert and
+ * remove churn shows the probe histogram and tombstones of linear probing.
+ *
+ * The counters are only there when built with make bench STATS=1.
+ *
+ * Usage: bench stats [render distance]
+ */
+
+#include "bench.h"
+#include "hashmap.h"
+#include "lru-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STATS_BENCH_FPS			   60
+#define STATS_BENCH_SECONDS		   10
+#define STATS_BENCH_MAP_CAPACITY   2048
+#define STATS_BENCH_MAP_LIVE	   1024
+#define STATS_BENCH_MAP_CYCLES	   200000
+
+#if defined(LRU_CACHE_STATS) && defined(HASHMAP_STATS)
+
+static void stats_print_histogram(const size_t *histogram, size_t buckets) {
+	for (size_t i = 0; i < buckets; i++) {
+		if (histogram[i] != 0) {
+			printf("  %2zu%s %10zu\n", i + 1, i + 1 == buckets ? "+" : " ", histogram[i]);
+		}
+	}
+}
+
+static int stats_cache(int renderDistance, struct Coord *frame) {
+	static int value;
+
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+
+	LRUCACHE *cache = lru_cache_create(diameter * diameter);
+	if (cache == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-6s %8s %8s %8s %8s %9s %9s %9s\n", "second", "hits", "misses", "inserts", "updates", "evictions",
+		"avg probe", "max probe");
+
+	struct LRUCacheStats stats;
+	for (int t = 0; t < STATS_BENCH_FPS * STATS_BENCH_SECONDS; t++) {
+		size_t count = bench_orbit_frame(t, renderDistance, frame);
+		for (size_t i = 0; i < count; i++) {
+			if (lru_cache_get(cache, frame[i].x, frame[i].z) == NULL) {
+				lru_cache_put(cache, frame[i].x, frame[i].z, &value);
+			}
+		}
+
+		if ((t + 1) % STATS_BENCH_FPS == 0) {
+			lru_cache_stats(cache, &stats);
+			lru_cache_stats_reset(cache);
+
+			printf("%-6d %8zu %8zu %8zu %8zu %9zu %9.2f %9zu\n", (t + 1) / STATS_BENCH_FPS, stats.hits, stats.misses,
+				stats.inserts, stats.updates, stats.evictions, stats.average_probe, stats.max_probe);
+		}
+	}
+
+	printf("cache probe lengths in the last second:\n");
+	stats_print_histogram(stats.probe_histogram, LRU_CACHE_PROBE_BUCKETS);
+
+	lru_cache_destroy(cache);
+	return EXIT_SUCCESS;
+}
+
+static int stats_hashmap(void) {
+	static int value;
+
+	struct HashmapConfig config = {
+		.capacity = STATS_BENCH_MAP_CAPACITY,
+		.hash = HASHMAP_HASH_COORDS,
+		.probe = HASHMAP_PROBE_LINEAR,
+	};
+
+	HASHMAP *hashmap = hashmap_create_with(&config);
+	if (hashmap == NULL) {
+		fprintf(stderr, "Failed to allocate hashmap\n");
+		return EXIT_FAILURE;
+	}
+
+	// A sliding window of live keys: every cycle inserts one key and removes the oldest
+	for (int i = 0; i < STATS_BENCH_MAP_CYCLES; i++) {
+		hashmap_insert(hashmap, i, i / 7, &value);
+		if (i >= STATS_BENCH_MAP_LIVE) {
+			int old = i - STATS_BENCH_MAP_LIVE;
+			hashmap_remove(hashmap, old, old / 7);
+		}
+
+		// Mostly live keys, some already removed
+		int key = i - (int)(((unsigned int)i * 7919U) % (STATS_BENCH_MAP_LIVE + STATS_BENCH_MAP_LIVE / 4));
+		hashmap_get(hashmap, key, key / 7);
+	}
+
+	struct HashmapStats stats;
+	hashmap_stats(hashmap, &stats);
+
+	printf("\nlinear hashmap after %d insert/remove cycles:\n", STATS_BENCH_MAP_CYCLES);
+	printf("hits %zu misses %zu inserts %zu updates %zu removes %zu tombstones %zu\n", stats.hits, stats.misses,
+		stats.inserts, stats.updates, stats.removes, stats.tombstones);
+	printf("lookups %zu avg probe %.2f max probe %zu\n", stats.lookups, stats.average_probe, stats.max_probe);
+	stats_print_histogram(stats.probe_histogram, HASHMAP_PROBE_BUCKETS);
+
+	hashmap_destroy(hashmap);
+	return EXIT_SUCCESS;
+}
+
+int bench_stats(int argc, char **argv) {
+	int renderDistance = 8;
+
+	if (argc > 0) {
+		renderDistance = atoi(argv[0]);
+
+		if (renderDistance <= 0) {
+			fprintf(stderr, "Usage: bench stats [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+	if (frame == NULL) {
+		fprintf(stderr, "Failed to allocate frame\n");
+		return EXIT_FAILURE;
+	}
+
+	int status = stats_cache(renderDistance, frame);
+	if (status == EXIT_SUCCESS) {
+		status = stats_hashmap();
+	}
+
+	free(frame);
+	return status;
+}
+
+#else
+
+int bench_stats(int argc, char **argv) {
+	(void)argc;
+	(void)argv;
+
+	printf("Counters are compiled out, rebuild with make bench STATS=1\n");
+	return EXIT_SUCCESS;
+}
+
+#endif
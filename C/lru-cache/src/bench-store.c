@@ -0,0 +1,308 @@
+/**
+ * Chunk misses served by regeneration alone against the region file tier.
+ * Chunks are generated by bench_chunk_generate, and every
+ * STORE_BENCH_EDIT_PERIOD frames the player's chunk is edited. With the
+ * tier, evicted chunks go to chunk_store_evict and a miss tries
+ * chunk_store_load before generating. Generated chunks are marked clean, so
+ * only edited ones are written. Reports the time spent per miss, including
+ * the puts and the evictions they cause, how many chunks were written back
+ * and how many evictions were skipped for being clean.
+ *
+ * Then the region file runs out of disk, RLIMIT_FSIZE keeps it from growing.
+ * Chunks evicted after that must stay loadable and unreleased, and then be
+ * either written once the limit is lifted or released by chunk_store_close,
+ * which has to report them lost.
+ *
+ * Usage: bench store [render distance]
+ */
+
+// setrlimit and SIGXFSZ are POSIX, not part of -std=c11
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+#include "chunk-store.h"
+#include "lru-cache.h"
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define STORE_BENCH_FRAMES		20000
+#define STORE_BENCH_EDIT_PERIOD 16
+#define STORE_BENCH_FULL_GROUP	32	 // Chunks evicted between flushes once the disk is full, well below the store's queue
+#define STORE_BENCH_FULL_MAX	8192 // Chunks after which the file is taken to never fill up
+#define STORE_BENCH_FULL_TRIES	50	 // Flushes to wait for after the limit is lifted, the writer retries every 100 ms
+
+static const struct {
+	const char *name;
+	BenchFrameFn frame;
+} workloads[] = {
+	{"flight", bench_flight_frame},
+	{"excursion", bench_excursion_frame},
+};
+
+static void store_free(int x, int z, void *value, void *userdata) {
+	(void)x;
+	(void)z;
+	(void)userdata;
+
+	free(value);
+}
+
+static int store_run(size_t w, bool tiered, int renderDistance, struct Coord *frame) {
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+
+	CHUNKSTORE *store = tiered ? chunk_store_open(NULL, sizeof(struct BenchChunk), store_free, NULL) : NULL;
+	struct LRUCacheConfig config = {
+		.capacity = diameter * diameter,
+		.on_evict = tiered ? chunk_store_evict : store_free,
+		.userdata = store,
+	};
+
+	LRUCACHE *cache = lru_cache_create_with(&config);
+	if (cache == NULL || (tiered && store == NULL)) {
+		fprintf(stderr, "Failed to allocate %s\n", cache == NULL ? "cache" : "region file");
+		if (cache != NULL) {
+			lru_cache_destroy(cache);
+		}
+		if (store != NULL) {
+			chunk_store_close(store);
+		}
+		return EXIT_FAILURE;
+	}
+
+	size_t misses = 0;
+	size_t generated = 0;
+	double ns = 0.0;
+
+	for (int t = 0; t < STORE_BENCH_FRAMES; t++) {
+		size_t count = workloads[w].frame(t, renderDistance, frame);
+
+		for (size_t i = 0; i < count; i++) {
+			if (lru_cache_get(cache, frame[i].x, frame[i].z) != NULL) {
+				continue;
+			}
+
+			double start = bench_now_ns();
+			struct BenchChunk *chunk = malloc(sizeof(struct BenchChunk));
+			if (chunk == NULL) {
+				fprintf(stderr, "Failed to allocate chunk\n");
+				lru_cache_destroy(cache);
+				if (store != NULL) {
+					chunk_store_close(store);
+				}
+				return EXIT_FAILURE;
+			}
+
+			if (!tiered || !chunk_store_load(store, frame[i].x, frame[i].z, chunk)) {
+				bench_chunk_generate(chunk, frame[i].x, frame[i].z);
+				generated++;
+
+				if (tiered) {
+					chunk_store_mark_clean(store, frame[i].x, frame[i].z, chunk);
+				}
+			}
+
+			lru_cache_put(cache, frame[i].x, frame[i].z, chunk);
+			ns += bench_now_ns() - start;
+			misses++;
+		}
+
+		// The spiral starts at the player's chunk
+		if (t % STORE_BENCH_EDIT_PERIOD == 0) {
+			struct BenchChunk *chunk = lru_cache_get(cache, frame[0].x, frame[0].z);
+			chunk->blocks[BENCH_CHUNK_HEIGHT - 1][t % BENCH_CHUNK_WIDTH][0] = 1;
+			if (tiered) {
+				chunk_store_mark_dirty(store, frame[0].x, frame[0].z);
+			}
+		}
+	}
+
+	struct ChunkStoreStats stats = {0};
+	if (tiered) {
+		chunk_store_flush(store);
+		chunk_store_stats(store, &stats);
+	}
+
+	printf("%-9s %-6s %10zu %10zu %10zu %10zu %10zu %10.2f\n", workloads[w].name, tiered ? "store" : "regen", misses,
+		generated, stats.loads, stats.writes, stats.skipped, ns / 1e3 / (double)misses);
+
+	lru_cache_destroy(cache);
+	if (store != NULL) {
+		chunk_store_close(store);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static void store_count_free(int x, int z, void *value, void *userdata) {
+	(void)x;
+	(void)z;
+
+	size_t *released = userdata;
+	(*released)++;
+	free(value);
+}
+
+/** Evicts generated chunks in groups until a flush fails, returns the number evicted, 0 if the file never filled */
+static int store_fill(CHUNKSTORE *store) {
+	int evicted = 0;
+
+	while (evicted < STORE_BENCH_FULL_MAX) {
+		for (int i = 0; i < STORE_BENCH_FULL_GROUP; i++, evicted++) {
+			struct BenchChunk *chunk = malloc(sizeof(struct BenchChunk));
+			if (chunk == NULL) {
+				return 0;
+			}
+
+			bench_chunk_generate(chunk, evicted, 0);
+			chunk_store_evict(evicted, 0, chunk, store);
+		}
+
+		if (!chunk_store_flush(store)) {
+			return evicted;
+		}
+	}
+
+	return 0;
+}
+
+/** Chunks below count that do not load back as generated */
+static size_t store_check(CHUNKSTORE *store, int count, struct BenchChunk *expected, struct BenchChunk *loaded) {
+	size_t wrong = 0;
+
+	for (int i = 0; i < count; i++) {
+		bench_chunk_generate(expected, i, 0);
+		wrong += !chunk_store_load(store, i, 0, loaded) || memcmp(expected, loaded, sizeof(*loaded)) != 0;
+	}
+
+	return wrong;
+}
+
+/**
+ * Fills the disk under a store. Nothing is printed while the file size limit
+ * is down, stdout may be a regular file that would hit it too.
+ */
+static int store_full_run(bool recover, struct BenchChunk *expected, struct BenchChunk *loaded) {
+	size_t released = 0;
+	CHUNKSTORE *store = chunk_store_open(NULL, sizeof(struct BenchChunk), store_count_free, &released);
+	if (store == NULL) {
+		fprintf(stderr, "Failed to open region file\n");
+		return EXIT_FAILURE;
+	}
+
+	struct rlimit limit;
+	getrlimit(RLIMIT_FSIZE, &limit);
+	struct rlimit full = {1, limit.rlim_max}; // Below the size of the new file, so it cannot grow
+
+	fflush(stdout);
+	void (*previous)(int) = signal(SIGXFSZ, SIG_IGN);
+	setrlimit(RLIMIT_FSIZE, &full);
+
+	int evicted = store_fill(store);
+
+	struct ChunkStoreStats stats;
+	chunk_store_stats(store, &stats);
+	size_t writtenFull = stats.writes;
+	size_t releasedFull = released;
+	size_t wrong = store_check(store, evicted, expected, loaded);
+
+	bool closed = false;
+	size_t tries = 0;
+	if (recover) {
+		setrlimit(RLIMIT_FSIZE, &limit);
+
+		while (!chunk_store_flush(store) && ++tries < STORE_BENCH_FULL_TRIES) {
+			nanosleep(&(struct timespec){0, 10 * 1000000L}, NULL);
+		}
+
+		wrong += store_check(store, evicted, expected, loaded);
+		chunk_store_stats(store, &stats);
+		closed = chunk_store_close(store);
+	} else {
+		// Still full, so the writer cannot get the chunks out while closing
+		closed = chunk_store_close(store);
+		setrlimit(RLIMIT_FSIZE, &limit);
+	}
+
+	signal(SIGXFSZ, previous);
+
+	printf("%-9s %10d %10zu %10zu %10zu %10zu %10s\n", recover ? "recover" : "close", evicted, writtenFull,
+		recover ? stats.writes : writtenFull, releasedFull, released, closed ? "yes" : "no");
+
+	// Only written chunks are released while full, and nothing is lost unless the store reports it
+	bool failed = evicted == 0 || wrong != 0 || writtenFull >= (size_t)evicted || releasedFull != writtenFull ||
+		released != (size_t)evicted || closed != recover || (recover && stats.writes != (size_t)evicted);
+	if (failed) {
+		fprintf(stderr, "Disk full %s: %zu wrong loads, %d evicted, %zu written, %zu released\n",
+			recover ? "recovery" : "close", wrong, evicted, recover ? stats.writes : writtenFull, released);
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int store_full(void) {
+	struct BenchChunk *expected = malloc(sizeof(struct BenchChunk));
+	struct BenchChunk *loaded = malloc(sizeof(struct BenchChunk));
+	if (expected == NULL || loaded == NULL) {
+		fprintf(stderr, "Failed to allocate chunk\n");
+		free(expected);
+		free(loaded);
+		return EXIT_FAILURE;
+	}
+
+	printf("\n%-9s %10s %10s %10s %10s %10s %10s\n", "disk full", "evicted", "written", "then", "released", "then",
+		"close ok");
+
+	int status = store_full_run(true, expected, loaded);
+	if (status == EXIT_SUCCESS) {
+		status = store_full_run(false, expected, loaded);
+	}
+
+	free(expected);
+	free(loaded);
+	return status;
+}
+
+int bench_store(int argc, char **argv) {
+	int renderDistance = 8;
+
+	if (argc > 0) {
+		renderDistance = atoi(argv[0]);
+
+		if (renderDistance <= 0) {
+			fprintf(stderr, "Usage: bench store [render distance]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+	if (frame == NULL) {
+		fprintf(stderr, "Failed to allocate frame\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-9s %-6s %10s %10s %10s %10s %10s %10s\n", "trace", "tier", "misses", "generated", "reloaded", "written",
+		"skipped", "us/miss");
+
+	int status = EXIT_SUCCESS;
+	for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]) && status == EXIT_SUCCESS; w++) {
+		status = store_run(w, false, renderDistance, frame);
+		if (status == EXIT_SUCCESS) {
+			status = store_run(w, true, renderDistance, frame);
+		}
+	}
+
+	free(frame);
+
+	if (status == EXIT_SUCCESS) {
+		status = store_full();
+	}
+
+	return status;
+}
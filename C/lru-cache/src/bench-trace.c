@@ -0,0 +1,250 @@
+/**
+ * Replays chunk access traces through lru_cache_get/lru_cache_put with no
+ * terminal output, for comparing builds and policies by script. The
+ * synthetic traces are the circular walk, a straight flight, random
+ * teleports and a player standing still. A recorded trace is a text file
+ * with one "x z" chunk coordinate per line.
+ *
+ * Every get, and the put after a miss, is timed on its own to give the p50
+ * and p99 latency, with the cost of reading the clock taken out. Ops/sec is
+ * derived from the same timings. Peak memory is the largest
+ * lru_cache_memory seen, sampled every frame outside the timed section.
+ *
+ * Usage: bench trace [csv|json] [render distance] [trace file]
+ */
+
+#include "bench.h"
+#include "lru-cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_BENCH_FRAMES			 20000
+#define TRACE_BENCH_LATENCY_BUCKETS 4096 // 1 ns each, the last one collects everything slower
+
+struct TraceWorkload {
+	const char *name;
+	BenchFrameFn frame;
+};
+
+static const struct TraceWorkload workloads[] = {
+	{"orbit", bench_orbit_frame},
+	{"flight", bench_flight_frame},
+	{"teleport", bench_teleport_frame},
+	{"standing", bench_standing_frame},
+};
+
+struct TraceResult {
+	const char *name;
+	int renderDistance;
+	size_t ops;
+	size_t hits;
+	double ns;
+	size_t peak;
+	size_t latency[TRACE_BENCH_LATENCY_BUCKETS];
+};
+
+struct TraceRun {
+	LRUCACHE *cache;
+	double overhead;
+	struct TraceResult *result;
+};
+
+/** Smallest time between two clock reads, subtracted from every sample */
+static double trace_timer_overhead(void) {
+	double best = 1e9;
+	for (int i = 0; i < 1000; i++) {
+		double start = bench_now_ns();
+		double end = bench_now_ns();
+		best = end - start < best ? end - start : best;
+	}
+
+	return best;
+}
+
+static void trace_sample_memory(struct TraceRun *run) {
+	size_t bytes = lru_cache_memory(run->cache);
+	run->result->peak = bytes > run->result->peak ? bytes : run->result->peak;
+}
+
+static void trace_access(struct TraceRun *run, int x, int z) {
+	static int value;
+
+	double start = bench_now_ns();
+	if (lru_cache_get(run->cache, x, z) != NULL) {
+		run->result->hits++;
+	} else {
+		lru_cache_put(run->cache, x, z, &value);
+	}
+	double ns = bench_now_ns() - start - run->overhead;
+	ns = ns < 0.0 ? 0.0 : ns;
+
+	size_t bucket = (size_t)ns;
+	run->result->latency[bucket < TRACE_BENCH_LATENCY_BUCKETS ? bucket : TRACE_BENCH_LATENCY_BUCKETS - 1]++;
+	run->result->ns += ns;
+	run->result->ops++;
+}
+
+/** Latency in ns below which the given fraction of ops fall */
+static size_t trace_percentile(const struct TraceResult *result, double fraction) {
+	size_t target = (size_t)((double)result->ops * fraction);
+	size_t seen = 0;
+
+	for (size_t i = 0; i < TRACE_BENCH_LATENCY_BUCKETS; i++) {
+		seen += result->latency[i];
+		if (seen > target) {
+			return i;
+		}
+	}
+
+	return TRACE_BENCH_LATENCY_BUCKETS - 1;
+}
+
+static void trace_print(const struct TraceResult *result, bool json, bool first) {
+	double ops_per_sec = result->ns > 0.0 ? (double)result->ops * 1e9 / result->ns : 0.0;
+	double hit_rate = result->ops > 0 ? (double)result->hits / (double)result->ops : 0.0;
+	size_t p50 = trace_percentile(result, 0.50);
+	size_t p99 = trace_percentile(result, 0.99);
+
+	if (json) {
+		printf("%s  {\"trace\": \"%s\", \"distance\": %d, \"ops\": %zu, \"ops_per_sec\": %.0f, \"p50_ns\": %zu, "
+			"\"p99_ns\": %zu, \"hit_rate\": %.4f, \"peak_bytes\": %zu}",
+			first ? "" : ",\n", result->name, result->renderDistance, result->ops, ops_per_sec, p50, p99, hit_rate,
+			result->peak);
+	} else {
+		printf("%s,%d,%zu,%.0f,%zu,%zu,%.4f,%zu\n", result->name, result->renderDistance, result->ops, ops_per_sec,
+			p50, p99, hit_rate, result->peak);
+	}
+}
+
+static bool trace_begin(struct TraceRun *run, struct TraceResult *result, const char *name, int renderDistance) {
+	size_t radius = (size_t)renderDistance + BENCH_CACHE_MARGIN;
+	size_t diameter = radius * 2 + 1;
+
+	memset(result, 0, sizeof(*result));
+	result->name = name;
+	result->renderDistance = renderDistance;
+
+	run->result = result;
+	run->overhead = trace_timer_overhead();
+	run->cache = lru_cache_create(diameter * diameter);
+	if (run->cache == NULL) {
+		fprintf(stderr, "Failed to allocate cache\n");
+		return false;
+	}
+
+	return true;
+}
+
+static int trace_run_synthetic(const struct TraceWorkload *workload, int renderDistance, struct Coord *frame,
+	struct TraceResult *result) {
+	struct TraceRun run;
+	if (!trace_begin(&run, result, workload->name, renderDistance)) {
+		return EXIT_FAILURE;
+	}
+
+	for (int t = 0; t < TRACE_BENCH_FRAMES; t++) {
+		size_t count = workload->frame(t, renderDistance, frame);
+		for (size_t i = 0; i < count; i++) {
+			trace_access(&run, frame[i].x, frame[i].z);
+		}
+		trace_sample_memory(&run);
+	}
+
+	lru_cache_destroy(run.cache);
+	return EXIT_SUCCESS;
+}
+
+static int trace_run_file(const char *path, int renderDistance, struct TraceResult *result) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open trace %s\n", path);
+		return EXIT_FAILURE;
+	}
+
+	struct TraceRun run;
+	if (!trace_begin(&run, result, path, renderDistance)) {
+		fclose(file);
+		return EXIT_FAILURE;
+	}
+
+	int x, z;
+	while (fscanf(file, "%d %d", &x, &z) == 2) {
+		trace_access(&run, x, z);
+		trace_sample_memory(&run);
+	}
+
+	int status = EXIT_SUCCESS;
+	if (!feof(file)) {
+		fprintf(stderr, "Malformed trace %s after %zu accesses\n", path, result->ops);
+		status = EXIT_FAILURE;
+	}
+
+	fclose(file);
+	lru_cache_destroy(run.cache);
+	return status;
+}
+
+int bench_trace(int argc, char **argv) {
+	bool json = false;
+	int renderDistance = 8;
+	const char *path = NULL;
+
+	if (argc > 0) {
+		json = strcmp(argv[0], "json") == 0;
+		if (!json && strcmp(argv[0], "csv") != 0) {
+			fprintf(stderr, "Usage: bench trace [csv|json] [render distance] [trace file]\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc > 1) {
+		renderDistance = atoi(argv[1]);
+
+		if (renderDistance <= 0) {
+			fprintf(stderr, "Usage: bench trace [csv|json] [render distance] [trace file]\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc > 2) {
+		path = argv[2];
+	}
+
+	size_t side = (size_t)renderDistance * 2 + 1;
+	struct Coord *frame = malloc(side * side * sizeof(struct Coord));
+	struct TraceResult *result = malloc(sizeof(struct TraceResult));
+	if (frame == NULL || result == NULL) {
+		fprintf(stderr, "Failed to allocate frame\n");
+		free(frame);
+		free(result);
+		return EXIT_FAILURE;
+	}
+
+	if (json) {
+		printf("[\n");
+	} else {
+		printf("trace,distance,ops,ops_per_sec,p50_ns,p99_ns,hit_rate,peak_bytes\n");
+	}
+
+	int status = EXIT_SUCCESS;
+	if (path != NULL) {
+		status = trace_run_file(path, renderDistance, result);
+		if (status == EXIT_SUCCESS) {
+			trace_print(result, json, true);
+		}
+	} else {
+		for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]) && status == EXIT_SUCCESS; w++) {
+			status = trace_run_synthetic(&workloads[w], renderDistance, frame, result);
+			if (status == EXIT_SUCCESS) {
+				trace_print(result, json, w == 0);
+			}
+		}
+	}
+
+	if (json) {
+		printf("\n]\n");
+	}
+
+	free(frame);
+	free(result);
+	return status;
+}
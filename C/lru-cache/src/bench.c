@@ -0,0 +1,182 @@
+/**
+ * Benchmarks for the chunk cache and its hashmap. Unlike bin/lrucache this
+ * does no terminal drawing, so the numbers only measure the data structures.
+ *
+ * Usage: bin/bench [name [args...]]   (no name runs every benchmark)
+ */
+
+#include "bench.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Benchmark {
+	const char *name;
+	const char *description;
+	int (*run)(int argc, char **argv);
+};
+
+static const struct Benchmark benchmarks[] = {
+	{"hash", "Coordinate mixer vs FNV-1a: collision rate and lookups/sec", bench_hash},
+	{"probe", "Linear vs group probing lookups/sec as the table fills", bench_probe},
+	{"churn", "Probe lengths over millions of put/evict cycles", bench_churn},
+	{"rehash", "Inserts, updates, removes and gets checked against an array while incremental rehashes run", bench_rehash},
+	{"sharded", "Sharded cache throughput from 1 to 16 threads", bench_sharded},
+	{"policy", "Replacement policies and the fused map on orbit, flight and excursion traces", bench_policy},
+	{"batch", "Spiral scans through lru_cache_get/put vs lru_cache_get_many/put_many", bench_batch},
+	{"pin", "Evictions passing over chunks pinned by in-flight mesh jobs", bench_pin},
+	{"budget", "Entry count vs byte budget on chunks of mixed size, then a runtime shrink", bench_budget},
+	{"stats", "Per second counter snapshots and probe histograms (make bench STATS=1)", bench_stats},
+	{"trace", "Synthetic or recorded traces: ops/sec, p50/p99 latency, hit rate, peak memory as CSV/JSON", bench_trace},
+	{"record", "Cost of recording an access log of the circular walk (make bench TRACE=1)", bench_record},
+	{"replay", "Replays a recorded access log through every replacement policy", bench_replay},
+	{"keyed", "Macro generated chunk, section and 64 bit handle caches vs the hand written ones", bench_keyed},
+	{"expire", "Budgeted per frame expiry of idle chunks once the player stops", bench_expire},
+	{"grid", "Toroidal chunk grid vs the LRU cache and the fused map on the spiral loop", bench_grid},
+	{"prefetch", "Spiral edge misses with generation latency, with and without velocity prefetching", bench_prefetch},
+	{"store", "Chunk misses regenerated vs reloaded from the region file tier, with dirty only writeback", bench_store},
+	{"snapshot", "Startup with 10k chunks: regeneration, region file reloads and a mapped cache snapshot", bench_snapshot},
+	{"memory", "Random lookups in a 1M entry cache and hashmap per allocation mode, with dTLB and cache misses", bench_memory},
+};
+
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/**
+ * Writes the coordinates of a square spiral around the center in the same
+ * order the game loop visits them. Returns (radius * 2 + 1)^2.
+ */
+size_t bench_spiral(int centerX, int centerZ, int radius, struct Coord *out) {
+	int x = 0;
+	int z = 0;
+	int dx = 0;
+	int dz = -1;
+	int maxSide = (radius * 2 + 1);
+	int maxSteps = maxSide * maxSide;
+
+	for (int i = 0; i < maxSteps; i++) {
+		out[i].x = centerX + x;
+		out[i].z = centerZ + z;
+
+		if (x == z || (x < 0 && x == -z) || (x > 0 && x == 1 - z)) {
+			int temp = dx;
+			dx = -dz;
+			dz = temp;
+		}
+
+		x += dx;
+		z += dz;
+	}
+
+	return (size_t)maxSteps;
+}
+
+/**
+ * Chunks requested in frame t of the circular walk in main.c: the player
+ * orbits the origin and a spiral of the render distance is scanned around
+ * the player's chunk. Returns the number of coordinates written.
+ */
+size_t bench_orbit_frame(int t, int renderDistance, struct Coord *out) {
+	float angle = (float)t * BENCH_ORBIT_ANGLE_STEP;
+	int playerChunkX = (int)(BENCH_ORBIT_RADIUS * cosf(angle)) / BENCH_CHUNK_WIDTH;
+	int playerChunkZ = (int)(BENCH_ORBIT_RADIUS * sinf(angle)) / BENCH_CHUNK_WIDTH;
+
+	return bench_spiral(playerChunkX, playerChunkZ, renderDistance, out);
+}
+
+/** Frame t of a flight along the x axis that turns around every BENCH_FLIGHT_LENGTH chunks */
+size_t bench_flight_frame(int t, int renderDistance, struct Coord *out) {
+	int step = t / BENCH_FLIGHT_FRAMES_PER_CHUNK;
+	int leg = step % (BENCH_FLIGHT_LENGTH * 2);
+	int playerChunkX = leg < BENCH_FLIGHT_LENGTH ? leg : BENCH_FLIGHT_LENGTH * 2 - leg;
+
+	return bench_spiral(playerChunkX, 0, renderDistance, out);
+}
+
+/**
+ * Frame t of the circular walk interrupted by a straight trip away from home
+ * and back. The trip streams chunks through the cache once, which a scan
+ * resistant policy should not let flush the home area.
+ */
+size_t bench_excursion_frame(int t, int renderDistance, struct Coord *out) {
+	int phase = t % BENCH_EXCURSION_PERIOD;
+	if (phase >= BENCH_EXCURSION_LENGTH * 2) {
+		return bench_orbit_frame(t, renderDistance, out);
+	}
+
+	int playerChunkX = phase < BENCH_EXCURSION_LENGTH ? phase : BENCH_EXCURSION_LENGTH * 2 - phase;
+	return bench_spiral(playerChunkX, 0, renderDistance, out);
+}
+
+/** Frame t of a player teleporting to a random chunk every BENCH_TELEPORT_PERIOD frames */
+size_t bench_teleport_frame(int t, int renderDistance, struct Coord *out) {
+	uint64_t state = (uint64_t)(t / BENCH_TELEPORT_PERIOD) * 0x9E3779B97F4A7C15ULL + 1;
+	int playerChunkX = (int)(bench_rand(&state) % (BENCH_TELEPORT_RANGE * 2)) - BENCH_TELEPORT_RANGE;
+	int playerChunkZ = (int)(bench_rand(&state) % (BENCH_TELEPORT_RANGE * 2)) - BENCH_TELEPORT_RANGE;
+
+	return bench_spiral(playerChunkX, playerChunkZ, renderDistance, out);
+}
+
+/** Frame t of a player standing still at the origin, every lookup after the first frame hits */
+size_t bench_standing_frame(int t, int renderDistance, struct Coord *out) {
+	(void)t;
+	return bench_spiral(0, 0, renderDistance, out);
+}
+
+/** Uniformly random coordinates in [-range, range) */
+void bench_random_coords(uint64_t seed, int range, size_t count, struct Coord *out) {
+	uint64_t state = seed;
+	for (size_t i = 0; i < count; i++) {
+		out[i].x = (int)(bench_rand(&state) % (uint64_t)(range * 2)) - range;
+		out[i].z = (int)(bench_rand(&state) % (uint64_t)(range * 2)) - range;
+	}
+}
+
+/** Fills a chunk with the blocks below a heightmap of a few octaves of sines, slow enough to stand in for terrain generation */
+void bench_chunk_generate(struct BenchChunk *chunk, int chunkX, int chunkZ) {
+	for (int z = 0; z < BENCH_CHUNK_WIDTH; z++) {
+		for (int x = 0; x < BENCH_CHUNK_WIDTH; x++) {
+			float blockX = (float)(chunkX * BENCH_CHUNK_WIDTH + x);
+			float blockZ = (float)(chunkZ * BENCH_CHUNK_WIDTH + z);
+			float height = 0.0F;
+			float scale = 0.01F;
+
+			for (int octave = 0; octave < BENCH_CHUNK_OCTAVES; octave++) {
+				height += (sinf(blockX * scale) + cosf(blockZ * scale) + 2.0F) / (float)(4 << octave);
+				scale *= 2.0F;
+			}
+
+			int top = (int)(height * (BENCH_CHUNK_HEIGHT - 1));
+			for (int y = 0; y < BENCH_CHUNK_HEIGHT; y++) {
+				chunk->blocks[y][z][x] = y <= top ? (unsigned char)(1 + (y * 3) / BENCH_CHUNK_HEIGHT) : 0;
+			}
+		}
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: bench [name [args...]]\n\n");
+	for (size_t i = 0; i < BENCHMARK_COUNT; i++) {
+		fprintf(stderr, "  %-10s %s\n", benchmarks[i].name, benchmarks[i].description);
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		for (size_t i = 0; i < BENCHMARK_COUNT; i++) {
+			if (benchmarks[i].run(0, NULL) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+		}
+		return EXIT_SUCCESS;
+	}
+
+	for (size_t i = 0; i < BENCHMARK_COUNT; i++) {
+		if (strcmp(argv[1], benchmarks[i].name) == 0) {
+			return benchmarks[i].run(argc - 2, argv + 2);
+		}
+	}
+
+	usage();
+	return EXIT_FAILURE;
+}
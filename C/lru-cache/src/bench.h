@@ -0,0 +1,92 @@
+#ifndef BENCH_H
+#define BENCH_H 1
+
+// clock_gettime is POSIX, not part of -std=c11
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Circular walk used by the terminal demo in main.c
+#define BENCH_ORBIT_RADIUS	   50.0F
+#define BENCH_ORBIT_ANGLE_STEP 0.5F
+#define BENCH_CHUNK_WIDTH	   16
+#define BENCH_CACHE_MARGIN	   2
+
+// Chunk payload for the benchmarks that store or copy chunks, see bench_chunk_generate
+#define BENCH_CHUNK_HEIGHT	64
+#define BENCH_CHUNK_OCTAVES 4
+
+// Straight flight patrolling back and forth along the x axis
+#define BENCH_FLIGHT_LENGTH			  256 // Chunks
+#define BENCH_FLIGHT_FRAMES_PER_CHUNK 4
+
+// Orbit that every BENCH_EXCURSION_PERIOD frames flies out and back, one chunk per frame
+#define BENCH_EXCURSION_PERIOD 4096
+#define BENCH_EXCURSION_LENGTH 64 // Chunks
+
+// Player jumps to a random chunk every BENCH_TELEPORT_PERIOD frames
+#define BENCH_TELEPORT_PERIOD 256
+#define BENCH_TELEPORT_RANGE  4096 // Chunks from the origin
+
+struct Coord {
+	int x, z;
+};
+
+struct BenchChunk {
+	unsigned char blocks[BENCH_CHUNK_HEIGHT][BENCH_CHUNK_WIDTH][BENCH_CHUNK_WIDTH];
+};
+
+/** Writes the chunks requested in frame t of a movement trace, returns how many */
+typedef size_t (*BenchFrameFn)(int t, int renderDistance, struct Coord *out);
+
+static inline double bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec * 1e9) + (double)ts.tv_nsec;
+}
+
+/** xorshift64*, deterministic so every run sees the same workload */
+static inline uint64_t bench_rand(uint64_t *state) {
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+size_t bench_spiral(int centerX, int centerZ, int radius, struct Coord *out);
+size_t bench_orbit_frame(int t, int renderDistance, struct Coord *out);
+size_t bench_flight_frame(int t, int renderDistance, struct Coord *out);
+size_t bench_excursion_frame(int t, int renderDistance, struct Coord *out);
+size_t bench_teleport_frame(int t, int renderDistance, struct Coord *out);
+size_t bench_standing_frame(int t, int renderDistance, struct Coord *out);
+void bench_random_coords(uint64_t seed, int range, size_t count, struct Coord *out);
+void bench_chunk_generate(struct BenchChunk *chunk, int chunkX, int chunkZ);
+
+int bench_hash(int argc, char **argv);
+int bench_probe(int argc, char **argv);
+int bench_churn(int argc, char **argv);
+int bench_sharded(int argc, char **argv);
+int bench_policy(int argc, char **argv);
+int bench_batch(int argc, char **argv);
+int bench_pin(int argc, char **argv);
+int bench_budget(int argc, char **argv);
+int bench_stats(int argc, char **argv);
+int bench_trace(int argc, char **argv);
+int bench_record(int argc, char **argv);
+int bench_replay(int argc, char **argv);
+int bench_keyed(int argc, char **argv);
+int bench_expire(int argc, char **argv);
+int bench_grid(int argc, char **argv);
+int bench_prefetch(int argc, char **argv);
+int bench_store(int argc, char **argv);
+int bench_snapshot(int argc, char **argv);
+int bench_memory(int argc, char **argv);
+int bench_rehash(int argc, char **argv);
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * Allocation of the single blocks the cache and the hashmap keep their
+ * arrays in. Every block comes back zeroed.
+ *
+ * Transparent huge pages only back a range that covers a whole aligned huge
+ * page, so huge blocks are mapped one huge page larger than needed and the
+ * misaligned head and the tail are unmapped again. MADV_HUGEPAGE is a Linux
+ * hint; where it does not exist the block is still aligned and the kernel
+ * decides on its own.
+ */
+
+// mmap is POSIX and madvise's MADV_HUGEPAGE a Linux extension, neither is part of -std=c11
+#define _DEFAULT_SOURCE
+
+#include "block-memory.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static inline size_t block_memory_round(size_t size, size_t alignment) {
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static void *block_memory_map_huge(size_t size) {
+	size_t mapped = size + BLOCK_MEMORY_HUGE_PAGE;
+
+	uint8_t *map = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	uint8_t *block = (uint8_t *)block_memory_round((uintptr_t)map, BLOCK_MEMORY_HUGE_PAGE);
+	size_t head = (size_t)(block - map);
+	if (head > 0) {
+		munmap(map, head);
+	}
+	if (mapped - head > size) {
+		munmap(block + size, mapped - head - size);
+	}
+
+#ifdef MADV_HUGEPAGE
+	madvise(block, size, MADV_HUGEPAGE);
+#endif
+
+	return block;
+}
+
+/** Returns a zeroed block of at least size bytes, or NULL */
+void *block_memory_alloc(enum BlockMemory memory, size_t size) {
+	switch (memory) {
+	case BLOCK_MEMORY_HUGE:
+		if (size >= BLOCK_MEMORY_HUGE_PAGE) {
+			return block_memory_map_huge(block_memory_round(size, BLOCK_MEMORY_HUGE_PAGE));
+		}
+		// Smaller blocks would waste most of the huge page
+		/* fall through */
+	case BLOCK_MEMORY_ALIGNED: {
+		size_t rounded = block_memory_round(size, BLOCK_MEMORY_LINE); // aligned_alloc wants a multiple of the alignment
+		void *block = aligned_alloc(BLOCK_MEMORY_LINE, rounded);
+		if (block != NULL) {
+			memset(block, 0, rounded);
+		}
+		return block;
+	}
+	case BLOCK_MEMORY_DEFAULT:
+	default:
+		return calloc(1, size);
+	}
+}
+
+/** Frees a block, given the mode and size it was allocated with */
+void block_memory_free(enum BlockMemory memory, void *block, size_t size) {
+	if (block == NULL) {
+		return;
+	}
+
+	if (memory == BLOCK_MEMORY_HUGE && size >= BLOCK_MEMORY_HUGE_PAGE) {
+		munmap(block, block_memory_round(size, BLOCK_MEMORY_HUGE_PAGE));
+	} else {
+		free(block);
+	}
+}
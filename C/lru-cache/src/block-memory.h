@@ -0,0 +1,28 @@
+#ifndef BLOCK_MEMORY_H
+#define BLOCK_MEMORY_H 1
+
+#include <stddef.h>
+
+#define BLOCK_MEMORY_LINE	   64
+#define BLOCK_MEMORY_HUGE_PAGE (2 * 1024 * 1024)
+
+/** Where the single block of a cache or hashmap comes from */
+enum BlockMemory {
+	BLOCK_MEMORY_DEFAULT, // malloc
+	BLOCK_MEMORY_ALIGNED, // Cache line aligned block, and every array in it starts on a cache line
+	BLOCK_MEMORY_HUGE	  // Aligned, blocks of a huge page or more are mapped on huge page boundaries and madvised for THP
+};
+
+void *block_memory_alloc(enum BlockMemory memory, size_t size);
+void block_memory_free(enum BlockMemory memory, void *block, size_t size);
+
+/** Rounds an offset into a block up to where the next array may start */
+static inline size_t block_memory_align(enum BlockMemory memory, size_t offset) {
+	if (memory == BLOCK_MEMORY_DEFAULT) {
+		return offset;
+	}
+
+	return (offset + BLOCK_MEMORY_LINE - 1) & ~(size_t)(BLOCK_MEMORY_LINE - 1);
+}
+
+#endif
@@ -0,0 +1,215 @@
+/**
+ * Toroidal chunk grid. The window's corner chunk lives in cell (origin_x,
+ * origin_z) and every other chunk in the window is stored at its offset
+ * from the corner, wrapped around the side. Each chunk inside the window
+ * has a cell of its own, so a lookup is a range check, two wrapping adds and
+ * a tag compare.
+ *
+ * When the center moves by dx, the dx columns on the trailing side leave the
+ * window and become the columns of the leading side, so recycling them is
+ * all it takes. Rows work the same way. A jump of a whole window or more
+ * clears every cell.
+ */
+
+#include "chunk-grid.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct GridCell {
+	int x, z; // Tag, only meaningful while value is not NULL
+	void *value;
+};
+
+struct ChunkGrid {
+	struct GridCell *cells; // side * side, row major
+	unsigned int side;
+	int radius;
+
+	int min_x, min_z;				 // Corner of the window
+	unsigned int origin_x, origin_z; // Column and row of the corner's cell
+	size_t size;
+
+	LRUCacheEvictFn on_evict;
+	void *userdata;
+};
+
+CHUNKGRID *chunk_grid_create(int radius, LRUCacheEvictFn on_evict, void *userdata) {
+	assert(radius >= 0 && radius < 0x7FFF && "Grid radius out of range");
+
+	unsigned int side = (unsigned int)radius * 2 + 1;
+	size_t blockSize = sizeof(CHUNKGRID) + (size_t)side * side * sizeof(struct GridCell);
+
+	char *block = malloc(blockSize);
+	if (block == NULL) {
+		return NULL;
+	}
+
+	memset(block, 0, blockSize);
+
+	CHUNKGRID *grid = (CHUNKGRID *)block;
+	grid->cells = (struct GridCell *)(block + sizeof(CHUNKGRID));
+	grid->side = side;
+	grid->radius = radius;
+	grid->min_x = -radius;
+	grid->min_z = -radius;
+	grid->on_evict = on_evict;
+	grid->userdata = userdata;
+
+	return grid;
+}
+
+static inline void chunk_grid_release(CHUNKGRID *grid, struct GridCell *cell) {
+	if (cell->value == NULL) {
+		return;
+	}
+
+	if (grid->on_evict != NULL) {
+		grid->on_evict(cell->x, cell->z, cell->value, grid->userdata);
+	}
+
+	cell->value = NULL;
+	grid->size--;
+}
+
+void chunk_grid_destroy(CHUNKGRID *grid) {
+	assert(grid != NULL);
+
+	size_t count = (size_t)grid->side * grid->side;
+	for (size_t i = 0; i < count && grid->size > 0; i++) {
+		chunk_grid_release(grid, &grid->cells[i]);
+	}
+
+	free(grid);
+}
+
+static void chunk_grid_recycle_column(CHUNKGRID *grid, unsigned int column) {
+	for (unsigned int row = 0; row < grid->side; row++) {
+		chunk_grid_release(grid, &grid->cells[(size_t)row * grid->side + column]);
+	}
+}
+
+static void chunk_grid_recycle_row(CHUNKGRID *grid, unsigned int row) {
+	struct GridCell *cells = &grid->cells[(size_t)row * grid->side];
+	for (unsigned int column = 0; column < grid->side; column++) {
+		chunk_grid_release(grid, &cells[column]);
+	}
+}
+
+/** First column or row to recycle when the corner moves by delta, the others follow it */
+static inline unsigned int chunk_grid_leaving(unsigned int origin, int64_t delta, unsigned int side) {
+	// Moving up the low end leaves, moving down the high end
+	return delta > 0 ? origin : (unsigned int)((origin + (uint64_t)((int64_t)side + delta)) % side);
+}
+
+static inline unsigned int chunk_grid_wrap(unsigned int origin, int64_t delta, unsigned int side) {
+	int64_t wrapped = ((int64_t)origin + delta) % (int64_t)side;
+	return (unsigned int)(wrapped < 0 ? wrapped + (int64_t)side : wrapped);
+}
+
+/**
+ * Moves the window to be centered on the given chunk. Chunks that are no
+ * longer inside it are released, a row or column at a time.
+ */
+void chunk_grid_recenter(CHUNKGRID *grid, int centerX, int centerZ) {
+	assert(grid != NULL);
+
+	int64_t minX = (int64_t)centerX - grid->radius;
+	int64_t minZ = (int64_t)centerZ - grid->radius;
+	int64_t dx = minX - grid->min_x;
+	int64_t dz = minZ - grid->min_z;
+	int64_t side = grid->side;
+
+	if (dx == 0 && dz == 0) {
+		return;
+	}
+
+	if (dx >= side || dx <= -side || dz >= side || dz <= -side) {
+		size_t count = (size_t)grid->side * grid->side;
+		for (size_t i = 0; i < count && grid->size > 0; i++) {
+			chunk_grid_release(grid, &grid->cells[i]);
+		}
+	} else {
+		unsigned int column = chunk_grid_leaving(grid->origin_x, dx, grid->side);
+		for (int64_t i = 0; i < (dx < 0 ? -dx : dx); i++) {
+			chunk_grid_recycle_column(grid, column);
+			column = column + 1 == grid->side ? 0 : column + 1;
+		}
+
+		unsigned int row = chunk_grid_leaving(grid->origin_z, dz, grid->side);
+		for (int64_t i = 0; i < (dz < 0 ? -dz : dz); i++) {
+			chunk_grid_recycle_row(grid, row);
+			row = row + 1 == grid->side ? 0 : row + 1;
+		}
+	}
+
+	grid->origin_x = chunk_grid_wrap(grid->origin_x, dx, grid->side);
+	grid->origin_z = chunk_grid_wrap(grid->origin_z, dz, grid->side);
+	grid->min_x = (int)minX;
+	grid->min_z = (int)minZ;
+}
+
+/** Returns the cell a chunk inside the window is stored in, or NULL when it is outside */
+static inline struct GridCell *chunk_grid_cell(CHUNKGRID *grid, int x, int z) {
+	unsigned int dx = (unsigned int)x - (unsigned int)grid->min_x;
+	unsigned int dz = (unsigned int)z - (unsigned int)grid->min_z;
+	if (dx >= grid->side || dz >= grid->side) {
+		return NULL;
+	}
+
+	unsigned int column = grid->origin_x + dx;
+	unsigned int row = grid->origin_z + dz;
+	column -= column >= grid->side ? grid->side : 0;
+	row -= row >= grid->side ? grid->side : 0;
+
+	return &grid->cells[(size_t)row * grid->side + column];
+}
+
+/**
+ * Stores a value for a chunk inside the window, releasing the value it
+ * replaces. A chunk outside the window cannot be stored, its value goes
+ * straight to on_evict.
+ */
+void chunk_grid_put(CHUNKGRID *grid, int x, int z, void *value) {
+	assert(grid != NULL);
+	assert(value != NULL);
+
+	struct GridCell *cell = chunk_grid_cell(grid, x, z);
+	if (cell == NULL) {
+		if (grid->on_evict != NULL) {
+			grid->on_evict(x, z, value, grid->userdata);
+		}
+		return;
+	}
+
+	if (cell->value == NULL) {
+		grid->size++;
+	} else {
+		assert(cell->x == x && cell->z == z && "Cell was not recycled when it left the window");
+		if (cell->value != value && grid->on_evict != NULL) {
+			grid->on_evict(x, z, cell->value, grid->userdata);
+		}
+	}
+
+	cell->x = x;
+	cell->z = z;
+	cell->value = value;
+}
+
+void *chunk_grid_get(CHUNKGRID *grid, int x, int z) {
+	assert(grid != NULL);
+
+	struct GridCell *cell = chunk_grid_cell(grid, x, z);
+	if (cell == NULL || cell->x != x || cell->z != z) {
+		return NULL;
+	}
+
+	return cell->value;
+}
+
+size_t chunk_grid_size(CHUNKGRID *grid) {
+	assert(grid != NULL);
+
+	return grid->size;
+}
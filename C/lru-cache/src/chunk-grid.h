@@ -0,0 +1,25 @@
+#ifndef CHUNK_GRID_H
+#define CHUNK_GRID_H 1
+
+#include "lru-cache.h"
+#include <stddef.h>
+
+typedef struct ChunkGrid CHUNKGRID;
+
+/**
+ * Clipmap style chunk container: a square window of (2 * radius + 1)^2
+ * chunks around a center, stored in a fixed array that wraps around in both
+ * directions. No hashing and no probing, the cell of a chunk follows from
+ * its coordinates. Moving the center recycles the rows and columns that fell
+ * out of the window, handing their values to on_evict (may be NULL).
+ */
+CHUNKGRID *chunk_grid_create(int radius, LRUCacheEvictFn on_evict, void *userdata);
+void chunk_grid_destroy(CHUNKGRID *grid);
+
+void chunk_grid_recenter(CHUNKGRID *grid, int centerX, int centerZ);
+
+void chunk_grid_put(CHUNKGRID *grid, int x, int z, void *value);
+void *chunk_grid_get(CHUNKGRID *grid, int x, int z);
+size_t chunk_grid_size(CHUNKGRID *grid);
+
+#endif
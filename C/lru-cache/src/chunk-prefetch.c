@@ -0,0 +1,136 @@
+/**
+ * Velocity extrapolation for prefetching chunks. The velocity is an
+ * exponential moving average of the per frame movement, so a single jittery
+ * frame does not swing the prediction. A step longer than
+ * CHUNK_PREFETCH_MAX_STEP is a teleport and resets it.
+ *
+ * Every prediction is kept until the frame it was made for, and the distance
+ * to where the player actually got is averaged too. While that error is
+ * above CHUNK_PREFETCH_MAX_ERROR nothing is planned: a player circling or
+ * zigzagging faster than the lookahead would only get chunks generated that
+ * push useful ones out of the cache.
+ *
+ * The planned chunks are the predicted view square minus the current one,
+ * nearest to the predicted center first, which is the band the player is
+ * moving into.
+ */
+
+#include "chunk-prefetch.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define CHUNK_PREFETCH_SMOOTHING 0.5F // Weight of the newest sample in the velocity and the error
+#define CHUNK_PREFETCH_MAX_STEP	 8.0F // Chunks per frame, anything faster is a teleport
+#define CHUNK_PREFETCH_MAX_ERROR 2.0F // Chunks the predictions may miss by on average and still be used
+
+struct ChunkPrefetchPoint {
+	float x, z;
+};
+
+struct ChunkPrefetch {
+	float x, z;	  // Last observed position, in chunks
+	float vx, vz; // Chunks per frame
+	float error;  // Average distance between the predictions and where the player got, in chunks
+
+	int frames;			 // Lookahead
+	unsigned int observed; // Frames since creation or the last teleport
+	struct ChunkPrefetchPoint predicted[CHUNK_PREFETCH_MAX_FRAMES]; // Predictions not due yet, by the frame they were made in modulo frames
+};
+
+/** Creates a prefetcher predicting the given number of frames ahead, usually a little more than generation takes */
+CHUNKPREFETCH *chunk_prefetch_create(int frames) {
+	assert(frames > 0 && frames <= CHUNK_PREFETCH_MAX_FRAMES);
+
+	CHUNKPREFETCH *prefetch = calloc(1, sizeof(CHUNKPREFETCH));
+	if (prefetch == NULL) {
+		return NULL;
+	}
+
+	prefetch->frames = frames;
+	return prefetch;
+}
+
+void chunk_prefetch_destroy(CHUNKPREFETCH *prefetch) {
+	assert(prefetch != NULL);
+
+	free(prefetch);
+}
+
+/** Records the player position of this frame, in chunks (block coordinates divided by the chunk width) */
+void chunk_prefetch_observe(CHUNKPREFETCH *prefetch, float chunkX, float chunkZ) {
+	assert(prefetch != NULL);
+
+	float dx = chunkX - prefetch->x;
+	float dz = chunkZ - prefetch->z;
+
+	if (prefetch->observed == 0 || fabsf(dx) > CHUNK_PREFETCH_MAX_STEP || fabsf(dz) > CHUNK_PREFETCH_MAX_STEP) {
+		prefetch->vx = 0.0F;
+		prefetch->vz = 0.0F;
+		prefetch->error = 0.0F;
+		prefetch->observed = 0;
+	} else {
+		prefetch->vx += (dx - prefetch->vx) * CHUNK_PREFETCH_SMOOTHING;
+		prefetch->vz += (dz - prefetch->vz) * CHUNK_PREFETCH_SMOOTHING;
+	}
+
+	// The slot holds the prediction made frames ago for this frame, it is replaced by the one for frames ahead
+	struct ChunkPrefetchPoint *predicted = &prefetch->predicted[prefetch->observed % (unsigned int)prefetch->frames];
+	if (prefetch->observed >= (unsigned int)prefetch->frames) {
+		float error = hypotf(chunkX - predicted->x, chunkZ - predicted->z);
+		prefetch->error += (error - prefetch->error) * CHUNK_PREFETCH_SMOOTHING;
+	}
+
+	predicted->x = chunkX + prefetch->vx * (float)prefetch->frames;
+	predicted->z = chunkZ + prefetch->vz * (float)prefetch->frames;
+
+	prefetch->x = chunkX;
+	prefetch->z = chunkZ;
+	prefetch->observed++;
+}
+
+/**
+ * Writes up to max chunks of the view square of the given radius around
+ * where the player will be at the end of the lookahead, leaving out the ones
+ * inside the current view square. Returns how many were written, none while
+ * the player stands still or moves too unpredictably.
+ */
+size_t chunk_prefetch_plan(const CHUNKPREFETCH *prefetch, int radius, struct LRUCacheKey *out, size_t max) {
+	assert(prefetch != NULL);
+	assert(out != NULL || max == 0);
+
+	if (prefetch->observed < (unsigned int)prefetch->frames || prefetch->error > CHUNK_PREFETCH_MAX_ERROR) {
+		return 0;
+	}
+
+	int centerX = (int)floorf(prefetch->x);
+	int centerZ = (int)floorf(prefetch->z);
+	int aheadX = (int)floorf(prefetch->x + prefetch->vx * (float)prefetch->frames);
+	int aheadZ = (int)floorf(prefetch->z + prefetch->vz * (float)prefetch->frames);
+	size_t count = 0;
+
+	if (aheadX == centerX && aheadZ == centerZ) {
+		return 0;
+	}
+
+	// Rings of growing distance around the predicted center
+	for (int ring = 0; ring <= radius && count < max; ring++) {
+		for (int dz = -ring; dz <= ring && count < max; dz++) {
+			bool edge = dz == -ring || dz == ring;
+
+			for (int dx = -ring; dx <= ring && count < max; dx += edge || ring == 0 ? 1 : ring * 2) {
+				int x = aheadX + dx;
+				int z = aheadZ + dz;
+
+				if (abs(x - centerX) > radius || abs(z - centerZ) > radius) {
+					out[count].x = x;
+					out[count].z = z;
+					count++;
+				}
+			}
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,24 @@
+#ifndef CHUNK_PREFETCH_H
+#define CHUNK_PREFETCH_H 1
+
+#include "lru-cache.h"
+#include <stddef.h>
+
+typedef struct ChunkPrefetch CHUNKPREFETCH;
+
+#define CHUNK_PREFETCH_MAX_FRAMES 32
+
+/**
+ * Predicts which chunks the player is about to see. Fed the player position
+ * once a frame, it keeps a smoothed velocity and plans the chunks of the
+ * view square around the extrapolated position that the current view does
+ * not cover yet, to be generated ahead with lru_cache_prefetch. Nothing is
+ * planned while its predictions keep missing.
+ */
+CHUNKPREFETCH *chunk_prefetch_create(int frames);
+void chunk_prefetch_destroy(CHUNKPREFETCH *prefetch);
+
+void chunk_prefetch_observe(CHUNKPREFETCH *prefetch, float chunkX, float chunkZ);
+size_t chunk_prefetch_plan(const CHUNKPREFETCH *prefetch, int radius, struct LRUCacheKey *out, size_t max);
+
+#endif
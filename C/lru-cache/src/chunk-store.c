@@ -0,0 +1,560 @@
+/**
+ * Region file behind the chunk cache. The file is a header followed by
+ * slots of a fixed stride, each the chunk's coordinates and its payload,
+ * allocated in the order chunks are first written and never freed. It is
+ * mapped whole, so a load is a memcpy out of the page cache, and an index
+ * of every written chunk is rebuilt from the slots when the file is opened.
+ *
+ * Evicted dirty chunks go into a queue that the writer thread takes as one
+ * batch once CHUNK_STORE_BATCH of them are waiting. The writer picks the
+ * slots under the lock, copies the payloads in without it and only then
+ * releases the values. Until then a load finds a chunk in the queue or the
+ * batch being written, so a chunk evicted and needed again right away never
+ * waits for its write. Only the writer grows the file, under the lock, which
+ * is also held for every load from the mapping.
+ *
+ * The header's slot count only grows once a batch's payloads are copied in,
+ * so a writer interrupted halfway leaves the new slots outside the file's
+ * count, to be written over, instead of indexed with garbage in them.
+ *
+ * A chunk that cannot get a slot, because the file cannot grow or the index
+ * is out of memory, stays at the head of its batch, still visible to loads.
+ * The writer retries it every CHUNK_STORE_RETRY_MS and only takes the next
+ * batch once it is written, so evictions end up waiting for room in the
+ * queue until the disk has space again. Nothing is released unwritten
+ * before chunk_store_close.
+ */
+
+// mmap, ftruncate and mkstemp are POSIX, not part of -std=c11
+#define _POSIX_C_SOURCE 200809L
+
+#include "chunk-store.h"
+#include "hashmap.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHUNK_STORE_MAGIC	  0x4E474552 // "REGN"
+#define CHUNK_STORE_VERSION	  1
+#define CHUNK_STORE_HEADER	  64  // Bytes before the first slot, one cache line
+#define CHUNK_STORE_ALIGN	  64  // Slot stride alignment
+#define CHUNK_STORE_SLOTS	  256 // Slots of a new file, doubled whenever it is full
+#define CHUNK_STORE_BATCH	  32  // Queued writes that wake the writer
+#define CHUNK_STORE_QUEUE	  256 // Queued writes that make chunk_store_evict wait for the writer
+#define CHUNK_STORE_RETRY_MS  100 // Wait before writing a batch that failed again
+#define CHUNK_STORE_TEMPLATE  "/tmp/chunk-store-XXXXXX"
+
+struct ChunkStoreHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t payload_size;
+	uint64_t count; // Slots written
+};
+
+struct ChunkStoreSlot {
+	int32_t x, z; // Followed by the payload
+};
+
+struct ChunkStoreWrite {
+	int x, z;
+	void *value;
+	size_t slot;
+};
+
+struct ChunkStore {
+	int fd;
+	unsigned char *map;
+	size_t capacity; // Slots the file has room for
+	size_t used;	 // Slots handed out, the header counts the ones written
+	size_t stride;
+	size_t payload_size;
+
+	HASHMAP *index; // Slot + 1 of every chunk in the file
+	HASHMAP *clean; // Value each clean chunk was loaded into
+
+	struct ChunkStoreWrite *queue; // Dirty chunks waiting for the writer, oldest first
+	struct ChunkStoreWrite *batch; // Chunks the writer is copying in
+	size_t queued;
+	size_t batched;
+	size_t batch_head; // First chunk of the batch not written yet
+	bool stalled;	   // The batch could not be written completely and is retried
+
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t wake; // Writer, a batch is ready or the queue is being flushed
+	pthread_cond_t done; // A batch was written
+	int flushers;
+	bool stop;
+
+	LRUCacheEvictFn release;
+	void *userdata;
+
+	struct ChunkStoreStats stats;
+};
+
+static inline struct ChunkStoreHeader *chunk_store_header(CHUNKSTORE *store) {
+	return (struct ChunkStoreHeader *)store->map;
+}
+
+static inline unsigned char *chunk_store_slot(unsigned char *map, size_t stride, size_t slot) {
+	return map + CHUNK_STORE_HEADER + slot * stride;
+}
+
+/** Makes room for twice as many slots. Maps the larger file before dropping the old mapping, so a failure leaves it in place */
+static bool chunk_store_grow(CHUNKSTORE *store) {
+	size_t capacity = store->capacity * 2;
+	size_t size = CHUNK_STORE_HEADER + capacity * store->stride;
+
+	if (ftruncate(store->fd, (off_t)size) != 0) {
+		return false;
+	}
+
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+
+	munmap(store->map, CHUNK_STORE_HEADER + store->capacity * store->stride);
+	store->map = map;
+	store->capacity = capacity;
+	return true;
+}
+
+/** Chunks evicted and not written yet */
+static inline size_t chunk_store_waiting(const CHUNKSTORE *store) {
+	return store->queued + store->batched - store->batch_head;
+}
+
+/** Gives a chunk its slot, the one it was written to before or the next free one. Returns false if there is no room for it. */
+static bool chunk_store_assign(CHUNKSTORE *store, struct ChunkStoreWrite *write) {
+	uintptr_t slot = (uintptr_t)hashmap_get(store->index, write->x, write->z);
+
+	if (slot == 0) {
+		if (store->used == store->capacity && !chunk_store_grow(store)) {
+			return false;
+		}
+
+		// Indexed before the slot is taken, a chunk that cannot be indexed could never be found again
+		slot = (uintptr_t)store->used + 1;
+		if (!hashmap_insert(store->index, write->x, write->z, (void *)slot)) {
+			return false;
+		}
+		store->used++;
+	}
+
+	write->slot = (size_t)slot - 1;
+	return true;
+}
+
+/** Waits until there is a batch to write, or returns false once stopped with nothing left */
+static bool chunk_store_wait(CHUNKSTORE *store) {
+	struct timespec retry;
+	if (store->stalled) {
+		clock_gettime(CLOCK_REALTIME, &retry);
+		retry.tv_nsec += CHUNK_STORE_RETRY_MS * 1000000L;
+		retry.tv_sec += retry.tv_nsec / 1000000000L;
+		retry.tv_nsec %= 1000000000L;
+	}
+
+	// A stalled batch is only retried on time, flushes and new chunks would just fail it again
+	while (!store->stop) {
+		if (store->stalled) {
+			if (pthread_cond_timedwait(&store->wake, &store->lock, &retry) == ETIMEDOUT) {
+				break;
+			}
+		} else if (store->queued >= CHUNK_STORE_BATCH || (store->flushers > 0 && store->queued > 0)) {
+			break;
+		} else {
+			pthread_cond_wait(&store->wake, &store->lock);
+		}
+	}
+
+	return chunk_store_waiting(store) > 0;
+}
+
+static void *chunk_store_write(void *arg) {
+	CHUNKSTORE *store = arg;
+
+	pthread_mutex_lock(&store->lock);
+	while (chunk_store_wait(store)) {
+		// A batch that failed before is finished first, only then the queue becomes the next batch
+		if (store->batch_head == store->batched) {
+			struct ChunkStoreWrite *batch = store->queue;
+			store->queue = store->batch;
+			store->batch = batch;
+			store->batched = store->queued;
+			store->batch_head = 0;
+			store->queued = 0;
+		}
+
+		struct ChunkStoreWrite *batch = store->batch;
+		size_t first = store->batch_head;
+		size_t count = store->batched;
+
+		size_t written = first;
+		while (written < count && chunk_store_assign(store, &batch[written])) {
+			written++;
+		}
+
+		unsigned char *map = store->map;
+		pthread_cond_broadcast(&store->done); // Room in the queue again
+		pthread_mutex_unlock(&store->lock);
+
+		for (size_t i = first; i < written; i++) {
+			unsigned char *slot = chunk_store_slot(map, store->stride, batch[i].slot);
+			struct ChunkStoreSlot tag = {batch[i].x, batch[i].z};
+
+			memcpy(slot, &tag, sizeof(tag));
+			memcpy(slot + sizeof(tag), batch[i].value, store->payload_size);
+		}
+
+		pthread_mutex_lock(&store->lock);
+		chunk_store_header(store)->count = store->used; // Every slot handed out is written now
+		store->batch_head = written;
+		store->stalled = written < count;
+		if (!store->stalled) {
+			store->batched = 0;
+			store->batch_head = 0;
+		}
+		store->stats.writes += written - first;
+		store->stats.failed += count - written;
+		store->stats.batches++;
+		bool stopping = store->stop && store->stalled; // chunk_store_close releases what is left
+		pthread_cond_broadcast(&store->done);
+		pthread_mutex_unlock(&store->lock);
+
+		// Loads no longer see the chunks written, so nothing reads their values anymore
+		if (store->release != NULL) {
+			for (size_t i = first; i < written; i++) {
+				store->release(batch[i].x, batch[i].z, batch[i].value, store->userdata);
+			}
+		}
+
+		pthread_mutex_lock(&store->lock);
+		if (stopping) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&store->lock);
+
+	return NULL;
+}
+
+/** Maps the file, starting it over when it is new or was written with a different payload size */
+static bool chunk_store_map(CHUNKSTORE *store) {
+	struct stat info;
+	if (fstat(store->fd, &info) != 0) {
+		return false;
+	}
+
+	size_t size = (size_t)info.st_size;
+	size_t count = 0;
+	store->capacity = CHUNK_STORE_SLOTS;
+
+	if (size >= CHUNK_STORE_HEADER + store->stride) {
+		struct ChunkStoreHeader header;
+
+		if (pread(store->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && header.magic == CHUNK_STORE_MAGIC &&
+			header.version == CHUNK_STORE_VERSION && header.payload_size == store->payload_size) {
+			size_t capacity = (size - CHUNK_STORE_HEADER) / store->stride;
+
+			if (header.count <= capacity) {
+				count = (size_t)header.count;
+				store->capacity = capacity > store->capacity ? capacity : store->capacity;
+			}
+		}
+	}
+
+	size = CHUNK_STORE_HEADER + store->capacity * store->stride;
+	if (ftruncate(store->fd, (off_t)size) != 0) {
+		return false;
+	}
+
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+
+	store->map = map;
+
+	struct ChunkStoreHeader *header = chunk_store_header(store);
+	*header = (struct ChunkStoreHeader){CHUNK_STORE_MAGIC, CHUNK_STORE_VERSION, store->payload_size, count};
+
+	for (size_t i = 0; i < count; i++) {
+		struct ChunkStoreSlot tag;
+		memcpy(&tag, chunk_store_slot(store->map, store->stride, i), sizeof(tag));
+
+		if (!hashmap_insert(store->index, tag.x, tag.z, (void *)(uintptr_t)(i + 1))) {
+			header->count = i; // Chunks past this one are written over
+			break;
+		}
+	}
+
+	store->used = (size_t)header->count;
+
+	return true;
+}
+
+/** Frees a store that failed to open, whatever part of it was set up */
+static void chunk_store_discard(CHUNKSTORE *store) {
+	if (store->fd >= 0) {
+		close(store->fd);
+	}
+	if (store->index != NULL) {
+		hashmap_destroy(store->index);
+	}
+	if (store->clean != NULL) {
+		hashmap_destroy(store->clean);
+	}
+	free(store);
+}
+
+/**
+ * Opens the region file at path, creating it if needed, for payloads of
+ * payloadSize bytes. A NULL path keeps the region in an unnamed temporary
+ * file. Returns NULL if the file cannot be mapped or the writer not started.
+ */
+CHUNKSTORE *chunk_store_open(const char *path, size_t payloadSize, LRUCacheEvictFn release, void *userdata) {
+	assert(payloadSize > 0);
+
+	size_t blockSize = sizeof(CHUNKSTORE) + 2 * CHUNK_STORE_QUEUE * sizeof(struct ChunkStoreWrite);
+
+	char *block = malloc(blockSize);
+	if (block == NULL) {
+		return NULL;
+	}
+
+	memset(block, 0, blockSize);
+
+	CHUNKSTORE *store = (CHUNKSTORE *)block;
+	store->queue = (struct ChunkStoreWrite *)(block + sizeof(CHUNKSTORE));
+	store->batch = store->queue + CHUNK_STORE_QUEUE;
+	store->payload_size = payloadSize;
+	store->stride = (sizeof(struct ChunkStoreSlot) + payloadSize + CHUNK_STORE_ALIGN - 1) & ~(size_t)(CHUNK_STORE_ALIGN - 1);
+	store->release = release;
+	store->userdata = userdata;
+	store->fd = -1;
+
+	struct HashmapConfig config = {
+		.capacity = CHUNK_STORE_SLOTS,
+		.max_load_factor = 0.75F,
+		.hash = HASHMAP_HASH_COORDS,
+	};
+
+	store->index = hashmap_create_with(&config);
+	store->clean = hashmap_create_with(&config);
+
+	if (path != NULL) {
+		store->fd = open(path, O_RDWR | O_CREAT, 0644);
+	} else {
+		char name[] = CHUNK_STORE_TEMPLATE;
+		store->fd = mkstemp(name);
+		if (store->fd >= 0) {
+			unlink(name);
+		}
+	}
+
+	if (store->index == NULL || store->clean == NULL || store->fd < 0 || !chunk_store_map(store)) {
+		chunk_store_discard(store);
+		return NULL;
+	}
+
+	pthread_mutex_init(&store->lock, NULL);
+	pthread_cond_init(&store->wake, NULL);
+	pthread_cond_init(&store->done, NULL);
+
+	if (pthread_create(&store->writer, NULL, chunk_store_write, store) != 0) {
+		pthread_cond_destroy(&store->done);
+		pthread_cond_destroy(&store->wake);
+		pthread_mutex_destroy(&store->lock);
+		munmap(store->map, CHUNK_STORE_HEADER + store->capacity * store->stride);
+		chunk_store_discard(store);
+		return NULL;
+	}
+
+	return store;
+}
+
+/**
+ * Writes everything still queued and closes the file. Destroy the cache
+ * first, its chunks are evicted into the store. Returns false if some chunks
+ * could not be written, they are released all the same.
+ */
+bool chunk_store_close(CHUNKSTORE *store) {
+	assert(store != NULL);
+
+	pthread_mutex_lock(&store->lock);
+	store->stop = true;
+	pthread_cond_signal(&store->wake);
+	pthread_mutex_unlock(&store->lock);
+
+	pthread_join(store->writer, NULL);
+
+	// Only left when the writer gave up on a batch
+	size_t lost = chunk_store_waiting(store);
+	if (store->release != NULL) {
+		for (size_t i = store->batch_head; i < store->batched; i++) {
+			store->release(store->batch[i].x, store->batch[i].z, store->batch[i].value, store->userdata);
+		}
+		for (size_t i = 0; i < store->queued; i++) {
+			store->release(store->queue[i].x, store->queue[i].z, store->queue[i].value, store->userdata);
+		}
+	}
+
+	size_t size = CHUNK_STORE_HEADER + store->capacity * store->stride;
+	msync(store->map, size, MS_SYNC);
+	munmap(store->map, size);
+	close(store->fd);
+
+	pthread_cond_destroy(&store->done);
+	pthread_cond_destroy(&store->wake);
+	pthread_mutex_destroy(&store->lock);
+	hashmap_destroy(store->index);
+	hashmap_destroy(store->clean);
+	free(store);
+
+	return lost == 0;
+}
+
+/**
+ * LRUCacheEvictFn taking the store as userdata. A clean chunk is released
+ * right away, a dirty one queued for writing. Waits for the writer only when
+ * CHUNK_STORE_QUEUE chunks are queued already.
+ */
+void chunk_store_evict(int x, int z, void *value, void *userdata) {
+	CHUNKSTORE *store = userdata;
+	assert(store != NULL);
+	assert(value != NULL);
+
+	pthread_mutex_lock(&store->lock);
+
+	// Removed either way, a clean value for the chunk that is not this one is gone already
+	if (hashmap_remove(store->clean, x, z) == value) {
+		store->stats.skipped++;
+		pthread_mutex_unlock(&store->lock);
+
+		if (store->release != NULL) {
+			store->release(x, z, value, store->userdata);
+		}
+		return;
+	}
+
+	while (store->queued == CHUNK_STORE_QUEUE) {
+		pthread_cond_wait(&store->done, &store->lock);
+	}
+
+	store->queue[store->queued++] = (struct ChunkStoreWrite){x, z, value, 0};
+	if (store->queued >= CHUNK_STORE_BATCH) {
+		pthread_cond_signal(&store->wake);
+	}
+
+	pthread_mutex_unlock(&store->lock);
+}
+
+/** Newest queued or in flight value of a chunk, NULL if it is not waiting to be written */
+static const void *chunk_store_pending(CHUNKSTORE *store, int x, int z) {
+	for (size_t i = store->queued; i-- > 0;) {
+		if (store->queue[i].x == x && store->queue[i].z == z) {
+			return store->queue[i].value;
+		}
+	}
+
+	for (size_t i = store->batched; i-- > store->batch_head;) {
+		if (store->batch[i].x == x && store->batch[i].z == z) {
+			return store->batch[i].value;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Copies the payload of a chunk the store holds into out and remembers out
+ * as the chunk's clean value. Returns false if the chunk was never written
+ * or queued, out is left alone then. Safe to call from any thread.
+ */
+bool chunk_store_load(CHUNKSTORE *store, int x, int z, void *out) {
+	assert(store != NULL);
+	assert(out != NULL);
+
+	pthread_mutex_lock(&store->lock);
+
+	const void *payload = chunk_store_pending(store, x, z);
+	if (payload == NULL) {
+		uintptr_t slot = (uintptr_t)hashmap_get(store->index, x, z);
+		if (slot == 0) {
+			store->stats.misses++;
+			pthread_mutex_unlock(&store->lock);
+			return false;
+		}
+
+		payload = chunk_store_slot(store->map, store->stride, (size_t)slot - 1) + sizeof(struct ChunkStoreSlot);
+	}
+
+	memcpy(out, payload, store->payload_size);
+	hashmap_insert(store->clean, x, z, out); // Left dirty if this fails, which only costs a write
+	store->stats.loads++;
+
+	pthread_mutex_unlock(&store->lock);
+	return true;
+}
+
+/**
+ * Call when a chunk was generated from scratch, so value is released on
+ * eviction instead of written, generating it again gives the same payload.
+ */
+void chunk_store_mark_clean(CHUNKSTORE *store, int x, int z, void *value) {
+	assert(store != NULL);
+	assert(value != NULL);
+
+	pthread_mutex_lock(&store->lock);
+	hashmap_insert(store->clean, x, z, value); // Left dirty if this fails, which only costs a write
+	pthread_mutex_unlock(&store->lock);
+}
+
+/** Call whenever a loaded or generated chunk changes, so it is written when it is evicted */
+void chunk_store_mark_dirty(CHUNKSTORE *store, int x, int z) {
+	assert(store != NULL);
+
+	pthread_mutex_lock(&store->lock);
+	hashmap_remove(store->clean, x, z);
+	pthread_mutex_unlock(&store->lock);
+}
+
+/** Waits until every chunk evicted so far is written. Returns false as soon as a write fails, the chunks stay queued. */
+bool chunk_store_flush(CHUNKSTORE *store) {
+	assert(store != NULL);
+
+	pthread_mutex_lock(&store->lock);
+	store->flushers++;
+	pthread_cond_signal(&store->wake);
+
+	size_t failed = store->stats.failed;
+	while (chunk_store_waiting(store) > 0 && store->stats.failed == failed) {
+		pthread_cond_wait(&store->done, &store->lock);
+	}
+
+	bool flushed = chunk_store_waiting(store) == 0;
+	store->flushers--;
+	pthread_mutex_unlock(&store->lock);
+
+	return flushed;
+}
+
+void chunk_store_stats(CHUNKSTORE *store, struct ChunkStoreStats *stats) {
+	assert(store != NULL);
+	assert(stats != NULL);
+
+	pthread_mutex_lock(&store->lock);
+	*stats = store->stats;
+	stats->slots = (size_t)chunk_store_header(store)->count;
+	pthread_mutex_unlock(&store->lock);
+}
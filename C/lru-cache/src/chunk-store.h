@@ -0,0 +1,43 @@
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H 1
+
+#include "lru-cache.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct ChunkStore CHUNKSTORE;
+
+struct ChunkStoreStats {
+	size_t loads;	// Misses served from the region file or the writeback queue
+	size_t misses;	// Chunks the store never saw
+	size_t writes;	// Dirty chunks written
+	size_t failed;	// Writes that found no room in the file or the index, those chunks stay queued and are retried
+	size_t skipped; // Evicted chunks that were still clean and were not written
+	size_t batches;
+	size_t slots; // Chunks held by the region file
+};
+
+/**
+ * Second tier beneath an LRUCACHE: evicted chunk payloads of a fixed size
+ * are kept in a memory mapped region file and copied back on a later miss.
+ * Install chunk_store_evict as the cache's on_evict with the store as its
+ * userdata. Only dirty chunks are written, by a background thread in
+ * batches, and release gets every value once the store is done with it.
+ *
+ * A chunk is clean from chunk_store_load or chunk_store_mark_clean until
+ * chunk_store_mark_dirty, every other value handed to chunk_store_evict is
+ * dirty. Chunks written survive chunk_store_close and are found again by
+ * the next chunk_store_open of the same path.
+ */
+CHUNKSTORE *chunk_store_open(const char *path, size_t payloadSize, LRUCacheEvictFn release, void *userdata);
+bool chunk_store_close(CHUNKSTORE *store);
+
+void chunk_store_evict(int x, int z, void *value, void *userdata);
+bool chunk_store_load(CHUNKSTORE *store, int x, int z, void *out);
+void chunk_store_mark_clean(CHUNKSTORE *store, int x, int z, void *value);
+void chunk_store_mark_dirty(CHUNKSTORE *store, int x, int z);
+
+bool chunk_store_flush(CHUNKSTORE *store);
+void chunk_store_stats(CHUNKSTORE *store, struct ChunkStoreStats *stats);
+
+#endif
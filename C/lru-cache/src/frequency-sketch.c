@@ -0,0 +1,155 @@
+/**
+ * Count-min frequency sketch packed 16 counters to a 64 bit word, giving
+ * about 2 bytes per expected key. The words are grouped in 64 byte blocks
+ * and a key's four counters all come from one block, two words per row, so
+ * an increment or estimate touches a single cache line. The estimate is the
+ * minimum of the four.
+ */
+
+#include "frequency-sketch.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FREQUENCY_SKETCH_DEPTH		4
+#define FREQUENCY_SKETCH_MAX		15
+#define FREQUENCY_SKETCH_RESET_MULT 10
+#define FREQUENCY_SKETCH_BLOCK_WORDS 8 // 64 bytes
+
+struct FrequencySketch {
+	uint64_t *table;
+	size_t block_mask; // Number of blocks - 1
+	size_t additions;
+	size_t sample_size;
+};
+
+FREQUENCYSKETCH *frequency_sketch_create(size_t expected_keys) {
+	assert(expected_keys > 0);
+
+	// Four counters per key, at least one full block
+	size_t blocks = 1;
+	while (blocks * FREQUENCY_SKETCH_BLOCK_WORDS * 16 < expected_keys * 4) {
+		blocks <<= 1;
+	}
+
+	FREQUENCYSKETCH *sketch = malloc(sizeof(FREQUENCYSKETCH));
+	if (sketch == NULL) {
+		return NULL;
+	}
+
+	sketch->table = calloc(blocks * FREQUENCY_SKETCH_BLOCK_WORDS, sizeof(uint64_t));
+	if (sketch->table == NULL) {
+		free(sketch);
+		return NULL;
+	}
+
+	sketch->block_mask = blocks - 1;
+	sketch->additions = 0;
+	sketch->sample_size = expected_keys * FREQUENCY_SKETCH_RESET_MULT;
+
+	return sketch;
+}
+
+void frequency_sketch_destroy(FREQUENCYSKETCH *sketch) {
+	assert(sketch != NULL);
+
+	free(sketch->table);
+	free(sketch);
+}
+
+/** Spreads the key hash, the low bits pick counters inside the block and the high bits pick the block */
+static inline uint64_t frequency_sketch_spread(uint64_t hash) {
+	hash = (hash ^ (hash >> 31)) * 0x9E3779B97F4A7C15ULL;
+	return hash ^ (hash >> 29);
+}
+
+/** Counter number of a row: word index * 16 + nibble */
+static inline size_t frequency_sketch_counter(const FREQUENCYSKETCH *sketch, uint64_t spread, int row) {
+	size_t block = (size_t)(spread >> 32) & sketch->block_mask;
+	size_t word = block * FREQUENCY_SKETCH_BLOCK_WORDS + (size_t)row * 2 + ((spread >> row) & 1);
+	size_t nibble = (spread >> (8 + row * 4)) & 15;
+	return word * 16 + nibble;
+}
+
+static inline unsigned int frequency_sketch_get(const FREQUENCYSKETCH *sketch, size_t counter) {
+	return (unsigned int)(sketch->table[counter >> 4] >> ((counter & 15) * 4)) & 0xF;
+}
+
+/** Halves every counter at once, 16 per word */
+static void frequency_sketch_reset(FREQUENCYSKETCH *sketch) {
+	size_t words = (sketch->block_mask + 1) * FREQUENCY_SKETCH_BLOCK_WORDS;
+	for (size_t i = 0; i < words; i++) {
+		sketch->table[i] = (sketch->table[i] >> 1) & 0x7777777777777777ULL;
+	}
+
+	sketch->additions /= 2;
+}
+
+void frequency_sketch_increment(FREQUENCYSKETCH *sketch, uint64_t hash) {
+	assert(sketch != NULL);
+
+	uint64_t spread = frequency_sketch_spread(hash);
+	bool added = false;
+	for (int row = 0; row < FREQUENCY_SKETCH_DEPTH; row++) {
+		size_t counter = frequency_sketch_counter(sketch, spread, row);
+		if (frequency_sketch_get(sketch, counter) < FREQUENCY_SKETCH_MAX) {
+			sketch->table[counter >> 4] += 1ULL << ((counter & 15) * 4);
+			added = true;
+		}
+	}
+
+	if (added && ++sketch->additions >= sketch->sample_size) {
+		frequency_sketch_reset(sketch);
+	}
+}
+
+unsigned int frequency_sketch_estimate(const FREQUENCYSKETCH *sketch, uint64_t hash) {
+	assert(sketch != NULL);
+
+	uint64_t spread = frequency_sketch_spread(hash);
+	unsigned int frequency = FREQUENCY_SKETCH_MAX;
+	for (int row = 0; row < FREQUENCY_SKETCH_DEPTH; row++) {
+		unsigned int count = frequency_sketch_get(sketch, frequency_sketch_counter(sketch, spread, row));
+		if (count < frequency) {
+			frequency = count;
+		}
+	}
+
+	return frequency;
+}
+
+/** Bytes allocated for the sketch and its counter table */
+size_t frequency_sketch_memory(const FREQUENCYSKETCH *sketch) {
+	assert(sketch != NULL);
+
+	return sizeof(FREQUENCYSKETCH) + (sketch->block_mask + 1) * FREQUENCY_SKETCH_BLOCK_WORDS * sizeof(uint64_t);
+}
+
+/** Bytes frequency_sketch_save_state writes, the same for every sketch created for the same number of keys */
+size_t frequency_sketch_state_size(const FREQUENCYSKETCH *sketch) {
+	assert(sketch != NULL);
+
+	return sizeof(uint64_t) + (sketch->block_mask + 1) * FREQUENCY_SKETCH_BLOCK_WORDS * sizeof(uint64_t);
+}
+
+/** Copies the counters and the number of increments since the last halving to out */
+void frequency_sketch_save_state(const FREQUENCYSKETCH *sketch, void *out) {
+	assert(sketch != NULL);
+	assert(out != NULL);
+
+	uint64_t additions = sketch->additions;
+	memcpy(out, &additions, sizeof(additions));
+	memcpy((char *)out + sizeof(additions), sketch->table, frequency_sketch_state_size(sketch) - sizeof(additions));
+}
+
+/** Restores a state saved from a sketch created for the same number of keys */
+void frequency_sketch_load_state(FREQUENCYSKETCH *sketch, const void *state) {
+	assert(sketch != NULL);
+	assert(state != NULL);
+
+	uint64_t additions;
+	memcpy(&additions, state, sizeof(additions));
+	memcpy(sketch->table, (const char *)state + sizeof(additions), frequency_sketch_state_size(sketch) - sizeof(additions));
+	sketch->additions = (size_t)additions;
+}
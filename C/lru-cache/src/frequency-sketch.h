@@ -0,0 +1,26 @@
+#ifndef FREQUENCY_SKETCH_H
+#define FREQUENCY_SKETCH_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct FrequencySketch FREQUENCYSKETCH;
+
+/**
+ * Count-min sketch of 4 bit counters used to estimate how often a key was
+ * seen recently. Counters saturate at 15 and are all halved once the
+ * number of increments reaches ten times the expected number of keys, so old
+ * popularity fades.
+ */
+FREQUENCYSKETCH *frequency_sketch_create(size_t expected_keys);
+void frequency_sketch_destroy(FREQUENCYSKETCH *sketch);
+
+void frequency_sketch_increment(FREQUENCYSKETCH *sketch, uint64_t hash);
+unsigned int frequency_sketch_estimate(const FREQUENCYSKETCH *sketch, uint64_t hash);
+size_t frequency_sketch_memory(const FREQUENCYSKETCH *sketch);
+
+size_t frequency_sketch_state_size(const FREQUENCYSKETCH *sketch);
+void frequency_sketch_save_state(const FREQUENCYSKETCH *sketch, void *out);
+void frequency_sketch_load_state(FREQUENCYSKETCH *sketch, const void *state);
+
+#endif
@@ -1,28 +1,105 @@
 /**
- * Static open address hashmap implementation for use with a X, Z grid of chunks
+ * Open address hashmap implementation for use with a X, Z grid of chunks
  * for use within a LRU cache.
+ *
+ * A hashmap is either static (one block, insert fails once full) or resizable.
+ * Resizable maps grow once the load factor is exceeded, but instead of
+ * rehashing everything at once the old table is kept around and drained a few
+ * slots at a time by later inserts and removes. A migrated slot is left as a
+ * tombstone, so every key is only ever found in one of the two tables.
+ *
+ * By default keys are hashed with a mixer specialised for coordinate pairs and
+ * tables have power-of-two capacities so slots are found with a mask. The
+ * original FNV-1a hash with modulo indexing is kept for comparison.
+ *
+ * HASHMAP_PROBE_GROUP lays the state array out like a SwissTable: every
+ * control byte of a full slot holds 7 bits of the hash, and a lookup compares
+ * a whole group of 16 control bytes at once (SSE2 when available), only
+ * touching entries whose control byte matched. Static group tables cannot
+ * grow, so once deleted control bytes pile up they are rebuilt in place the
+ * way SwissTable drops its tombstones: every entry is moved to the first group
+ * with room along its probe sequence, swapping with entries not placed yet.
+ *
+ * HASHMAP_PROBE_BACKSHIFT is linear probing without tombstones: a remove
+ * pulls later entries of the same run back into the hole, so probe lengths
+ * do not creep up under constant insert/evict churn.
+ *
+ * Building with HASHMAP_STATS defined counts hits, misses, inserts, updates
+ * and removes and keeps a histogram of lookup probe lengths. Without it the
+ * counting statements are not compiled at all.
+ *
+ * With BLOCK_MEMORY_ALIGNED or BLOCK_MEMORY_HUGE the entry array of every
+ * table starts on a cache line, and entries divide the line evenly, so no
+ * entry is split over two lines.
  */
 
 #include "hashmap.h"
+#include "block-memory.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define HASHMAP_FREE	  0
 #define HASHMAP_TOMBSTONE 1
 #define HASHMAP_OCCUPIED  2
 
+// Control bytes used by HASHMAP_PROBE_GROUP, full slots store 0x00-0x7F
+#define HASHMAP_CTRL_EMPTY	 0x80
+#define HASHMAP_CTRL_DELETED 0xFE
+#define HASHMAP_GROUP_WIDTH	 16
+
+/** A static group table is rebuilt in place once live and deleted slots pass 7/8 of its capacity */
+#define HASHMAP_GROUP_REBUILD_NUMERATOR	  7
+#define HASHMAP_GROUP_REBUILD_DENOMINATOR 8
+
+/** Number of old table slots visited per insert/remove while a rehash is in progress */
+#define HASHMAP_MIGRATE_STEP 16
+
+#ifdef HASHMAP_STATS
+#define HASHMAP_STAT(statement) statement
+#else
+#define HASHMAP_STAT(statement)
+#endif
+
 struct HashmapEntry {
 	int x, z;
 	void *value;
 };
 
-struct Hashmap {
+_Static_assert(BLOCK_MEMORY_LINE % sizeof(struct HashmapEntry) == 0, "hashmap entries must not straddle cache lines");
+
+struct HashmapTable {
 	struct HashmapEntry *data;
 	uint8_t *state;
 	size_t capacity;
+	size_t mask; // capacity - 1 for power-of-two tables, 0 when indexing by modulo
 	size_t size;
+	size_t tombstones;
+	enum HashmapHash hash;
+	enum HashmapProbe probe;
+#ifdef HASHMAP_STATS
+	struct Hashmap *owner; // Lookups in either table are counted on the map
+#endif
+};
+
+struct Hashmap {
+	struct HashmapTable table;
+	struct HashmapTable old; // Table being drained, capacity is 0 when no rehash is in progress
+	size_t migrate_index;
+	float max_load_factor;
+	enum HashmapHash hash;
+	enum HashmapProbe probe;
+	enum BlockMemory memory;
+
+#ifdef HASHMAP_STATS
+	struct HashmapStats stats; // average_probe and tombstones are filled in when taking a snapshot
+	size_t probe_total;
+#endif
 };
 
 /**
@@ -41,63 +118,150 @@ uint64_t fnv1a_hash(const void *data, size_t len) {
 	return hash;
 }
 
-static inline uint64_t fnv1a_hash_coords(int x, int z, size_t hashmap_capacity) {
+uint64_t hashmap_hash_coords_fnv1a(int x, int z) {
 	struct {
 		int x;
 		int z;
 	} key = {x, z};
 
-	uint64_t hash = fnv1a_hash(&key, sizeof(key));
-	return hash % hashmap_capacity;
+	return fnv1a_hash(&key, sizeof(key));
 }
 
-HASHMAP *hashmap_create(size_t capacity) {
-	assert(capacity > 0);
+/**
+ * Packs both coordinates into one 64 bit word and runs it through the
+ * murmur3 64 bit finalizer, so neighbouring chunks land far apart in the table.
+ */
+uint64_t hashmap_hash_coords(int x, int z) {
+	uint64_t key = ((uint64_t)(uint32_t)x << 32) | (uint32_t)z;
 
-	size_t block_size = sizeof(HASHMAP) + capacity * sizeof(struct HashmapEntry) +
-		capacity * sizeof(uint8_t);
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
 
-	char *block = malloc(block_size);
-	if (block == NULL) {
-		return NULL;
-	}
+	return key;
+}
 
-	memset(block, 0, block_size);
+static inline uint64_t hashmap_hash(enum HashmapHash hash, int x, int z) {
+	return hash == HASHMAP_HASH_COORDS ? hashmap_hash_coords(x, z) : hashmap_hash_coords_fnv1a(x, z);
+}
 
-	HASHMAP *hashmap = (HASHMAP *)block;
-	hashmap->data = (struct HashmapEntry *)(block + sizeof(HASHMAP));
-	hashmap->state = (uint8_t *)(block + sizeof(HASHMAP) + sizeof(struct HashmapEntry) * capacity);
-	hashmap->capacity = capacity;
+static inline uint64_t hashmap_table_slot(const struct HashmapTable *table, uint64_t hash) {
+	return table->mask != 0 ? hash & table->mask : hash % table->capacity;
+}
 
-	return hashmap;
+static inline uint64_t hashmap_table_next(const struct HashmapTable *table, uint64_t index) {
+	return index + 1 == table->capacity ? 0 : index + 1;
 }
 
-void hashmap_destroy(HASHMAP *hashmap) {
-	assert(hashmap != NULL);
-	free(hashmap);
+static size_t hashmap_round_up_pow2(size_t capacity) {
+	size_t rounded = 1;
+	while (rounded < capacity) {
+		rounded <<= 1;
+	}
+	return rounded;
 }
 
-bool hashmap_insert(HASHMAP *hashmap, int x, int z, void *value) {
-	assert(hashmap != NULL && value != NULL);
+/** Size of the block holding the data array of a table followed by its state array */
+static inline size_t hashmap_table_size(enum BlockMemory memory, size_t capacity) {
+	return block_memory_align(memory, capacity * sizeof(struct HashmapEntry)) + capacity * sizeof(uint8_t);
+}
+
+/** Points a table at a zeroed block holding its data array followed by its state array */
+static void hashmap_table_init(HASHMAP *hashmap, struct HashmapTable *table, char *block, size_t capacity) {
+	table->data = (struct HashmapEntry *)block;
+	table->state = (uint8_t *)(block + block_memory_align(hashmap->memory, capacity * sizeof(struct HashmapEntry)));
+	table->capacity = capacity;
+	table->mask = hashmap->hash == HASHMAP_HASH_COORDS ? capacity - 1 : 0;
+	table->size = 0;
+	table->tombstones = 0;
+	table->hash = hashmap->hash;
+	table->probe = hashmap->probe;
+	HASHMAP_STAT(table->owner = hashmap);
+
+	if (table->probe == HASHMAP_PROBE_GROUP) {
+		memset(table->state, HASHMAP_CTRL_EMPTY, capacity);
+	}
+}
 
-	if (hashmap->size == hashmap->capacity) {
+/** Allocates the data and state arrays of a table as a single block */
+static bool hashmap_table_alloc(HASHMAP *hashmap, struct HashmapTable *table, size_t capacity) {
+	char *block = block_memory_alloc(hashmap->memory, hashmap_table_size(hashmap->memory, capacity));
+	if (block == NULL) {
 		return false;
 	}
 
-	uint64_t preferred_index = fnv1a_hash_coords(x, z, hashmap->capacity);
+	hashmap_table_init(hashmap, table, block, capacity);
+
+	return true;
+}
+
+static void hashmap_table_free(HASHMAP *hashmap, struct HashmapTable *table) {
+	block_memory_free(hashmap->memory, table->data, hashmap_table_size(hashmap->memory, table->capacity));
+	memset(table, 0, sizeof(*table));
+}
+
+#ifdef HASHMAP_STATS
+/** Counts a lookup that inspected probe slots, or groups for HASHMAP_PROBE_GROUP */
+static inline void hashmap_record_probe(const struct HashmapTable *table, size_t probe) {
+	struct HashmapStats *stats = &table->owner->stats;
+
+	stats->lookups++;
+	table->owner->probe_total += probe;
+	stats->max_probe = probe > stats->max_probe ? probe : stats->max_probe;
+	stats->probe_histogram[probe <= HASHMAP_PROBE_BUCKETS ? probe - 1 : HASHMAP_PROBE_BUCKETS - 1]++;
+}
+#endif
+
+static struct HashmapEntry *hashmap_linear_find(struct HashmapTable *table, uint64_t hash, int x, int z) {
+	uint64_t preferred_index = hashmap_table_slot(table, hash);
+	HASHMAP_STAT(size_t probe = 0); // Slots looked at
+
+	uint64_t index = preferred_index;
+	do {
+		HASHMAP_STAT(probe++);
+
+		uint8_t state = table->state[index];
+		if (state == HASHMAP_OCCUPIED) {
+			struct HashmapEntry *entry = &table->data[index];
+			if (entry->x == x && entry->z == z) {
+				HASHMAP_STAT(hashmap_record_probe(table, probe));
+				return entry;
+			}
+		} else if (state == HASHMAP_FREE) {
+			break; // Key not found!
+		}
+
+		index = hashmap_table_next(table, index);
+	} while (index != preferred_index);
+
+	HASHMAP_STAT(hashmap_record_probe(table, probe));
+	return NULL;
+}
+
+/** Inserts or updates a key. The table must have room for one more entry. */
+static void hashmap_linear_insert(struct HashmapTable *table, uint64_t hash, int x, int z, void *value) {
+	assert(table->size < table->capacity);
+
+	uint64_t preferred_index = hashmap_table_slot(table, hash);
 	uint64_t first_tombstone = UINT64_MAX;
+	HASHMAP_STAT(size_t probe = 0); // Slots looked at, like hashmap_linear_find
 
 	uint64_t index = preferred_index;
 
 	do {
-		uint8_t state = hashmap->state[index];
+		HASHMAP_STAT(probe++);
+
+		uint8_t state = table->state[index];
 
 		if (state == HASHMAP_OCCUPIED) {
-			struct HashmapEntry *entry = &hashmap->data[index];
+			struct HashmapEntry *entry = &table->data[index];
 
 			if (entry->x == x && entry->z == z) {
+				HASHMAP_STAT(hashmap_record_probe(table, probe));
 				entry->value = value;
-				return true;
+				return;
 			}
 		} else if (state == HASHMAP_TOMBSTONE && first_tombstone == UINT64_MAX) {
 			first_tombstone = index;
@@ -105,80 +269,661 @@ bool hashmap_insert(HASHMAP *hashmap, int x, int z, void *value) {
 			break;
 		}
 
-		index = (index + 1) % hashmap->capacity;
+		index = hashmap_table_next(table, index);
 	} while (index != preferred_index);
 
+	HASHMAP_STAT(hashmap_record_probe(table, probe));
+
 	uint64_t target = (first_tombstone != UINT64_MAX) ? first_tombstone : index;
+	if (target == first_tombstone) {
+		table->tombstones--;
+	}
 
-	hashmap->state[target] = HASHMAP_OCCUPIED;
-	hashmap->data[target].x = x;
-	hashmap->data[target].z = z;
-	hashmap->data[target].value = value;
+	table->state[target] = HASHMAP_OCCUPIED;
+	table->data[target].x = x;
+	table->data[target].z = z;
+	table->data[target].value = value;
 
-	hashmap->size++;
+	table->size++;
+}
 
-	return true;
+static void *hashmap_linear_remove(struct HashmapTable *table, uint64_t hash, int x, int z) {
+	struct HashmapEntry *entry = hashmap_linear_find(table, hash, x, z);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	void *value = entry->value;
+
+	uint64_t index = (uint64_t)(entry - table->data);
+	uint64_t next_index = hashmap_table_next(table, index);
+	if (table->state[next_index] == HASHMAP_FREE) {
+		table->state[index] = HASHMAP_FREE;
+	} else {
+		table->state[index] = HASHMAP_TOMBSTONE;
+		table->tombstones++;
+	}
+	table->size--;
+
+	entry->x = 0;
+	entry->z = 0;
+	entry->value = NULL;
+
+	return value;
 }
 
-void *hashmap_remove(HASHMAP *hashmap, int x, int z) {
-	assert(hashmap != NULL);
+/** Distance of a slot from the home slot of the key stored in it */
+static inline uint64_t hashmap_table_displacement(const struct HashmapTable *table, uint64_t index) {
+	const struct HashmapEntry *entry = &table->data[index];
+	uint64_t home = hashmap_table_slot(table, hashmap_hash(table->hash, entry->x, entry->z));
+	return index >= home ? index - home : index + table->capacity - home;
+}
 
-	uint64_t preferred_index = fnv1a_hash_coords(x, z, hashmap->capacity);
+/**
+ * Backward shift deletion: walks the run after the removed slot and moves
+ * every entry that may legally sit in the hole into it, until the run ends
+ * or an entry is already at its home slot.
+ */
+static void *hashmap_backshift_remove(struct HashmapTable *table, uint64_t hash, int x, int z) {
+	struct HashmapEntry *entry = hashmap_linear_find(table, hash, x, z);
+	if (entry == NULL) {
+		return NULL;
+	}
 
-	uint64_t index = preferred_index;
-	do {
-		uint8_t state = hashmap->state[index];
-		if (state == HASHMAP_OCCUPIED) {
-			struct HashmapEntry *entry = &hashmap->data[index];
-			if (entry->x == x && entry->z == z) {
-				void *value = entry->value;
+	void *value = entry->value;
+
+	uint64_t hole = (uint64_t)(entry - table->data);
+	uint64_t index = hashmap_table_next(table, hole);
+	table->state[hole] = HASHMAP_FREE;
+
+	while (table->state[index] == HASHMAP_OCCUPIED) {
+		uint64_t displacement = hashmap_table_displacement(table, index);
+		uint64_t gap = index >= hole ? index - hole : index + table->capacity - hole;
+
+		// The entry can only move back if its home slot is at or before the hole
+		if (displacement >= gap) {
+			table->data[hole] = table->data[index];
+			table->state[hole] = HASHMAP_OCCUPIED;
+			table->state[index] = HASHMAP_FREE;
+			hole = index;
+		}
+
+		index = hashmap_table_next(table, index);
+	}
+
+	table->data[hole].x = 0;
+	table->data[hole].z = 0;
+	table->data[hole].value = NULL;
+	table->size--;
+
+	return value;
+}
+
+static inline uint8_t hashmap_group_h2(uint64_t hash) {
+	return (uint8_t)(hash >> 57);
+}
+
+/** Bit i is set when control byte i of the group equals value */
+static inline uint32_t hashmap_group_match(const uint8_t *group, uint8_t value) {
+#if defined(__SSE2__)
+	__m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+#else
+	uint32_t bits = 0;
+	for (int i = 0; i < HASHMAP_GROUP_WIDTH; i++) {
+		bits |= (uint32_t)(group[i] == value) << i;
+	}
+	return bits;
+#endif
+}
+
+/** Bit i is set when slot i of the group is empty or deleted */
+static inline uint32_t hashmap_group_match_free(const uint8_t *group) {
+#if defined(__SSE2__)
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+	uint32_t bits = 0;
+	for (int i = 0; i < HASHMAP_GROUP_WIDTH; i++) {
+		bits |= (uint32_t)(group[i] >> 7) << i;
+	}
+	return bits;
+#endif
+}
 
-				uint64_t next_index = (index + 1) % hashmap->capacity;
-				hashmap->state[index] = hashmap->state[next_index] == HASHMAP_FREE
-					? HASHMAP_FREE
-					: HASHMAP_TOMBSTONE;
-				hashmap->size--;
+static struct HashmapEntry *hashmap_group_find(struct HashmapTable *table, uint64_t hash, int x, int z) {
+	size_t group_mask = (table->capacity / HASHMAP_GROUP_WIDTH) - 1;
+	size_t group = (hash & table->mask) / HASHMAP_GROUP_WIDTH;
+	uint8_t h2 = hashmap_group_h2(hash);
 
-				entry->x = 0;
-				entry->z = 0;
-				entry->value = NULL;
+	for (size_t probes = 0; probes <= group_mask; probes++) {
+		size_t base = group * HASHMAP_GROUP_WIDTH;
+		const uint8_t *ctrl = &table->state[base];
 
-				return value;
+		uint32_t match = hashmap_group_match(ctrl, h2);
+		while (match != 0) {
+			struct HashmapEntry *entry = &table->data[base + (size_t)__builtin_ctz(match)];
+			if (entry->x == x && entry->z == z) {
+				HASHMAP_STAT(hashmap_record_probe(table, probes + 1));
+				return entry;
 			}
-		} else if (state == HASHMAP_FREE) {
-			break; // Key not found!
+			match &= match - 1;
 		}
 
-		index = (index + 1) % hashmap->capacity;
-	} while (index != preferred_index);
+		// A probe only moves past a group that had no empty slot left
+		if (hashmap_group_match(ctrl, HASHMAP_CTRL_EMPTY) != 0) {
+			HASHMAP_STAT(hashmap_record_probe(table, probes + 1));
+			return NULL; // Key not found!
+		}
+
+		group = (group + 1) & group_mask;
+	}
 
+	// Every group was looked at, the worst case a table full of deleted slots runs into
+	HASHMAP_STAT(hashmap_record_probe(table, group_mask + 1));
 	return NULL;
 }
 
-void *hashmap_get(HASHMAP *hashmap, int x, int z) {
+/** Inserts or updates a key. The table must have room for one more entry. */
+static void hashmap_group_insert(struct HashmapTable *table, uint64_t hash, int x, int z, void *value) {
+	assert(table->size < table->capacity);
+
+	struct HashmapEntry *entry = hashmap_group_find(table, hash, x, z);
+	if (entry != NULL) {
+		entry->value = value;
+		return;
+	}
+
+	size_t group_mask = (table->capacity / HASHMAP_GROUP_WIDTH) - 1;
+	size_t group = (hash & table->mask) / HASHMAP_GROUP_WIDTH;
+
+	uint32_t free_slots = 0;
+	while ((free_slots = hashmap_group_match_free(&table->state[group * HASHMAP_GROUP_WIDTH])) == 0) {
+		group = (group + 1) & group_mask;
+	}
+
+	size_t index = group * HASHMAP_GROUP_WIDTH + (size_t)__builtin_ctz(free_slots);
+	if (table->state[index] == HASHMAP_CTRL_DELETED) {
+		table->tombstones--;
+	}
+
+	table->state[index] = hashmap_group_h2(hash);
+	table->data[index].x = x;
+	table->data[index].z = z;
+	table->data[index].value = value;
+
+	table->size++;
+}
+
+static void *hashmap_group_remove(struct HashmapTable *table, uint64_t hash, int x, int z) {
+	struct HashmapEntry *entry = hashmap_group_find(table, hash, x, z);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	void *value = entry->value;
+
+	// A group that still has an empty slot never made a probe continue past it
+	size_t index = (size_t)(entry - table->data);
+	const uint8_t *group = &table->state[index & ~(size_t)(HASHMAP_GROUP_WIDTH - 1)];
+	if (hashmap_group_match(group, HASHMAP_CTRL_EMPTY) != 0) {
+		table->state[index] = HASHMAP_CTRL_EMPTY;
+	} else {
+		table->state[index] = HASHMAP_CTRL_DELETED;
+		table->tombstones++;
+	}
+	table->size--;
+
+	entry->x = 0;
+	entry->z = 0;
+	entry->value = NULL;
+
+	return value;
+}
+
+/** Position of the group holding index in the probe sequence of hash */
+static inline size_t hashmap_group_distance(const struct HashmapTable *table, uint64_t hash, size_t index) {
+	size_t group_mask = (table->capacity / HASHMAP_GROUP_WIDTH) - 1;
+	size_t home = (hash & table->mask) / HASHMAP_GROUP_WIDTH;
+	return (index / HASHMAP_GROUP_WIDTH - home) & group_mask;
+}
+
+static inline bool hashmap_group_needs_rebuild(const struct HashmapTable *table) {
+	return table->tombstones > 0 &&
+		(table->size + table->tombstones) * HASHMAP_GROUP_REBUILD_DENOMINATOR >= table->capacity * HASHMAP_GROUP_REBUILD_NUMERATOR;
+}
+
+/** Drops every deleted control byte without any memory besides the table, for static maps */
+static void hashmap_group_rebuild(struct HashmapTable *table) {
+	// Full slots are marked deleted until their entry is placed, tombstones become empty
+	for (size_t i = 0; i < table->capacity; i++) {
+		table->state[i] = (table->state[i] & HASHMAP_CTRL_EMPTY) == 0 ? HASHMAP_CTRL_DELETED : HASHMAP_CTRL_EMPTY;
+	}
+
+	size_t group_mask = (table->capacity / HASHMAP_GROUP_WIDTH) - 1;
+
+	for (size_t i = 0; i < table->capacity; i++) {
+		if (table->state[i] != HASHMAP_CTRL_DELETED) {
+			continue;
+		}
+
+		uint64_t hash = hashmap_hash(table->hash, table->data[i].x, table->data[i].z);
+		size_t group = (hash & table->mask) / HASHMAP_GROUP_WIDTH;
+
+		uint32_t free_slots;
+		while ((free_slots = hashmap_group_match_free(&table->state[group * HASHMAP_GROUP_WIDTH])) == 0) {
+			group = (group + 1) & group_mask;
+		}
+
+		size_t target = group * HASHMAP_GROUP_WIDTH + (size_t)__builtin_ctz(free_slots);
+
+		// Already in the first group a probe for it would find room in
+		if (hashmap_group_distance(table, hash, i) == hashmap_group_distance(table, hash, target)) {
+			table->state[i] = hashmap_group_h2(hash);
+			continue;
+		}
+
+		if (table->state[target] == HASHMAP_CTRL_EMPTY) {
+			table->data[target] = table->data[i];
+			table->state[target] = hashmap_group_h2(hash);
+			table->state[i] = HASHMAP_CTRL_EMPTY;
+			table->data[i] = (struct HashmapEntry){0};
+		} else {
+			// The target holds an entry not placed yet, which takes this slot and is placed next
+			struct HashmapEntry entry = table->data[target];
+			table->data[target] = table->data[i];
+			table->data[i] = entry;
+			table->state[target] = hashmap_group_h2(hash);
+			i--;
+		}
+	}
+
+	table->tombstones = 0;
+}
+
+static inline bool hashmap_table_is_full(const struct HashmapTable *table, size_t index) {
+	return table->probe == HASHMAP_PROBE_GROUP
+		? (table->state[index] & HASHMAP_CTRL_EMPTY) == 0
+		: table->state[index] == HASHMAP_OCCUPIED;
+}
+
+static inline struct HashmapEntry *hashmap_table_find(struct HashmapTable *table, uint64_t hash, int x, int z) {
+	return table->probe == HASHMAP_PROBE_GROUP
+		? hashmap_group_find(table, hash, x, z)
+		: hashmap_linear_find(table, hash, x, z);
+}
+
+static inline void hashmap_table_insert(struct HashmapTable *table, uint64_t hash, int x, int z, void *value) {
+	if (table->probe == HASHMAP_PROBE_GROUP) {
+		hashmap_group_insert(table, hash, x, z, value);
+	} else {
+		hashmap_linear_insert(table, hash, x, z, value);
+	}
+}
+
+static inline void *hashmap_table_remove(struct HashmapTable *table, uint64_t hash, int x, int z) {
+	switch (table->probe) {
+	case HASHMAP_PROBE_GROUP:
+		return hashmap_group_remove(table, hash, x, z);
+	case HASHMAP_PROBE_BACKSHIFT:
+		return hashmap_backshift_remove(table, hash, x, z);
+	default:
+		return hashmap_linear_remove(table, hash, x, z);
+	}
+}
+
+/**
+ * Empties a slot of the table being drained with a tombstone, whatever the
+ * probe scheme. Freeing it could cut the probe chain of an entry further along
+ * that was not migrated yet, and backward shifting would need free slots to
+ * end its runs.
+ */
+static inline void hashmap_table_vacate(struct HashmapTable *table, size_t index) {
+	table->state[index] = table->probe == HASHMAP_PROBE_GROUP ? HASHMAP_CTRL_DELETED : HASHMAP_TOMBSTONE;
+	table->tombstones++;
+	table->size--;
+
+	table->data[index].x = 0;
+	table->data[index].z = 0;
+	table->data[index].value = NULL;
+}
+
+/** Removes a key from the table being drained */
+static void *hashmap_old_remove(struct HashmapTable *old, uint64_t hash, int x, int z) {
+	struct HashmapEntry *entry = hashmap_table_find(old, hash, x, z);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	void *value = entry->value;
+	hashmap_table_vacate(old, (size_t)(entry - old->data));
+
+	return value;
+}
+
+HASHMAP *hashmap_create(size_t capacity) {
+	struct HashmapConfig config = {
+		.capacity = capacity,
+		.max_load_factor = 0.0F,
+		.hash = HASHMAP_HASH_COORDS,
+	};
+
+	return hashmap_create_with(&config);
+}
+
+HASHMAP *hashmap_create_with(const struct HashmapConfig *config) {
+	assert(config != NULL);
+	assert(config->capacity > 0);
+	assert(config->max_load_factor >= 0.0F && config->max_load_factor < 1.0F);
+	assert(config->probe != HASHMAP_PROBE_GROUP || config->hash == HASHMAP_HASH_COORDS);
+
+	size_t capacity = config->capacity;
+	if (config->hash == HASHMAP_HASH_COORDS) {
+		capacity = hashmap_round_up_pow2(capacity);
+	}
+	if (config->probe == HASHMAP_PROBE_GROUP && capacity < HASHMAP_GROUP_WIDTH) {
+		capacity = HASHMAP_GROUP_WIDTH;
+	}
+
+	HASHMAP *hashmap = NULL;
+
+	if (config->max_load_factor == 0.0F) {
+		// Static maps never reallocate, so keep the header and table in one block.
+		size_t header_size = block_memory_align(config->memory, sizeof(HASHMAP));
+
+		char *block = block_memory_alloc(config->memory, header_size + hashmap_table_size(config->memory, capacity));
+		if (block == NULL) {
+			return NULL;
+		}
+
+		hashmap = (HASHMAP *)block;
+		hashmap->hash = config->hash;
+		hashmap->probe = config->probe;
+		hashmap->memory = config->memory;
+		hashmap_table_init(hashmap, &hashmap->table, block + header_size, capacity);
+	} else {
+		assert(capacity > 1);
+
+		hashmap = calloc(1, sizeof(HASHMAP));
+		if (hashmap == NULL) {
+			return NULL;
+		}
+
+		hashmap->hash = config->hash;
+		hashmap->probe = config->probe;
+		hashmap->memory = config->memory;
+
+		if (!hashmap_table_alloc(hashmap, &hashmap->table, capacity)) {
+			free(hashmap);
+			return NULL;
+		}
+
+		hashmap->max_load_factor = config->max_load_factor;
+	}
+
+	return hashmap;
+}
+
+void hashmap_destroy(HASHMAP *hashmap) {
 	assert(hashmap != NULL);
 
-	uint64_t preferred_index = fnv1a_hash_coords(x, z, hashmap->capacity);
+	if (hashmap->max_load_factor > 0.0F) {
+		hashmap_table_free(hashmap, &hashmap->table);
+		hashmap_table_free(hashmap, &hashmap->old);
+		free(hashmap);
+		return;
+	}
 
-	uint64_t index = preferred_index;
-	do {
-		uint8_t state = hashmap->state[index];
-		if (state == HASHMAP_OCCUPIED) {
-			struct HashmapEntry *entry = &hashmap->data[index];
-			if (entry->x == x && entry->z == z) {
-				return entry->value;
+	size_t header_size = block_memory_align(hashmap->memory, sizeof(HASHMAP));
+	block_memory_free(hashmap->memory, hashmap, header_size + hashmap_table_size(hashmap->memory, hashmap->table.capacity));
+}
+
+/** Moves a bounded number of entries from the old table into the current one */
+static void hashmap_migrate_step(HASHMAP *hashmap) {
+	struct HashmapTable *old = &hashmap->old;
+	if (old->capacity == 0) {
+		return;
+	}
+
+	size_t end = hashmap->migrate_index + HASHMAP_MIGRATE_STEP;
+	if (end > old->capacity) {
+		end = old->capacity;
+	}
+
+	for (size_t i = hashmap->migrate_index; i < end; i++) {
+		if (hashmap_table_is_full(old, i)) {
+			struct HashmapEntry *entry = &old->data[i];
+			hashmap_table_insert(&hashmap->table, hashmap_hash(hashmap->hash, entry->x, entry->z), entry->x, entry->z, entry->value);
+			hashmap_table_vacate(old, i); // Every key lives in exactly one of the tables
+		}
+	}
+
+	hashmap->migrate_index = end;
+
+	if (hashmap->migrate_index == old->capacity) {
+		assert(old->size == 0);
+		hashmap_table_free(hashmap, old);
+		hashmap->migrate_index = 0;
+	}
+}
+
+/**
+ * Starts an incremental rehash when one more entry would push the table over
+ * its load factor. Tombstones count towards the load, so a table full of them
+ * is rebuilt at the same capacity instead of doubling.
+ */
+static bool hashmap_maybe_grow(HASHMAP *hashmap) {
+	struct HashmapTable *table = &hashmap->table;
+
+	size_t limit = (size_t)((float)table->capacity * hashmap->max_load_factor);
+	if (table->size + table->tombstones + 1 <= limit) {
+		return true;
+	}
+
+	// A rehash is already running and the new table filled up first, finish it now.
+	while (hashmap->old.capacity != 0) {
+		hashmap_migrate_step(hashmap);
+	}
+
+	size_t live = table->size + 1;
+	size_t new_capacity = live * 2 > limit ? table->capacity * 2 : table->capacity;
+
+	struct HashmapTable grown;
+	if (!hashmap_table_alloc(hashmap, &grown, new_capacity)) {
+		return table->size < table->capacity;
+	}
+
+	hashmap->old = *table;
+	hashmap->table = grown;
+	hashmap->migrate_index = 0;
+
+	return true;
+}
+
+bool hashmap_insert(HASHMAP *hashmap, int x, int z, void *value) {
+	assert(hashmap != NULL && value != NULL);
+
+	uint64_t hash = hashmap_hash(hashmap->hash, x, z);
+
+	if (hashmap->max_load_factor == 0.0F) {
+		struct HashmapTable *table = &hashmap->table;
+		if (table->size == table->capacity) {
+			struct HashmapEntry *entry = hashmap_table_find(table, hash, x, z);
+			if (entry == NULL) {
+				return false;
 			}
-		} else if (state == HASHMAP_FREE) {
-			break; // Key not found!
+			entry->value = value;
+			HASHMAP_STAT(hashmap->stats.updates++);
+			return true;
 		}
 
-		index = (index + 1) % hashmap->capacity;
-	} while (index != preferred_index);
+		if (table->probe == HASHMAP_PROBE_GROUP && hashmap_group_needs_rebuild(table)) {
+			hashmap_group_rebuild(table);
+		}
 
-	return NULL;
+		HASHMAP_STAT(size_t size = table->size);
+		hashmap_table_insert(table, hash, x, z, value);
+		HASHMAP_STAT(table->size > size ? hashmap->stats.inserts++ : hashmap->stats.updates++);
+		return true;
+	}
+
+	if (hashmap->old.capacity != 0) {
+		struct HashmapEntry *entry = hashmap_table_find(&hashmap->old, hash, x, z);
+		if (entry != NULL) {
+			entry->value = value;
+			HASHMAP_STAT(hashmap->stats.updates++);
+			hashmap_migrate_step(hashmap);
+			return true;
+		}
+	}
+
+	struct HashmapEntry *entry = hashmap_table_find(&hashmap->table, hash, x, z);
+	if (entry != NULL) {
+		entry->value = value;
+		HASHMAP_STAT(hashmap->stats.updates++);
+	} else {
+		if (!hashmap_maybe_grow(hashmap)) {
+			return false;
+		}
+
+		hashmap_table_insert(&hashmap->table, hash, x, z, value);
+		HASHMAP_STAT(hashmap->stats.inserts++);
+	}
+
+	hashmap_migrate_step(hashmap);
+
+	return true;
+}
+
+void *hashmap_remove(HASHMAP *hashmap, int x, int z) {
+	assert(hashmap != NULL);
+
+	uint64_t hash = hashmap_hash(hashmap->hash, x, z);
+
+	void *value = hashmap_table_remove(&hashmap->table, hash, x, z);
+	if (value == NULL && hashmap->old.capacity != 0) {
+		value = hashmap_old_remove(&hashmap->old, hash, x, z);
+	}
+
+	HASHMAP_STAT(hashmap->stats.removes += value != NULL);
+
+	if (hashmap->max_load_factor > 0.0F) {
+		hashmap_migrate_step(hashmap);
+	}
+
+	return value;
+}
+
+void *hashmap_get(HASHMAP *hashmap, int x, int z) {
+	assert(hashmap != NULL);
+
+	uint64_t hash = hashmap_hash(hashmap->hash, x, z);
+
+	struct HashmapEntry *entry = hashmap_table_find(&hashmap->table, hash, x, z);
+	if (entry == NULL && hashmap->old.capacity != 0) {
+		entry = hashmap_table_find(&hashmap->old, hash, x, z);
+	}
+
+	HASHMAP_STAT(entry != NULL ? hashmap->stats.hits++ : hashmap->stats.misses++);
+	return entry != NULL ? entry->value : NULL;
 }
 
 size_t hashmap_size(HASHMAP *hashmap) {
 	assert(hashmap != NULL);
-	return hashmap->size;
+	return hashmap->table.size + hashmap->old.size;
+}
+
+size_t hashmap_capacity(HASHMAP *hashmap) {
+	assert(hashmap != NULL);
+	return hashmap->table.capacity;
+}
+
+/** Copies the counters gathered since creation or the last reset. All zero unless built with HASHMAP_STATS. */
+void hashmap_stats(HASHMAP *hashmap, struct HashmapStats *stats) {
+	assert(hashmap != NULL && stats != NULL);
+
+#ifdef HASHMAP_STATS
+	*stats = hashmap->stats;
+	stats->average_probe = stats->lookups > 0 ? (double)hashmap->probe_total / (double)stats->lookups : 0.0;
+	stats->tombstones = hashmap->table.tombstones + hashmap->old.tombstones;
+#else
+	(void)hashmap;
+	memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void hashmap_stats_reset(HASHMAP *hashmap) {
+	assert(hashmap != NULL);
+
+#ifdef HASHMAP_STATS
+	memset(&hashmap->stats, 0, sizeof(hashmap->stats));
+	hashmap->probe_total = 0;
+#else
+	(void)hashmap;
+#endif
+}
+
+/**
+ * Walks the current table (not one being drained) and measures how far every
+ * entry sits from its home, and how long a miss starting at each home would
+ * run before reaching an empty slot.
+ */
+void hashmap_probe_stats(HASHMAP *hashmap, struct HashmapProbeStats *stats) {
+	assert(hashmap != NULL && stats != NULL);
+
+	const struct HashmapTable *table = &hashmap->table;
+	bool grouped = table->probe == HASHMAP_PROBE_GROUP;
+	size_t width = grouped ? HASHMAP_GROUP_WIDTH : 1;
+	size_t units = table->capacity / width;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->tombstones = table->tombstones;
+
+	size_t total = 0;
+	for (size_t i = 0; i < table->capacity; i++) {
+		if (!hashmap_table_is_full(table, i)) {
+			continue;
+		}
+
+		size_t probe = 0;
+		if (grouped) {
+			const struct HashmapEntry *entry = &table->data[i];
+			size_t home = (hashmap_hash(table->hash, entry->x, entry->z) & table->mask) / width;
+			probe = ((i / width + units - home) % units) + 1;
+		} else {
+			probe = hashmap_table_displacement(table, i) + 1;
+		}
+
+		total += probe;
+		if (probe > stats->max_probe) {
+			stats->max_probe = probe;
+		}
+	}
+
+	if (table->size > 0) {
+		stats->average_probe = (double)total / (double)table->size;
+	}
+
+	// A miss stops at the first slot (group) with an empty byte
+	size_t stop = SIZE_MAX;
+	for (size_t u = 0; u < units && stop == SIZE_MAX; u++) {
+		if (grouped ? hashmap_group_match(&table->state[u * width], HASHMAP_CTRL_EMPTY) != 0 : table->state[u] == HASHMAP_FREE) {
+			stop = u;
+		}
+	}
+
+	if (stop == SIZE_MAX) {
+		stats->average_miss_probe = (double)units;
+		return;
+	}
+
+	size_t run = 0;
+	size_t miss_total = 0;
+	for (size_t k = 0; k < units; k++) {
+		size_t u = (stop + units - k) % units;
+		bool empty = grouped ? hashmap_group_match(&table->state[u * width], HASHMAP_CTRL_EMPTY) != 0 : table->state[u] == HASHMAP_FREE;
+		run = empty ? 1 : run + 1;
+		miss_total += run;
+	}
+
+	stats->average_miss_probe = (double)miss_total / (double)units;
 }
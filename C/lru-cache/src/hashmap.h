@@ -3,15 +3,69 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "block-memory.h"
 
 typedef struct Hashmap HASHMAP;
 
+enum HashmapHash {
+	HASHMAP_HASH_COORDS, // Multiply-xorshift mixer over the packed coordinates, power-of-two capacity
+	HASHMAP_HASH_FNV1A	 // Byte-wise FNV-1a, exact capacity and modulo indexing
+};
+
+enum HashmapProbe {
+	HASHMAP_PROBE_LINEAR, // One state byte per slot, linear probing with tombstones
+	HASHMAP_PROBE_GROUP,  // Control bytes carry 7 hash bits and are scanned 16 at a time (HASHMAP_HASH_COORDS only)
+	HASHMAP_PROBE_BACKSHIFT // Linear probing, removes shift the rest of the run back so no tombstones are left
+};
+
+struct HashmapConfig {
+	size_t capacity;	   // Initial number of slots (rounded up to a power of two for HASHMAP_HASH_COORDS)
+	float max_load_factor; // Grow once size exceeds capacity * max_load_factor. 0 keeps the capacity fixed.
+	enum HashmapHash hash;
+	enum HashmapProbe probe;
+	enum BlockMemory memory; // Where the tables are allocated, BLOCK_MEMORY_DEFAULT uses plain malloc
+};
+
+/** Probe lengths are counted in slots, or in groups of 16 for HASHMAP_PROBE_GROUP */
+struct HashmapProbeStats {
+	double average_probe; // Successful lookup
+	size_t max_probe;
+	double average_miss_probe; // Lookup of a key that is not present
+	size_t tombstones;
+};
+
+#define HASHMAP_PROBE_BUCKETS 16
+
+/** Only counted when the map is built with HASHMAP_STATS. Probe lengths use the same units as HashmapProbeStats. */
+struct HashmapStats {
+	size_t hits;
+	size_t misses;
+	size_t inserts;
+	size_t updates; // Inserts of a key that was already present
+	size_t removes;
+	size_t tombstones; // Current count, not a counter
+
+	size_t lookups; // Finds in either table, including the ones made by inserts
+	size_t max_probe;
+	double average_probe;
+	size_t probe_histogram[HASHMAP_PROBE_BUCKETS]; // Bucket i counts probes of length i + 1, the last one all longer probes
+};
+
 HASHMAP *hashmap_create(size_t capacity);
+HASHMAP *hashmap_create_with(const struct HashmapConfig *config);
 void hashmap_destroy(HASHMAP *hashmap);
 
 bool hashmap_insert(HASHMAP *hashmap, int x, int z, void *value);
 void *hashmap_remove(HASHMAP *hashmap, int x, int z);
 void *hashmap_get(HASHMAP *hashmap, int x, int z);
 size_t hashmap_size(HASHMAP *hashmap);
+size_t hashmap_capacity(HASHMAP *hashmap);
+void hashmap_probe_stats(HASHMAP *hashmap, struct HashmapProbeStats *stats);
+void hashmap_stats(HASHMAP *hashmap, struct HashmapStats *stats);
+void hashmap_stats_reset(HASHMAP *hashmap);
+
+uint64_t hashmap_hash_coords(int x, int z);
+uint64_t hashmap_hash_coords_fnv1a(int x, int z);
 
 #endif
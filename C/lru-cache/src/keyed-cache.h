@@ -0,0 +1,403 @@
+#ifndef KEYED_CACHE_H
+#define KEYED_CACHE_H 1
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Hashmaps and LRU caches generated for a key type other than (x, z), like
+ * (x, y, z) sections or 64 bit handles. The hash and equality functions are
+ * expanded into each instantiation's probe loop, so a key compares in place
+ * the way it does in hashmap.c instead of through a function pointer and
+ * memcmp. They should be static inline:
+ *
+ *   uint64_t hash(Key key);          // Well mixed, the low bits pick the slot
+ *   bool equal(Key a, Key b);
+ *
+ * KEYED_MAP_DECLARE(TYPE, prefix, Key) goes in a header and declares
+ *
+ *   TYPE *prefix_create(size_t capacity);   // Initial slots, grows at 3/4 full
+ *   void prefix_destroy(TYPE *map);
+ *   bool prefix_insert(TYPE *map, Key key, void *value);   // false if growing failed
+ *   void *prefix_get(TYPE *map, Key key);
+ *   void *prefix_remove(TYPE *map, Key key);
+ *   size_t prefix_size(TYPE *map);
+ *
+ * KEYED_LRU_DECLARE(TYPE, prefix, Key) declares a fixed capacity LRU cache
+ * laid out like lru-cache.c, with the same index of node and hash slots:
+ *
+ *   TYPE *prefix_create(size_t capacity, prefix_evict_fn on_evict, void *userdata);
+ *   void prefix_destroy(TYPE *cache);
+ *   void prefix_put(TYPE *cache, Key key, void *value);
+ *   void *prefix_get(TYPE *cache, Key key);
+ *   size_t prefix_size(TYPE *cache);
+ *
+ * on_evict receives values the way LRUCacheEvictFn does: evicted, replaced
+ * by a put of a different value, or still cached at destroy.
+ *
+ * The matching KEYED_MAP_DEFINE/KEYED_LRU_DEFINE with the hash and equality
+ * functions goes in exactly one .c file. Values cannot be NULL.
+ */
+
+#define KEYED_NIL UINT32_MAX
+
+#define KEYED_MAP_DECLARE(TYPE, prefix, Key) \
+	typedef struct prefix TYPE; \
+\
+	TYPE *prefix##_create(size_t capacity); \
+	void prefix##_destroy(TYPE *map); \
+	bool prefix##_insert(TYPE *map, Key key, void *value); \
+	void *prefix##_get(TYPE *map, Key key); \
+	void *prefix##_remove(TYPE *map, Key key); \
+	size_t prefix##_size(TYPE *map);
+
+#define KEYED_MAP_DEFINE(TYPE, prefix, Key, hash, equal) \
+	struct prefix##_entry { \
+		Key key; \
+		void *value; /* NULL marks an empty slot */ \
+		uint32_t hash; \
+	}; \
+\
+	struct prefix { \
+		struct prefix##_entry *entries; \
+		size_t mask; \
+		size_t size; \
+	}; \
+\
+	/** Slot holding the key, or the empty slot that ends its probe sequence */ \
+	static inline struct prefix##_entry *prefix##_probe(const TYPE *map, Key key, uint32_t h) { \
+		size_t index = h & map->mask; \
+		for (;;) { \
+			struct prefix##_entry *entry = &map->entries[index]; \
+			if (entry->value == NULL || (entry->hash == h && equal(entry->key, key))) { \
+				return entry; \
+			} \
+\
+			index = (index + 1) & map->mask; \
+		} \
+	} \
+\
+	static bool prefix##_grow(TYPE *map) { \
+		size_t capacity = (map->mask + 1) * 2; \
+		struct prefix##_entry *entries = calloc(capacity, sizeof(struct prefix##_entry)); \
+		if (entries == NULL) { \
+			return false; \
+		} \
+\
+		struct prefix##_entry *old = map->entries; \
+		size_t old_capacity = map->mask + 1; \
+		map->entries = entries; \
+		map->mask = capacity - 1; \
+\
+		/* Keys are unique, so every entry goes to the first empty slot from its home */ \
+		for (size_t i = 0; i < old_capacity; i++) { \
+			if (old[i].value != NULL) { \
+				size_t index = old[i].hash & map->mask; \
+				while (entries[index].value != NULL) { \
+					index = (index + 1) & map->mask; \
+				} \
+				entries[index] = old[i]; \
+			} \
+		} \
+\
+		free(old); \
+		return true; \
+	} \
+\
+	TYPE *prefix##_create(size_t capacity) { \
+		size_t slots = 2; \
+		while (slots < capacity) { \
+			slots <<= 1; \
+		} \
+\
+		TYPE *map = malloc(sizeof(TYPE)); \
+		if (map == NULL) { \
+			return NULL; \
+		} \
+\
+		map->entries = calloc(slots, sizeof(struct prefix##_entry)); \
+		if (map->entries == NULL) { \
+			free(map); \
+			return NULL; \
+		} \
+\
+		map->mask = slots - 1; \
+		map->size = 0; \
+		return map; \
+	} \
+\
+	void prefix##_destroy(TYPE *map) { \
+		assert(map != NULL); \
+\
+		free(map->entries); \
+		free(map); \
+	} \
+\
+	bool prefix##_insert(TYPE *map, Key key, void *value) { \
+		assert(map != NULL); \
+		assert(value != NULL); \
+\
+		uint32_t h = (uint32_t)hash(key); \
+		struct prefix##_entry *entry = prefix##_probe(map, key, h); \
+		if (entry->value != NULL) { \
+			entry->value = value; \
+			return true; \
+		} \
+\
+		if ((map->size + 1) * 4 > (map->mask + 1) * 3) { \
+			if (!prefix##_grow(map)) { \
+				return false; \
+			} \
+			entry = prefix##_probe(map, key, h); \
+		} \
+\
+		entry->key = key; \
+		entry->value = value; \
+		entry->hash = h; \
+		map->size++; \
+		return true; \
+	} \
+\
+	void *prefix##_get(TYPE *map, Key key) { \
+		assert(map != NULL); \
+\
+		return prefix##_probe(map, key, (uint32_t)hash(key))->value; \
+	} \
+\
+	/** Removes the key with backward shift deletion, so no tombstones are left. Returns its value or NULL. */ \
+	void *prefix##_remove(TYPE *map, Key key) { \
+		assert(map != NULL); \
+\
+		struct prefix##_entry *entry = prefix##_probe(map, key, (uint32_t)hash(key)); \
+		void *value = entry->value; \
+		if (value == NULL) { \
+			return NULL; \
+		} \
+\
+		size_t hole = (size_t)(entry - map->entries); \
+		size_t index = (hole + 1) & map->mask; \
+		while (map->entries[index].value != NULL) { \
+			size_t home = map->entries[index].hash & map->mask; \
+			if (((index - home) & map->mask) >= ((index - hole) & map->mask)) { \
+				map->entries[hole] = map->entries[index]; \
+				hole = index; \
+			} \
+			index = (index + 1) & map->mask; \
+		} \
+\
+		map->entries[hole].value = NULL; \
+		map->size--; \
+		return value; \
+	} \
+\
+	size_t prefix##_size(TYPE *map) { \
+		assert(map != NULL); \
+\
+		return map->size; \
+	}
+
+#define KEYED_LRU_DECLARE(TYPE, prefix, Key) \
+	typedef struct prefix TYPE; \
+	typedef void (*prefix##_evict_fn)(Key key, void *value, void *userdata); \
+\
+	TYPE *prefix##_create(size_t capacity, prefix##_evict_fn on_evict, void *userdata); \
+	void prefix##_destroy(TYPE *cache); \
+	void prefix##_put(TYPE *cache, Key key, void *value); \
+	void *prefix##_get(TYPE *cache, Key key); \
+	size_t prefix##_size(TYPE *cache);
+
+#define KEYED_LRU_DEFINE(TYPE, prefix, Key, hash, equal) \
+	struct prefix##_node { \
+		Key key; \
+		void *value; \
+		uint32_t next; \
+		uint32_t prev; \
+	}; \
+\
+	struct prefix { \
+		struct prefix##_node *nodes; \
+		uint64_t *slots; /* Node index + 1 in the low half, 0 when empty, the key hash in the high half */ \
+		size_t slot_mask; \
+		size_t capacity; \
+		size_t size; \
+		uint32_t head; \
+		uint32_t tail; \
+		prefix##_evict_fn on_evict; \
+		void *userdata; \
+	}; \
+\
+	static inline uint32_t prefix##_find(const TYPE *cache, Key key, uint32_t h) { \
+		size_t index = h & cache->slot_mask; \
+		for (;;) { \
+			uint64_t slot = cache->slots[index]; \
+			if (slot == 0) { \
+				return KEYED_NIL; \
+			} \
+\
+			if ((uint32_t)(slot >> 32) == h && equal(cache->nodes[(uint32_t)slot - 1].key, key)) { \
+				return (uint32_t)slot - 1; \
+			} \
+\
+			index = (index + 1) & cache->slot_mask; \
+		} \
+	} \
+\
+	static void prefix##_unindex(TYPE *cache, uint32_t h, uint32_t node) { \
+		uint64_t target = ((uint64_t)h << 32) | (node + 1); \
+		size_t hole = h & cache->slot_mask; \
+		while (cache->slots[hole] != target) { \
+			hole = (hole + 1) & cache->slot_mask; \
+		} \
+\
+		size_t index = (hole + 1) & cache->slot_mask; \
+		while (cache->slots[index] != 0) { \
+			size_t home = (uint32_t)(cache->slots[index] >> 32) & cache->slot_mask; \
+			if (((index - home) & cache->slot_mask) >= ((index - hole) & cache->slot_mask)) { \
+				cache->slots[hole] = cache->slots[index]; \
+				hole = index; \
+			} \
+			index = (index + 1) & cache->slot_mask; \
+		} \
+\
+		cache->slots[hole] = 0; \
+	} \
+\
+	static inline void prefix##_unlink(TYPE *cache, uint32_t index) { \
+		struct prefix##_node *node = &cache->nodes[index]; \
+		if (node->prev != KEYED_NIL) { \
+			cache->nodes[node->prev].next = node->next; \
+		} else { \
+			cache->head = node->next; \
+		} \
+\
+		if (node->next != KEYED_NIL) { \
+			cache->nodes[node->next].prev = node->prev; \
+		} else { \
+			cache->tail = node->prev; \
+		} \
+	} \
+\
+	static inline void prefix##_push_head(TYPE *cache, uint32_t index) { \
+		struct prefix##_node *node = &cache->nodes[index]; \
+		node->prev = KEYED_NIL; \
+		node->next = cache->head; \
+		if (cache->head != KEYED_NIL) { \
+			cache->nodes[cache->head].prev = index; \
+		} else { \
+			cache->tail = index; \
+		} \
+		cache->head = index; \
+	} \
+\
+	TYPE *prefix##_create(size_t capacity, prefix##_evict_fn on_evict, void *userdata) { \
+		assert(capacity > 1 && "Cache capacity cannot be less then 1"); \
+		assert(capacity < KEYED_NIL && "Cache capacity must fit a 32 bit node index"); \
+\
+		size_t slot_count = 1; \
+		while (slot_count < capacity * 2) { \
+			slot_count <<= 1; \
+		} \
+\
+		/* Header and nodes hold pointers, so the slots after them stay 8 byte aligned */ \
+		size_t nodesOffset = sizeof(TYPE); \
+		size_t slotsOffset = nodesOffset + capacity * sizeof(struct prefix##_node); \
+		size_t blockSize = slotsOffset + slot_count * sizeof(uint64_t); \
+\
+		char *block = calloc(1, blockSize); \
+		if (block == NULL) { \
+			return NULL; \
+		} \
+\
+		TYPE *cache = (TYPE *)block; \
+		cache->nodes = (struct prefix##_node *)(block + nodesOffset); \
+		cache->slots = (uint64_t *)(block + slotsOffset); \
+		cache->slot_mask = slot_count - 1; \
+		cache->capacity = capacity; \
+		cache->head = KEYED_NIL; \
+		cache->tail = KEYED_NIL; \
+		cache->on_evict = on_evict; \
+		cache->userdata = userdata; \
+		return cache; \
+	} \
+\
+	void prefix##_destroy(TYPE *cache) { \
+		assert(cache != NULL); \
+\
+		if (cache->on_evict != NULL) { \
+			for (size_t i = 0; i < cache->size; i++) { \
+				cache->on_evict(cache->nodes[i].key, cache->nodes[i].value, cache->userdata); \
+			} \
+		} \
+\
+		free(cache); \
+	} \
+\
+	void prefix##_put(TYPE *cache, Key key, void *value) { \
+		assert(cache != NULL); \
+		assert(value != NULL); \
+\
+		uint32_t h = (uint32_t)hash(key); \
+		uint32_t index = prefix##_find(cache, key, h); \
+		if (index != KEYED_NIL) { \
+			void *replaced = cache->nodes[index].value; \
+			cache->nodes[index].value = value; \
+			prefix##_unlink(cache, index); \
+			prefix##_push_head(cache, index); \
+\
+			if (replaced != value && cache->on_evict != NULL) { \
+				cache->on_evict(cache->nodes[index].key, replaced, cache->userdata); \
+			} \
+			return; \
+		} \
+\
+		/* Nodes are used in order until the cache is full, then the tail node is reused */ \
+		if (cache->size < cache->capacity) { \
+			index = (uint32_t)cache->size++; \
+		} else { \
+			index = cache->tail; \
+			struct prefix##_node *victim = &cache->nodes[index]; \
+			prefix##_unindex(cache, (uint32_t)hash(victim->key), index); \
+			prefix##_unlink(cache, index); \
+\
+			if (cache->on_evict != NULL) { \
+				cache->on_evict(victim->key, victim->value, cache->userdata); \
+			} \
+		} \
+\
+		cache->nodes[index].key = key; \
+		cache->nodes[index].value = value; \
+		prefix##_push_head(cache, index); \
+\
+		size_t slot = h & cache->slot_mask; \
+		while (cache->slots[slot] != 0) { \
+			slot = (slot + 1) & cache->slot_mask; \
+		} \
+		cache->slots[slot] = ((uint64_t)h << 32) | (index + 1); \
+	} \
+\
+	void *prefix##_get(TYPE *cache, Key key) { \
+		assert(cache != NULL); \
+\
+		uint32_t index = prefix##_find(cache, key, (uint32_t)hash(key)); \
+		if (index == KEYED_NIL) { \
+			return NULL; \
+		} \
+\
+		if (cache->head != index) { \
+			prefix##_unlink(cache, index); \
+			prefix##_push_head(cache, index); \
+		} \
+		return cache->nodes[index].value; \
+	} \
+\
+	size_t prefix##_size(TYPE *cache) { \
+		assert(cache != NULL); \
+\
+		return cache->size; \
+	}
+
+#endif
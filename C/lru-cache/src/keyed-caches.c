@@ -0,0 +1,43 @@
+/**
+ * The keyed hashmap and LRU cache instantiations shared by the game, see
+ * keyed-cache.h for the functions each one gets.
+ */
+
+#include "keyed-caches.h"
+#include "hashmap.h"
+
+/** The (x, z) mixer with y folded in by a golden ratio multiply and one more finalizer round */
+static inline uint64_t section_key_hash(struct SectionKey key) {
+	uint64_t hash = hashmap_hash_coords(key.x, key.z) + (uint64_t)(uint32_t)key.y * 0x9E3779B97F4A7C15ULL;
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+static inline bool section_key_equal(struct SectionKey a, struct SectionKey b) {
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+/** murmur3 64 bit finalizer, handles are often sequential */
+static inline uint64_t handle_key_hash(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+
+	return key;
+}
+
+static inline bool handle_key_equal(uint64_t a, uint64_t b) {
+	return a == b;
+}
+
+KEYED_MAP_DEFINE(SECTIONMAP, section_map, struct SectionKey, section_key_hash, section_key_equal)
+KEYED_LRU_DEFINE(SECTIONCACHE, section_cache, struct SectionKey, section_key_hash, section_key_equal)
+
+KEYED_MAP_DEFINE(HANDLEMAP, handle_map, uint64_t, handle_key_hash, handle_key_equal)
+KEYED_LRU_DEFINE(HANDLECACHE, handle_cache, uint64_t, handle_key_hash, handle_key_equal)
@@ -0,0 +1,18 @@
+#ifndef KEYED_CACHES_H
+#define KEYED_CACHES_H 1
+
+#include "keyed-cache.h"
+
+/** A 16x16x16 section of a chunk column, y counts sections up from the bottom of the world */
+struct SectionKey {
+	int x, y, z;
+};
+
+KEYED_MAP_DECLARE(SECTIONMAP, section_map, struct SectionKey)
+KEYED_LRU_DECLARE(SECTIONCACHE, section_cache, struct SectionKey)
+
+// Region files and GPU mesh buffers are known by 64 bit handles
+KEYED_MAP_DECLARE(HANDLEMAP, handle_map, uint64_t)
+KEYED_LRU_DECLARE(HANDLECACHE, handle_cache, uint64_t)
+
+#endif
@@ -1,61 +1,504 @@
+/**
+ * Fixed capacity chunk cache. The cache header, node pool, index and
+ * reference bits all live in one block.
+ *
+ * Nodes are linked with 32 bit indices into the pool and are the only place
+ * a key is stored. The index is an open addressed table of 8 byte slots
+ * holding a node index and 32 bits of the key's hash, so a lookup only reads
+ * a node once the hash bits matched. Removes use backward shift deletion, so
+ * constant evictions never leave tombstones behind.
+ *
+ * With LRU_CACHE_POLICY_CLOCK the recency list is not used: a hit only sets
+ * the node's reference bit and eviction sweeps a hand over the node array,
+ * clearing bits until it finds a node that was not referenced since the last
+ * pass.
+ *
+ * The scan resistant policies split the nodes over several lists, with the
+ * list of each node kept in a side array:
+ *
+ * - LRU_CACHE_POLICY_2Q admits new keys to a FIFO. Keys falling out of it
+ *   stay indexed as ghost nodes without a value, and only a key put again
+ *   while it is a ghost is promoted to the main LRU list. The node pool holds
+ *   the ghosts on top of the capacity.
+ * - LRU_CACHE_POLICY_TINYLFU admits new keys to a small LRU window. When the
+ *   cache is full the window's oldest entry has to beat the main segment's
+ *   victim on an approximate access frequency to be kept. The main segment is
+ *   a segmented LRU, entries hit while on probation become protected.
+ *
+ * Pinned nodes carry a reference count and are never evicted. Instead of
+ * searching past them, eviction moves a pinned tail node to a separate list
+ * where it stays until its last unpin, so every pin costs at most one skip.
+ * CLOCK treats a pinned node like a referenced one.
+ *
+ * With a byte budget every value carries the cost it was put with, and puts
+ * keep evicting through the policy until the total is back under the budget.
+ * lru_cache_resize lowers or raises the entry limit and the budget in place,
+ * the node pool keeps the size it was created with.
+ *
+ * Every access stamps the node with the epoch given to lru_cache_set_epoch,
+ * usually the frame number. lru_cache_expire_older_than evicts entries not
+ * used since an epoch, a bounded number per call, walking each list from its
+ * tail so the work is proportional to what is evicted. CLOCK and the 2Q
+ * A1in FIFO are not in recency order, so they are scanned a bounded number of
+ * nodes per call instead, resuming where the previous call stopped.
+ *
+ * Every node carries a load state so chunk generation can run on worker
+ * threads. lru_cache_claim inserts a Loading node pinned on behalf of the
+ * worker, which only ever touches the node's state byte to publish it as
+ * Ready. The main thread drops that pin the next time it looks at the node,
+ * or when eviction runs after publishes and sweeps the pinned list. A node
+ * parked on the pinned list while loading goes back to the cold end of its
+ * list, only a lookup makes it recently used.
+ *
+ * lru_cache_prefetch claims a chunk the same way but links it where eviction
+ * looks first, without counting an access, so chunks generated ahead of the
+ * player never push out the ones in use.
+ *
+ * lru_cache_save writes the block's arrays out as they are, with value
+ * pointers turned into file offsets, followed by the values themselves.
+ * lru_cache_load maps the file, copies the arrays back and points the nodes
+ * at the values in the mapping, so the index is not rebuilt key by key and
+ * no chunk is copied.
+ *
+ * Building with LRU_CACHE_STATS defined adds hit, miss, insert, update and
+ * eviction counters plus a histogram of index probe lengths. Without it the
+ * counting statements are not compiled at all.
+ *
+ * Building with LRU_CACHE_TRACE defined lets lru_cache_trace_start log every
+ * get, put, pin, unpin and resize in the format described in lru-trace.h.
+ * Records are encoded into a buffer that is written out 64 KiB at a time.
+ */
+
+// mmap is POSIX, not part of -std=c11
+#define _POSIX_C_SOURCE 200809L
+
 #include "lru-cache.h"
+#include "block-memory.h"
+#include "frequency-sketch.h"
 #include "hashmap.h"
+#include "lru-trace.h"
 #include <assert.h>
 #include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LRU_CACHE_NIL UINT32_MAX
+#define LRU_CACHE_BATCH 16 // Keys hashed and prefetched ahead in lru_cache_get_many/lru_cache_put_many
+
+#define LRU_CACHE_2Q_IN_PERCENT		  25 // A1in share of the capacity
+#define LRU_CACHE_2Q_GHOST_PERCENT	  50 // A1out ghost keys, relative to the capacity
+#define LRU_CACHE_TINYLFU_WINDOW_PERCENT 1	 // Admission window share of the capacity
+#define LRU_CACHE_TINYLFU_PROTECTED_PERCENT 80 // Protected share of the main segment
+#define LRU_CACHE_EXPIRE_SCAN 8 // Unordered nodes looked at per entry lru_cache_expire_older_than may evict
+
+#define LRU_CACHE_IMAGE_MAGIC		0x494D4355 // "UCMI"
+#define LRU_CACHE_IMAGE_VERSION		2
+#define LRU_CACHE_IMAGE_ALIGN		4096 // Values start on a page of their own
+#define LRU_CACHE_IMAGE_VALUE_ALIGN 64	 // Value stride alignment, a cache line
+#define LRU_CACHE_IMAGE_SUFFIX		".tmp"
+
+#ifdef LRU_CACHE_STATS
+#define LRU_CACHE_STAT(statement) statement
+#else
+#define LRU_CACHE_STAT(statement)
+#endif
+
+#ifdef LRU_CACHE_TRACE
+#define LRU_CACHE_TRACED(statement) statement
+#define LRU_CACHE_TRACE_BUFFER (64 * 1024)
+
+/** Access log being recorded, records are encoded into the buffer and written out when it fills */
+struct CacheTrace {
+	FILE *file;
+	int x, z; // Coordinates of the previous record
+	bool failed;
+	size_t used;
+	uint8_t buffer[LRU_CACHE_TRACE_BUFFER];
+};
+#else
+#define LRU_CACHE_TRACED(statement)
+#endif
 
+/** Padded to 32 bytes so two nodes fill a cache line and none is split over two */
 struct CacheNode {
 	int x;
 	int z;
 	void *value;
-	struct CacheNode *next;
-	struct CacheNode *prev;
+	uint32_t next;
+	uint32_t prev;
+	uint8_t parked; // List the node was on before it was moved to CACHE_QUEUE_PINNED
+	char padding[32 - 2 * sizeof(int) - sizeof(void *) - 2 * sizeof(uint32_t) - sizeof(uint8_t)];
+};
+
+_Static_assert(sizeof(struct CacheNode) == 32, "cache nodes must not straddle cache lines");
+
+/** Index slot: low 32 bits are node index + 1 (0 marks an empty slot), high 32 bits the key hash */
+typedef uint64_t CacheSlot;
+
+/** The list a node is on. Every policy only uses the lists it needs. */
+enum CacheQueue {
+	CACHE_QUEUE_MAIN,	   // LRU recency list, 2Q Am, W-TinyLFU protected segment
+	CACHE_QUEUE_IN,		   // 2Q A1in FIFO, W-TinyLFU window
+	CACHE_QUEUE_GHOST,	   // 2Q A1out, keys without values
+	CACHE_QUEUE_PROBATION, // W-TinyLFU probation segment
+	CACHE_QUEUE_PINNED,	   // Pinned nodes found at the tail of another list while evicting
+	CACHE_QUEUE_COUNT
+};
+
+struct CacheList {
+	uint32_t head;
+	uint32_t tail;
+	size_t size;
+	size_t limit; // Soft target size, 0 when unused
+};
+
+/** Start of a snapshot file. Only meant to be read back by the same build on the same kind of machine. */
+struct CacheImageHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t policy;
+	uint32_t free_list;
+	uint64_t node_count;
+	uint64_t slot_count;
+	uint64_t max_capacity;
+	uint64_t capacity;
+	uint64_t size;
+	uint64_t cost;
+	uint64_t hand;
+	uint64_t value_size;
+	uint64_t sketch_size; // W-TinyLFU frequencies, 0 for the other policies
+	struct CacheList lists[CACHE_QUEUE_COUNT];
 };
 
 struct LRUCache {
-	struct CacheNode *head;
-	struct CacheNode *tail;
-	struct CacheNode *free_list;
-	HASHMAP *hashmap;
+	struct CacheList lists[CACHE_QUEUE_COUNT];
+	uint32_t free_list;
+
+	struct CacheNode *nodes;
+	size_t node_count;	 // Created capacity plus ghost nodes
+	size_t max_capacity; // Created capacity, lru_cache_resize cannot go above it
+	size_t block_size;	 // Bytes in the single allocation holding the header and all arrays
+	enum BlockMemory memory;
+	size_t capacity;
+	size_t size; // Nodes holding a value
+
+	size_t *costs;
+	size_t cost;   // Sum of the costs of all values
+	size_t budget; // 0 when only the number of entries is limited
+
+	CacheSlot *slots;
+	size_t slot_mask;
+
+	enum LRUCachePolicy policy;
+	uint8_t *referenced;
+	uint8_t *queue;
+	size_t hand;
+	FREQUENCYSKETCH *sketch;
+
+	uint32_t *pins;
+	size_t pinned;		  // Nodes with a non-zero pin count
+	size_t pin_skips;	  // Pinned nodes passed over by eviction
+	size_t pin_skip_puts; // Puts that had to pass over a pinned node
+
+	uint32_t *epochs; // Epoch of each node's last access
+	uint32_t epoch;
+	size_t expire_hand;		 // Where the next CLOCK expiry scan starts
+	uint32_t expire_cursor; // Next 2Q A1in node the expiry scan looks at
+
+	_Atomic uint8_t *states; // enum LRUCacheState of each node, the only field workers write
+	uint8_t *claimed;		 // Set while a node holds the pin lru_cache_claim took
+	atomic_size_t published; // Publishes since eviction last swept the pinned list
+
+	LRUCacheEvictFn on_evict;
+	void *userdata;
+	bool deferred;
+
+	// Values waiting for lru_cache_flush_evicted/lru_cache_take_evicted in deferred mode
+	struct LRUCacheEvicted *evicted;
+	size_t evicted_count;
+	size_t evicted_capacity;
+
+	void *image; // Snapshot mapped by lru_cache_load, the values it restored point into it
+	size_t image_size;
+
+#ifdef LRU_CACHE_STATS
+	struct LRUCacheStats stats; // average_probe is derived from probe_total when taking a snapshot
+	size_t probe_total;
+#endif
+
+#ifdef LRU_CACHE_TRACE
+	struct CacheTrace *trace; // NULL while not recording
+#endif
 };
 
+static inline uint32_t lru_cache_hash(int x, int z) {
+	return (uint32_t)hashmap_hash_coords(x, z);
+}
+
+static inline CacheSlot lru_cache_slot(uint32_t node, uint32_t hash) {
+	return ((CacheSlot)hash << 32) | (CacheSlot)(node + 1);
+}
+
+static inline uint32_t lru_cache_slot_node(CacheSlot slot) {
+	return (uint32_t)slot - 1;
+}
+
+static inline uint32_t lru_cache_slot_hash(CacheSlot slot) {
+	return (uint32_t)(slot >> 32);
+}
+
+#ifdef LRU_CACHE_STATS
+/** Counts a lookup that inspected probe slots */
+static inline void lru_cache_record_probe(LRUCACHE *cache, size_t probe) {
+	struct LRUCacheStats *stats = &cache->stats;
+
+	stats->lookups++;
+	cache->probe_total += probe;
+	stats->max_probe = probe > stats->max_probe ? probe : stats->max_probe;
+	stats->probe_histogram[probe <= LRU_CACHE_PROBE_BUCKETS ? probe - 1 : LRU_CACHE_PROBE_BUCKETS - 1]++;
+}
+#endif
+
+/** Returns the node index holding the key, or LRU_CACHE_NIL */
+static inline uint32_t lru_cache_index_find(LRUCACHE *cache, uint32_t hash, int x, int z) {
+	size_t index = hash & cache->slot_mask;
+	LRU_CACHE_STAT(size_t probe = 1);
+
+	for (;;) {
+		CacheSlot slot = cache->slots[index];
+		if (slot == 0) {
+			LRU_CACHE_STAT(lru_cache_record_probe(cache, probe));
+			return LRU_CACHE_NIL; // Key not found!
+		}
+
+		if (lru_cache_slot_hash(slot) == hash) {
+			uint32_t node = lru_cache_slot_node(slot);
+			if (cache->nodes[node].x == x && cache->nodes[node].z == z) {
+				LRU_CACHE_STAT(lru_cache_record_probe(cache, probe));
+				return node;
+			}
+		}
+
+		index = (index + 1) & cache->slot_mask;
+		LRU_CACHE_STAT(probe++);
+	}
+}
+
+/** Adds a node that is not indexed yet. The index always has free slots since it is twice the capacity. */
+static inline void lru_cache_index_insert(LRUCACHE *cache, uint32_t hash, uint32_t node) {
+	size_t index = hash & cache->slot_mask;
+	while (cache->slots[index] != 0) {
+		index = (index + 1) & cache->slot_mask;
+	}
+
+	cache->slots[index] = lru_cache_slot(node, hash);
+}
+
+/** Removes a node from the index, shifting the rest of its run back into the hole */
+static void lru_cache_index_remove(LRUCACHE *cache, uint32_t hash, uint32_t node) {
+	size_t hole = hash & cache->slot_mask;
+	while (cache->slots[hole] != lru_cache_slot(node, hash)) {
+		assert(cache->slots[hole] != 0 && "Node is not indexed");
+		hole = (hole + 1) & cache->slot_mask;
+	}
+
+	size_t index = (hole + 1) & cache->slot_mask;
+	while (cache->slots[index] != 0) {
+		size_t home = lru_cache_slot_hash(cache->slots[index]) & cache->slot_mask;
+
+		// The slot can only move back if its home is at or before the hole
+		if (((index - home) & cache->slot_mask) >= ((index - hole) & cache->slot_mask)) {
+			cache->slots[hole] = cache->slots[index];
+			hole = index;
+		}
+
+		index = (index + 1) & cache->slot_mask;
+	}
+
+	cache->slots[hole] = 0;
+}
+
+#ifdef LRU_CACHE_TRACE
+static size_t lru_cache_trace_varint(uint8_t *out, uint64_t value) {
+	size_t length = 0;
+	while (value >= 0x80) {
+		out[length++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	out[length++] = (uint8_t)value;
+
+	return length;
+}
+
+/** Delta code for the tag byte, a zigzag varint goes to out when the delta is not 0 or 1 either way */
+static unsigned int lru_cache_trace_delta(int previous, int current, uint8_t *out, size_t *length) {
+	int64_t delta = (int64_t)current - (int64_t)previous;
+	if (delta == 0) {
+		return LRU_TRACE_DELTA_ZERO;
+	}
+	if (delta == 1 || delta == -1) {
+		return delta == 1 ? LRU_TRACE_DELTA_PLUS : LRU_TRACE_DELTA_MINUS;
+	}
+
+	uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+	*length += lru_cache_trace_varint(out + *length, zigzag);
+	return LRU_TRACE_DELTA_VARINT;
+}
+
+static void lru_cache_trace_flush(struct CacheTrace *trace) {
+	if (!trace->failed && trace->used > 0 && fwrite(trace->buffer, 1, trace->used, trace->file) != trace->used) {
+		trace->failed = true;
+	}
+
+	trace->used = 0;
+}
+
+static void lru_cache_trace_write(struct CacheTrace *trace, enum LRUTraceOp op, int x, int z, size_t cost) {
+	if (trace->used + LRU_TRACE_MAX_RECORD > LRU_CACHE_TRACE_BUFFER) {
+		lru_cache_trace_flush(trace);
+	}
+
+	uint8_t *out = trace->buffer + trace->used;
+	size_t length = 1;
+
+	unsigned int tag = (unsigned int)op;
+	tag |= lru_cache_trace_delta(trace->x, x, out, &length) << LRU_TRACE_X_SHIFT;
+	tag |= lru_cache_trace_delta(trace->z, z, out, &length) << LRU_TRACE_Z_SHIFT;
+	if (cost != 0) {
+		tag |= LRU_TRACE_COST;
+		length += lru_cache_trace_varint(out + length, cost);
+	}
+
+	// The varints were written after the tag's place
+	out[0] = (uint8_t)tag;
+	trace->used += length;
+	trace->x = x;
+	trace->z = z;
+}
+
+static inline void lru_cache_trace(LRUCACHE *cache, enum LRUTraceOp op, int x, int z, size_t cost) {
+	if (cache->trace != NULL) {
+		lru_cache_trace_write(cache->trace, op, x, z, cost);
+	}
+}
+#endif
+
+/** Sizes the 2Q A1in and the W-TinyLFU window and protected segment from the capacity */
+static void lru_cache_set_limits(LRUCACHE *cache) {
+	size_t capacity = cache->capacity;
+
+	if (cache->policy == LRU_CACHE_POLICY_2Q) {
+		size_t in = capacity * LRU_CACHE_2Q_IN_PERCENT / 100;
+		cache->lists[CACHE_QUEUE_IN].limit = in == 0 ? 1 : in;
+	} else if (cache->policy == LRU_CACHE_POLICY_TINYLFU) {
+		size_t window = capacity * LRU_CACHE_TINYLFU_WINDOW_PERCENT / 100;
+		window = window == 0 ? 1 : window;
+		cache->lists[CACHE_QUEUE_IN].limit = window;
+		cache->lists[CACHE_QUEUE_MAIN].limit = (capacity - window) * LRU_CACHE_TINYLFU_PROTECTED_PERCENT / 100;
+	}
+}
+
 LRUCACHE *lru_cache_create(size_t capacity) {
+	struct LRUCacheConfig config = {
+		.capacity = capacity,
+	};
+
+	return lru_cache_create_with(&config);
+}
+
+LRUCACHE *lru_cache_create_with(const struct LRUCacheConfig *config) {
+	assert(config != NULL);
+
+	size_t capacity = config->capacity;
 	assert(capacity > 1 && "Cache capacity cannot be less then 1");
 
-	HASHMAP *hashmap = hashmap_create(capacity * 2);
-	if (hashmap == NULL) {
-		return NULL;
+	size_t ghosts = 0;
+	if (config->policy == LRU_CACHE_POLICY_2Q) {
+		ghosts = capacity * LRU_CACHE_2Q_GHOST_PERCENT / 100;
+		ghosts = ghosts == 0 ? 1 : ghosts;
+	}
+
+	size_t node_count = capacity + ghosts;
+	assert(node_count < LRU_CACHE_NIL && "Cache capacity must fit a 32 bit node index");
+
+	size_t slot_count = 1;
+	while (slot_count < node_count * 2) {
+		slot_count <<= 1;
 	}
 
-	size_t blockSize = sizeof(LRUCACHE) + (capacity * sizeof(struct CacheNode));
-	char *block = malloc(blockSize);
+	// Header, nodes, slots and costs are all multiples of 8 bytes, then the pin counts and the byte arrays.
+	// The aligned modes start every array on a cache line.
+	enum BlockMemory memory = config->memory;
+	size_t nodesOffset = block_memory_align(memory, sizeof(LRUCACHE));
+	size_t slotsOffset = block_memory_align(memory, nodesOffset + node_count * sizeof(struct CacheNode));
+	size_t costsOffset = block_memory_align(memory, slotsOffset + slot_count * sizeof(CacheSlot));
+	size_t pinsOffset = block_memory_align(memory, costsOffset + node_count * sizeof(size_t));
+	size_t epochsOffset = block_memory_align(memory, pinsOffset + node_count * sizeof(uint32_t));
+	size_t referencedOffset = block_memory_align(memory, epochsOffset + node_count * sizeof(uint32_t));
+	size_t queueOffset = block_memory_align(memory, referencedOffset + node_count * sizeof(uint8_t));
+	size_t statesOffset = block_memory_align(memory, queueOffset + node_count * sizeof(uint8_t));
+	size_t claimedOffset = block_memory_align(memory, statesOffset + node_count * sizeof(_Atomic uint8_t));
+	size_t blockSize = claimedOffset + node_count * sizeof(uint8_t);
+
+	char *block = block_memory_alloc(memory, blockSize);
 	if (block == NULL) {
-		hashmap_destroy(hashmap);
-		hashmap = NULL;
 		return NULL;
 	}
 
-	memset(block, 0, blockSize);
-
 	LRUCACHE *cache = (LRUCACHE *)block;
+	cache->nodes = (struct CacheNode *)(block + nodesOffset);
+	cache->node_count = node_count;
+	cache->max_capacity = capacity;
+	cache->block_size = blockSize;
+	cache->memory = memory;
+	cache->capacity = capacity;
+	cache->budget = config->budget;
+	cache->slots = (CacheSlot *)(block + slotsOffset);
+	cache->slot_mask = slot_count - 1;
+	cache->costs = (size_t *)(block + costsOffset);
+	cache->pins = (uint32_t *)(block + pinsOffset);
+	cache->epochs = (uint32_t *)(block + epochsOffset);
+	cache->referenced = (uint8_t *)(block + referencedOffset);
+	cache->queue = (uint8_t *)(block + queueOffset);
+	cache->states = (_Atomic uint8_t *)(block + statesOffset);
+	cache->claimed = (uint8_t *)(block + claimedOffset);
+	atomic_init(&cache->published, 0);
 
-	struct CacheNode *prev = NULL;
-	for (size_t i = 0; i < capacity; i++) {
-		struct CacheNode *node = &((struct CacheNode *)(block + sizeof(LRUCACHE)))[i];
-
-		if (prev != NULL) {
-			prev->next = node;
+	if (config->policy == LRU_CACHE_POLICY_TINYLFU) {
+		cache->sketch = frequency_sketch_create(capacity);
+		if (cache->sketch == NULL) {
+			block_memory_free(memory, block, blockSize);
+			return NULL;
 		}
+	}
 
-		node->prev = prev;
-		node->next = NULL;
+	for (size_t i = 0; i < node_count; i++) {
+		struct CacheNode *node = &cache->nodes[i];
+		node->prev = i == 0 ? LRU_CACHE_NIL : (uint32_t)(i - 1);
+		node->next = i + 1 == node_count ? LRU_CACHE_NIL : (uint32_t)(i + 1);
+		atomic_init(&cache->states[i], LRU_CACHE_UNLOADED);
+	}
 
-		prev = node;
+	for (int i = 0; i < CACHE_QUEUE_COUNT; i++) {
+		cache->lists[i].head = LRU_CACHE_NIL;
+		cache->lists[i].tail = LRU_CACHE_NIL;
 	}
 
-	cache->free_list = ((struct CacheNode *)(block + sizeof(LRUCACHE)));
-	cache->hashmap = hashmap;
+	cache->lists[CACHE_QUEUE_GHOST].limit = ghosts;
+	cache->expire_cursor = LRU_CACHE_NIL;
+	cache->free_list = 0;
+	cache->policy = config->policy;
+	lru_cache_set_limits(cache);
+	cache->on_evict = config->on_evict;
+	cache->userdata = config->userdata;
+	cache->deferred = config->deferred;
 
 	return cache;
 }
@@ -63,114 +506,1513 @@ LRUCACHE *lru_cache_create(size_t capacity) {
 void lru_cache_destroy(LRUCACHE *cache) {
 	assert(cache != NULL);
 
-	// TODO map any remaining stored values to the cleanup function
+	if (cache->on_evict != NULL) {
+		lru_cache_flush_evicted(cache);
+
+		// Free and ghost nodes have no value
+		for (size_t i = 0; i < cache->node_count; i++) {
+			struct CacheNode *node = &cache->nodes[i];
+			if (node->value != NULL) {
+				cache->on_evict(node->x, node->z, node->value, cache->userdata);
+			}
+		}
+	}
+
+	if (cache->sketch != NULL) {
+		frequency_sketch_destroy(cache->sketch);
+	}
+
+#ifdef LRU_CACHE_TRACE
+	if (cache->trace != NULL) {
+		lru_cache_trace_stop(cache);
+	}
+#endif
+
+	free(cache->evicted);
+	cache->evicted = NULL;
+
+	if (cache->image != NULL) {
+		munmap(cache->image, cache->image_size);
+	}
+
+	block_memory_free(cache->memory, cache, cache->block_size);
+}
+
+/**
+ * Hands a value that left the cache to the eviction callback, or queues it
+ * when the cache is deferred so the caller can release it outside the hot loop.
+ */
+static void lru_cache_release(LRUCACHE *cache, int x, int z, void *value) {
+	if (!cache->deferred) {
+		if (cache->on_evict != NULL) {
+			cache->on_evict(x, z, value, cache->userdata);
+		}
+		return;
+	}
+
+	if (cache->evicted_count == cache->evicted_capacity) {
+		size_t new_capacity = cache->evicted_capacity == 0 ? 64 : cache->evicted_capacity * 2;
+		struct LRUCacheEvicted *evicted = realloc(cache->evicted, new_capacity * sizeof(struct LRUCacheEvicted));
+
+		if (evicted == NULL) {
+			// Out of queue space, releasing now is better than losing the value.
+			if (cache->on_evict != NULL) {
+				cache->on_evict(x, z, value, cache->userdata);
+			}
+			return;
+		}
+
+		cache->evicted = evicted;
+		cache->evicted_capacity = new_capacity;
+	}
+
+	struct LRUCacheEvicted *entry = &cache->evicted[cache->evicted_count++];
+	entry->x = x;
+	entry->z = z;
+	entry->value = value;
+}
+
+/** Runs the eviction callback over every queued value. Returns how many were released. */
+size_t lru_cache_flush_evicted(LRUCACHE *cache) {
+	assert(cache != NULL);
+	assert(cache->on_evict != NULL || cache->evicted_count == 0);
+
+	size_t count = cache->evicted_count;
+	for (size_t i = 0; i < count; i++) {
+		struct LRUCacheEvicted *entry = &cache->evicted[i];
+		cache->on_evict(entry->x, entry->z, entry->value, cache->userdata);
+	}
+
+	cache->evicted_count = 0;
+	return count;
+}
+
+/**
+ * Moves up to max of the oldest queued values into out, e.g. to hand them to
+ * a worker thread for freeing or recycling. Returns how many were taken.
+ */
+size_t lru_cache_take_evicted(LRUCACHE *cache, struct LRUCacheEvicted *out, size_t max) {
+	assert(cache != NULL);
+	assert(out != NULL || max == 0);
+
+	size_t count = cache->evicted_count < max ? cache->evicted_count : max;
+	if (count == 0) {
+		return 0;
+	}
 
-	hashmap_destroy(cache->hashmap);
-	cache->hashmap = NULL;
+	memcpy(out, cache->evicted, count * sizeof(struct LRUCacheEvicted));
+	memmove(cache->evicted, cache->evicted + count, (cache->evicted_count - count) * sizeof(struct LRUCacheEvicted));
+	cache->evicted_count -= count;
 
-	free(cache);
+	return count;
 }
 
-/** Removes a node from the cache list */
-static inline void lru_cache_remove_from_list(LRUCACHE *cache, struct CacheNode *node) {
-	assert(cache != NULL && node != NULL);
-	if (cache->tail == node) {
-		cache->tail = node->prev;
+/** Removes a node from the list it is on */
+static inline void lru_cache_remove_from_list(LRUCACHE *cache, uint32_t index) {
+	assert(cache != NULL && index < cache->node_count);
+	struct CacheNode *node = &cache->nodes[index];
+	struct CacheList *list = &cache->lists[cache->queue[index]];
+
+	if (list->head == index) {
+		list->head = node->next;
+	}
+
+	if (list->tail == index) {
+		list->tail = node->prev;
 	}
 
-	if (node->prev != NULL) {
-		node->prev->next = node->next;
+	if (node->prev != LRU_CACHE_NIL) {
+		cache->nodes[node->prev].next = node->next;
 	}
 
-	if (node->next != NULL) {
-		node->next->prev = node->prev;
+	if (node->next != LRU_CACHE_NIL) {
+		cache->nodes[node->next].prev = node->prev;
 	}
 
-	node->prev = NULL;
-	node->next = NULL;
+	node->prev = LRU_CACHE_NIL;
+	node->next = LRU_CACHE_NIL;
+	list->size--;
 }
 
-/** Moves a detached node to the head */
-static inline void lru_cache_move_to_head(LRUCACHE *cache, struct CacheNode *node) {
+/** Moves a detached node to the head of a list */
+static inline void lru_cache_move_to_head(LRUCACHE *cache, enum CacheQueue queue, uint32_t index) {
 	assert(cache != NULL );
-	assert(node != NULL);
-	assert(node->prev == NULL);
-	assert(node->next == NULL);
+	assert(index < cache->node_count);
+	struct CacheNode *node = &cache->nodes[index];
+	struct CacheList *list = &cache->lists[queue];
+	assert(node->prev == LRU_CACHE_NIL);
+	assert(node->next == LRU_CACHE_NIL);
 
-	node->next = cache->head;
-	if (cache->head != NULL) {
-		cache->head->prev = node;
+	node->next = list->head;
+	if (list->head != LRU_CACHE_NIL) {
+		cache->nodes[list->head].prev = index;
 	}
 
-	cache->head = node;
+	list->head = index;
 
-	if (cache->tail == NULL) {
-		cache->tail = node;
+	if (list->tail == LRU_CACHE_NIL) {
+		list->tail = index;
 	}
+
+	list->size++;
+	cache->queue[index] = (uint8_t)queue;
 }
 
-void lru_cache_put(LRUCACHE *cache, int x, int z, void *value) {
-	assert(cache != NULL);
-	assert(value != NULL);
+/** Moves a detached node to the tail of a list, where eviction looks first */
+static inline void lru_cache_move_to_tail(LRUCACHE *cache, enum CacheQueue queue, uint32_t index) {
+	struct CacheNode *node = &cache->nodes[index];
+	struct CacheList *list = &cache->lists[queue];
+	assert(node->prev == LRU_CACHE_NIL);
+	assert(node->next == LRU_CACHE_NIL);
 
-	struct CacheNode *node = hashmap_get(cache->hashmap, x, z);
-	if (node != NULL) {
-		// TODO consider aborting if the value is different! Otherwise at risk of memory leaks!
-		node->value = value;
+	node->prev = list->tail;
+	if (list->tail != LRU_CACHE_NIL) {
+		cache->nodes[list->tail].next = index;
+	}
+
+	list->tail = index;
+
+	if (list->head == LRU_CACHE_NIL) {
+		list->head = index;
+	}
+
+	list->size++;
+	cache->queue[index] = (uint8_t)queue;
+}
+
+/** Links a detached node at the head of a list, or at the tail when it is cold */
+static inline void lru_cache_link(LRUCACHE *cache, enum CacheQueue queue, uint32_t index, bool cold) {
+	if (cold) {
+		lru_cache_move_to_tail(cache, queue, index);
+	} else {
+		lru_cache_move_to_head(cache, queue, index);
+	}
+}
+
+/** Moves a listed node to the head of a list, possibly a different one */
+static inline void lru_cache_relink(LRUCACHE *cache, enum CacheQueue queue, uint32_t index) {
+	if (cache->queue[index] != queue || cache->lists[queue].head != index) {
+		lru_cache_remove_from_list(cache, index);
+		lru_cache_move_to_head(cache, queue, index);
+	}
+}
+
+/** Moves W-TinyLFU protected overflow back to probation instead of letting it leave the cache */
+static inline void lru_cache_demote_protected(LRUCACHE *cache) {
+	struct CacheList *protected = &cache->lists[CACHE_QUEUE_MAIN];
+	if (protected->size > protected->limit) {
+		lru_cache_relink(cache, CACHE_QUEUE_PROBATION, protected->tail);
+	}
+}
+
+/**
+ * Drops one pin of a node. The last one makes it evictable again, a node
+ * parked on the pinned list goes back to the list it was parked from, as
+ * just used or as the next victim when cold. A 2Q A1in or W-TinyLFU window
+ * entry must not skip the ghost hit or the admission check it still owes.
+ */
+static void lru_cache_unpin_node(LRUCACHE *cache, uint32_t index, bool cold) {
+	if (--cache->pins[index] > 0) {
+		return;
+	}
+
+	cache->pinned--;
+
+	if (cache->queue[index] == CACHE_QUEUE_PINNED) {
+		lru_cache_remove_from_list(cache, index);
+		enum CacheQueue queue = (enum CacheQueue)cache->nodes[index].parked;
+		lru_cache_link(cache, queue, index, cold);
+
+		if (cache->policy == LRU_CACHE_POLICY_TINYLFU && queue == CACHE_QUEUE_MAIN) {
+			lru_cache_demote_protected(cache);
+		}
+	}
+}
+
+/** Drops the pin lru_cache_claim took once the value was published. Settling is not an access. */
+static inline void lru_cache_settle(LRUCACHE *cache, uint32_t index) {
+	if (cache->claimed[index] &&
+		atomic_load_explicit(&cache->states[index], memory_order_acquire) != LRU_CACHE_LOADING) {
+		cache->claimed[index] = 0;
+		lru_cache_unpin_node(cache, index, true);
+	}
+}
+
+/** Settles the claims parked on the pinned list, only when something was published since the last sweep */
+static void lru_cache_settle_parked(LRUCACHE *cache) {
+	if (atomic_load_explicit(&cache->published, memory_order_relaxed) == 0 ||
+		atomic_exchange_explicit(&cache->published, 0, memory_order_relaxed) == 0) {
+		return;
+	}
+
+	uint32_t index = cache->lists[CACHE_QUEUE_PINNED].head;
+	while (index != LRU_CACHE_NIL) {
+		uint32_t next = cache->nodes[index].next;
+		lru_cache_settle(cache, index);
+		index = next;
+	}
+}
+
+/** Settles every published claim, including the ones that never reached a list tail. Linear in the capacity. */
+static void lru_cache_settle_all(LRUCACHE *cache) {
+	for (uint32_t index = 0; index < cache->node_count; index++) {
+		lru_cache_settle(cache, index);
+	}
+}
+
+/** Advances the clock hand to the first node without its reference bit set, clearing bits on the way */
+static uint32_t lru_cache_clock_victim(LRUCACHE *cache) {
+	for (;;) {
+		size_t index = cache->hand;
+		cache->hand = cache->hand + 1 == cache->max_capacity ? 0 : cache->hand + 1;
+
+		if (cache->nodes[index].value == NULL) {
+			continue; // Free since the cache shrank or went over budget
+		}
+
+		lru_cache_settle(cache, (uint32_t)index);
+		if (cache->pins[index] != 0) {
+			cache->pin_skips++;
+			continue;
+		}
+
+		if (!cache->referenced[index]) {
+			return (uint32_t)index;
+		}
+
+		cache->referenced[index] = 0;
+	}
+}
+
+/** Returns the tail of a list, first moving pinned tail nodes to the pinned list */
+static uint32_t lru_cache_unpinned_tail(LRUCACHE *cache, enum CacheQueue queue) {
+	for (;;) {
+		uint32_t index = cache->lists[queue].tail;
+		if (index == LRU_CACHE_NIL || cache->pins[index] == 0) {
+			return index;
+		}
+
+		lru_cache_settle(cache, index);
+		if (cache->pins[index] != 0) {
+			cache->nodes[index].parked = (uint8_t)queue;
+			lru_cache_relink(cache, CACHE_QUEUE_PINNED, index);
+			cache->pin_skips++;
+		}
+	}
+}
+
+/** Marks a node as recently used according to the cache policy */
+static inline void lru_cache_touch(LRUCACHE *cache, uint32_t index, uint32_t hash) {
+	cache->epochs[index] = cache->epoch;
 
-		lru_cache_remove_from_list(cache, node);
-		lru_cache_move_to_head(cache, node);
+	if (cache->queue[index] == CACHE_QUEUE_PINNED) {
+		// Parked until unpinned, which puts it back as recently used
+		if (cache->policy == LRU_CACHE_POLICY_TINYLFU) {
+			frequency_sketch_increment(cache->sketch, hash);
+		}
 		return;
 	}
 
-	if (cache->free_list != NULL) {
-		node = cache->free_list;
-		cache->free_list = node->next;
+	switch (cache->policy) {
+	case LRU_CACHE_POLICY_LRU:
+		lru_cache_relink(cache, CACHE_QUEUE_MAIN, index);
+		break;
+	case LRU_CACHE_POLICY_CLOCK:
+		cache->referenced[index] = 1;
+		break;
+	case LRU_CACHE_POLICY_2Q:
+		// A1in is a FIFO, a hit there proves nothing until the key comes back as a ghost
+		if (cache->queue[index] == CACHE_QUEUE_MAIN) {
+			lru_cache_relink(cache, CACHE_QUEUE_MAIN, index);
+		}
+		break;
+	case LRU_CACHE_POLICY_TINYLFU: {
+		frequency_sketch_increment(cache->sketch, hash);
+
+		if (cache->queue[index] == CACHE_QUEUE_IN) {
+			lru_cache_relink(cache, CACHE_QUEUE_IN, index);
+			break;
+		}
+
+		lru_cache_relink(cache, CACHE_QUEUE_MAIN, index);
+		lru_cache_demote_protected(cache);
+		break;
+	}
+	}
+}
+
+/** Takes a node off its list and out of the index, releases its value and returns it to the free list */
+static void lru_cache_drop(LRUCACHE *cache, uint32_t index) {
+	struct CacheNode *node = &cache->nodes[index];
+
+	if (cache->policy != LRU_CACHE_POLICY_CLOCK) {
+		lru_cache_remove_from_list(cache, index);
+	}
 
-		node->x = 0;
-		node->z = 0;
+	lru_cache_index_remove(cache, lru_cache_hash(node->x, node->z), index);
+	if (node->value != NULL) {
+		LRU_CACHE_STAT(cache->stats.evictions++);
+		lru_cache_release(cache, node->x, node->z, node->value);
 		node->value = NULL;
-		node->prev = NULL;
-		node->next = NULL;
+		cache->size--;
+		cache->cost -= cache->costs[index];
+		cache->costs[index] = 0;
+	}
+
+	node->next = cache->free_list;
+	cache->free_list = index;
+}
+
+/** Evicts the 2Q A1in tail, or the Am tail while A1in is within its share. The A1in tail stays as a ghost. */
+static void lru_cache_2q_evict(LRUCACHE *cache) {
+	struct CacheList *in = &cache->lists[CACHE_QUEUE_IN];
+	struct CacheList *ghost = &cache->lists[CACHE_QUEUE_GHOST];
+
+	if (in->size <= in->limit) {
+		uint32_t victim = lru_cache_unpinned_tail(cache, CACHE_QUEUE_MAIN);
+		if (victim != LRU_CACHE_NIL) {
+			lru_cache_drop(cache, victim);
+			return;
+		}
+	}
+
+	uint32_t index = lru_cache_unpinned_tail(cache, CACHE_QUEUE_IN);
+	if (index == LRU_CACHE_NIL) {
+		lru_cache_drop(cache, lru_cache_unpinned_tail(cache, CACHE_QUEUE_MAIN));
+		return;
+	}
+
+	struct CacheNode *node = &cache->nodes[index];
+	LRU_CACHE_STAT(cache->stats.evictions++);
+	lru_cache_release(cache, node->x, node->z, node->value);
+	node->value = NULL;
+	cache->size--;
+	cache->cost -= cache->costs[index];
+	cache->costs[index] = 0;
+
+	lru_cache_relink(cache, CACHE_QUEUE_GHOST, index);
+	if (ghost->size > ghost->limit) {
+		lru_cache_drop(cache, ghost->tail);
+	}
+}
+
+/** Lets the W-TinyLFU window tail into the main segment if it was seen more often than the main victim */
+static void lru_cache_tinylfu_evict(LRUCACHE *cache) {
+	struct CacheList *window = &cache->lists[CACHE_QUEUE_IN];
+
+	uint32_t candidate = lru_cache_unpinned_tail(cache, CACHE_QUEUE_IN);
+	uint32_t victim = lru_cache_unpinned_tail(cache, CACHE_QUEUE_PROBATION);
+	if (victim == LRU_CACHE_NIL) {
+		victim = lru_cache_unpinned_tail(cache, CACHE_QUEUE_MAIN);
+	}
+
+	if (candidate == LRU_CACHE_NIL || victim == LRU_CACHE_NIL || window->size < window->limit) {
+		lru_cache_drop(cache, victim != LRU_CACHE_NIL ? victim : candidate);
+		return;
+	}
+
+	struct CacheNode *a = &cache->nodes[candidate];
+	struct CacheNode *b = &cache->nodes[victim];
+	unsigned int candidate_frequency = frequency_sketch_estimate(cache->sketch, lru_cache_hash(a->x, a->z));
+	unsigned int victim_frequency = frequency_sketch_estimate(cache->sketch, lru_cache_hash(b->x, b->z));
+
+	if (candidate_frequency > victim_frequency) {
+		lru_cache_drop(cache, victim);
+		lru_cache_relink(cache, CACHE_QUEUE_PROBATION, candidate);
 	} else {
+		lru_cache_drop(cache, candidate);
+	}
+}
+
+/** Frees a node holding a value, chosen by the cache policy */
+static void lru_cache_evict(LRUCACHE *cache) {
+	lru_cache_settle_parked(cache);
+	if (cache->pinned == cache->size) {
+		lru_cache_settle_all(cache);
+	}
+	assert(cache->pinned < cache->size && "Every cached value is pinned");
+	size_t skips = cache->pin_skips;
+
+	switch (cache->policy) {
+	case LRU_CACHE_POLICY_LRU:
+		lru_cache_drop(cache, lru_cache_unpinned_tail(cache, CACHE_QUEUE_MAIN));
+		break;
+	case LRU_CACHE_POLICY_CLOCK:
+		lru_cache_drop(cache, lru_cache_clock_victim(cache));
+		break;
+	case LRU_CACHE_POLICY_2Q:
+		lru_cache_2q_evict(cache);
+		break;
+	case LRU_CACHE_POLICY_TINYLFU:
+		lru_cache_tinylfu_evict(cache);
+		break;
+	}
+
+	if (cache->pin_skips != skips) {
+		cache->pin_skip_puts++;
+	}
+}
+
+/**
+ * Stores a value under its key, evicting one entry when the cache is full.
+ * A cold insert of a new key is linked where eviction looks first and does
+ * not count as an access. Returns the node the value went to.
+ */
+static uint32_t lru_cache_insert(LRUCACHE *cache, uint32_t hash, int x, int z, void *value, bool cold) {
+	uint32_t index = lru_cache_index_find(cache, hash, x, z);
+	if (index != LRU_CACHE_NIL && cache->nodes[index].value != NULL) {
+		assert(atomic_load_explicit(&cache->states[index], memory_order_acquire) != LRU_CACHE_LOADING &&
+			"Chunk is still being generated");
+
+		struct CacheNode *node = &cache->nodes[index];
+		if (node->value != value) {
+			lru_cache_release(cache, x, z, node->value);
+		}
+		node->value = value;
+		atomic_store_explicit(&cache->states[index], LRU_CACHE_READY, memory_order_relaxed);
+		LRU_CACHE_STAT(cache->stats.updates++);
+
+		lru_cache_touch(cache, index, hash);
+		return index;
+	}
+
+	if (index != LRU_CACHE_NIL) {
+		// 2Q ghost hit, the key was seen before so it goes straight to Am
+		lru_cache_remove_from_list(cache, index);
+		cache->queue[index] = CACHE_QUEUE_MAIN;
+
+		if (cache->size >= cache->capacity) {
+			lru_cache_evict(cache);
+		}
+
+		cache->nodes[index].value = value;
+		cache->epochs[index] = cache->epoch;
+		atomic_store_explicit(&cache->states[index], LRU_CACHE_READY, memory_order_relaxed);
+		cache->size++;
+		LRU_CACHE_STAT(cache->stats.inserts++);
+		lru_cache_link(cache, CACHE_QUEUE_MAIN, index, cold);
+		return index;
+	}
+
+	if (cache->policy == LRU_CACHE_POLICY_TINYLFU && !cold) {
+		frequency_sketch_increment(cache->sketch, hash);
+	}
+
+	if (cache->size >= cache->capacity) {
 		//
 		// Eviction time!
 		//
 
-		node = cache->tail;
-		hashmap_remove(cache->hashmap, node->x, node->z);
-		lru_cache_remove_from_list(cache, node);
-
-		node->x = 0;
-		node->z = 0;
-		node->value = NULL; // In the future we will call a cleanup function before overwriting this.
-		node->prev = NULL;
-		node->next = NULL;
+		lru_cache_evict(cache);
 	}
 
+	index = cache->free_list;
+	assert(index != LRU_CACHE_NIL);
+	cache->free_list = cache->nodes[index].next;
+
 	//
 	// Setup node for new value
 	//
 
+	struct CacheNode *node = &cache->nodes[index];
 	node->x = x;
 	node->z = z;
 	node->value = value;
+	node->prev = LRU_CACHE_NIL;
+	node->next = LRU_CACHE_NIL;
+	cache->referenced[index] = 0;
+	cache->epochs[index] = cache->epoch;
+	atomic_store_explicit(&cache->states[index], LRU_CACHE_READY, memory_order_relaxed);
+	cache->size++;
+	LRU_CACHE_STAT(cache->stats.inserts++);
 
-	hashmap_insert(cache->hashmap, x, z, node);
-	lru_cache_remove_from_list(cache, node);
-	lru_cache_move_to_head(cache, node);
-}
+	lru_cache_index_insert(cache, hash, index);
 
-void *lru_cache_get(LRUCACHE *cache, int x, int z) {
+	switch (cache->policy) {
+	case LRU_CACHE_POLICY_LRU:
+		lru_cache_link(cache, CACHE_QUEUE_MAIN, index, cold);
+		break;
+	case LRU_CACHE_POLICY_CLOCK:
+		break;
+	case LRU_CACHE_POLICY_2Q:
+		// A1in already keeps new keys away from Am, and hits do not reorder it, so cold ones go in as usual
+		lru_cache_move_to_head(cache, CACHE_QUEUE_IN, index);
+		break;
+	case LRU_CACHE_POLICY_TINYLFU: {
+		if (cold) {
+			// Behind the main segment's victim, a cold entry is never admitted over anything
+			lru_cache_move_to_tail(cache, CACHE_QUEUE_PROBATION, index);
+			break;
+		}
+
+		lru_cache_move_to_head(cache, CACHE_QUEUE_IN, index);
+
+		// Until the cache fills up the window overflow moves to probation without a contest
+		struct CacheList *window = &cache->lists[CACHE_QUEUE_IN];
+		if (window->size > window->limit) {
+			lru_cache_relink(cache, CACHE_QUEUE_PROBATION, window->tail);
+		}
+		break;
+	}
+	}
+
+	return index;
+}
+
+/** Evicts until the cache is within its capacity and budget, or only pinned values are left */
+static void lru_cache_trim(LRUCACHE *cache) {
+	while ((cache->size > cache->capacity || (cache->budget != 0 && cache->cost > cache->budget && cache->size > 1)) &&
+		cache->pinned < cache->size) {
+		lru_cache_evict(cache);
+	}
+}
+
+static void lru_cache_put_hashed(LRUCACHE *cache, uint32_t hash, int x, int z, void *value, size_t cost) {
+	LRU_CACHE_TRACED(lru_cache_trace(cache, LRU_TRACE_PUT, x, z, cost));
+
+	uint32_t index = lru_cache_insert(cache, hash, x, z, value, false);
+
+	cache->cost += cost - cache->costs[index];
+	cache->costs[index] = cost;
+
+	if (cache->budget != 0 && cache->cost > cache->budget) {
+		lru_cache_trim(cache);
+	}
+}
+
+/**
+ * Finds and touches the node holding a value for the key, or returns
+ * LRU_CACHE_NIL. With settle a published claim is settled first, so a node
+ * parked while it was loading comes back as recently used.
+ */
+static inline uint32_t lru_cache_lookup(LRUCACHE *cache, uint32_t hash, int x, int z, bool settle) {
+	uint32_t index = lru_cache_index_find(cache, hash, x, z);
+	if (index != LRU_CACHE_NIL && cache->nodes[index].value != NULL) {
+		LRU_CACHE_STAT(cache->stats.hits++);
+		if (settle) {
+			lru_cache_settle(cache, index);
+		}
+		lru_cache_touch(cache, index, hash);
+
+		return index;
+	}
+
+	LRU_CACHE_STAT(cache->stats.misses++);
+
+	if (index == LRU_CACHE_NIL && cache->policy == LRU_CACHE_POLICY_TINYLFU) {
+		// Misses count too, so a key that keeps being asked for can win admission
+		frequency_sketch_increment(cache->sketch, hash);
+	}
+
+	return LRU_CACHE_NIL;
+}
+
+static inline void *lru_cache_get_hashed(LRUCACHE *cache, uint32_t hash, int x, int z) {
+	LRU_CACHE_TRACED(lru_cache_trace(cache, LRU_TRACE_GET, x, z, 0));
+
+	uint32_t index = lru_cache_lookup(cache, hash, x, z, false);
+	return index != LRU_CACHE_NIL ? cache->nodes[index].value : NULL;
+}
+
+void lru_cache_put(LRUCACHE *cache, int x, int z, void *value) {
+	assert(cache != NULL);
+	assert(value != NULL);
+
+	lru_cache_put_hashed(cache, lru_cache_hash(x, z), x, z, value, 0);
+}
+
+/**
+ * Puts a value that counts cost bytes against the budget. With a budget set,
+ * entries are evicted through the policy until the total fits again, which
+ * may be the new value itself under W-TinyLFU or CLOCK. A value costing more
+ * than the whole budget stays while it is the only entry.
+ */
+void lru_cache_put_cost(LRUCACHE *cache, int x, int z, void *value, size_t cost) {
+	assert(cache != NULL);
+	assert(value != NULL);
+
+	lru_cache_put_hashed(cache, lru_cache_hash(x, z), x, z, value, cost);
+}
+
+/**
+ * Changes the entry limit and the byte budget (0 for none), evicting right
+ * away when the cache is over either. The entry limit cannot go above the
+ * capacity the cache was created with. Pinned values are never evicted, so
+ * the cache may stay above the new limits until they are unpinned.
+ */
+void lru_cache_resize(LRUCACHE *cache, size_t capacity, size_t budget) {
+	assert(cache != NULL);
+	assert(capacity > 1 && "Cache capacity cannot be less then 1");
+	assert(capacity <= cache->max_capacity && "Cache cannot grow past its created capacity");
+
+#ifdef LRU_CACHE_TRACE
+	if (cache->trace != NULL) {
+		struct CacheTrace *trace = cache->trace;
+		if (trace->used + LRU_TRACE_MAX_RECORD > LRU_CACHE_TRACE_BUFFER) {
+			lru_cache_trace_flush(trace);
+		}
+
+		trace->buffer[trace->used++] = LRU_TRACE_TAG_RESIZE;
+		trace->used += lru_cache_trace_varint(trace->buffer + trace->used, capacity);
+		trace->used += lru_cache_trace_varint(trace->buffer + trace->used, budget);
+	}
+#endif
+
+	cache->capacity = capacity;
+	cache->budget = budget;
+	lru_cache_set_limits(cache);
+
+	lru_cache_trim(cache);
+}
+
+size_t lru_cache_size(LRUCACHE *cache) {
+	assert(cache != NULL);
+
+	return cache->size;
+}
+
+size_t lru_cache_cost(LRUCACHE *cache) {
+	assert(cache != NULL);
+
+	return cache->cost;
+}
+
+/** Bytes the cache has allocated itself, not counting the values it holds */
+size_t lru_cache_memory(LRUCACHE *cache) {
+	assert(cache != NULL);
+
+	size_t bytes = cache->block_size + cache->evicted_capacity * sizeof(struct LRUCacheEvicted);
+	if (cache->sketch != NULL) {
+		bytes += frequency_sketch_memory(cache->sketch);
+	}
+
+	return bytes;
+}
+
+/** Sets the epoch stamped on entries by the accesses that follow, usually the frame number. Wraps around safely. */
+void lru_cache_set_epoch(LRUCACHE *cache, uint32_t epoch) {
+	assert(cache != NULL);
+
+	cache->epoch = epoch;
+}
+
+static inline bool lru_cache_idle(const LRUCACHE *cache, uint32_t index, uint32_t epoch) {
+	return (int32_t)(epoch - cache->epochs[index]) > 0;
+}
+
+/** Drops idle entries from the tail of a list, returns how many */
+static size_t lru_cache_expire_list(LRUCACHE *cache, enum CacheQueue queue, uint32_t epoch, size_t budget) {
+	size_t expired = 0;
+	uint32_t index;
+
+	while (expired < budget && (index = lru_cache_unpinned_tail(cache, queue)) != LRU_CACHE_NIL &&
+		lru_cache_idle(cache, index, epoch)) {
+		lru_cache_drop(cache, index);
+		expired++;
+	}
+
+	return expired;
+}
+
+static inline size_t lru_cache_expire_scan(const LRUCACHE *cache, size_t budget) {
+	return budget < cache->max_capacity / LRU_CACHE_EXPIRE_SCAN ? budget * LRU_CACHE_EXPIRE_SCAN : cache->max_capacity;
+}
+
+/** Drops idle entries of the 2Q A1in FIFO, where hits do not move entries, walking on from the last call */
+static size_t lru_cache_expire_fifo(LRUCACHE *cache, uint32_t epoch, size_t budget) {
+	struct CacheList *in = &cache->lists[CACHE_QUEUE_IN];
+	size_t scan = lru_cache_expire_scan(cache, budget);
+	size_t expired = 0;
+	uint32_t index = cache->expire_cursor;
+
+	for (size_t i = 0; i < scan && expired < budget && in->size > 0; i++) {
+		// Start over from the tail when the cursor fell off the list or its node moved
+		if (index == LRU_CACHE_NIL || cache->queue[index] != CACHE_QUEUE_IN || cache->nodes[index].value == NULL) {
+			index = in->tail;
+		}
+
+		uint32_t prev = cache->nodes[index].prev;
+		if (cache->pins[index] == 0 && lru_cache_idle(cache, index, epoch)) {
+			lru_cache_drop(cache, index);
+			expired++;
+		}
+		index = prev;
+	}
+
+	cache->expire_cursor = index;
+	return expired;
+}
+
+/**
+ * Evicts up to budget entries that were not used since epoch, through the
+ * eviction callback like any other eviction, and returns how many. Calling
+ * it every frame with a small budget frees an idle cache gradually instead of
+ * all at once. Pinned entries are never expired. CLOCK and the 2Q A1in FIFO
+ * look at no more than LRU_CACHE_EXPIRE_SCAN nodes per entry of budget, so
+ * they may return fewer than budget while idle entries are left.
+ */
+size_t lru_cache_expire_older_than(LRUCACHE *cache, uint32_t epoch, size_t budget) {
+	assert(cache != NULL);
+
+	size_t expired = 0;
+
+	switch (cache->policy) {
+	case LRU_CACHE_POLICY_LRU:
+		expired = lru_cache_expire_list(cache, CACHE_QUEUE_MAIN, epoch, budget);
+		break;
+	case LRU_CACHE_POLICY_CLOCK: {
+		size_t scan = lru_cache_expire_scan(cache, budget);
+
+		for (size_t i = 0; i < scan && expired < budget; i++) {
+			size_t index = cache->expire_hand;
+			cache->expire_hand = index + 1 == cache->max_capacity ? 0 : index + 1;
+
+			if (cache->nodes[index].value != NULL && cache->pins[index] == 0 &&
+				lru_cache_idle(cache, (uint32_t)index, epoch)) {
+				lru_cache_drop(cache, (uint32_t)index);
+				expired++;
+			}
+		}
+		break;
+	}
+	case LRU_CACHE_POLICY_2Q:
+		expired = lru_cache_expire_fifo(cache, epoch, budget);
+		expired += lru_cache_expire_list(cache, CACHE_QUEUE_MAIN, epoch, budget - expired);
+		break;
+	case LRU_CACHE_POLICY_TINYLFU:
+		expired = lru_cache_expire_list(cache, CACHE_QUEUE_IN, epoch, budget);
+		expired += lru_cache_expire_list(cache, CACHE_QUEUE_PROBATION, epoch, budget - expired);
+		expired += lru_cache_expire_list(cache, CACHE_QUEUE_MAIN, epoch, budget - expired);
+		break;
+	}
+
+	return expired;
+}
+
+/** Copies the counters gathered since creation or the last reset. All zero unless built with LRU_CACHE_STATS. */
+void lru_cache_stats(LRUCACHE *cache, struct LRUCacheStats *stats) {
+	assert(cache != NULL);
+	assert(stats != NULL);
+
+#ifdef LRU_CACHE_STATS
+	*stats = cache->stats;
+	stats->average_probe = stats->lookups > 0 ? (double)cache->probe_total / (double)stats->lookups : 0.0;
+#else
+	(void)cache;
+	memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void lru_cache_stats_reset(LRUCACHE *cache) {
+	assert(cache != NULL);
+
+#ifdef LRU_CACHE_STATS
+	memset(&cache->stats, 0, sizeof(cache->stats));
+	cache->probe_total = 0;
+#else
+	(void)cache;
+#endif
+}
+
+/**
+ * Starts logging every access to the file at path, replacing it. Returns
+ * false when the file cannot be created or the cache was built without
+ * LRU_CACHE_TRACE. The log is only complete after lru_cache_trace_stop.
+ */
+bool lru_cache_trace_start(LRUCACHE *cache, const char *path) {
+	assert(cache != NULL);
+	assert(path != NULL);
+
+#ifdef LRU_CACHE_TRACE
+	assert(cache->trace == NULL && "Cache is already being traced");
+
+	struct CacheTrace *trace = malloc(sizeof(struct CacheTrace));
+	if (trace == NULL) {
+		return false;
+	}
+
+	trace->file = fopen(path, "wb");
+	if (trace->file == NULL) {
+		free(trace);
+		return false;
+	}
+
+	// The buffer already batches the writes
+	setvbuf(trace->file, NULL, _IONBF, 0);
+
+	trace->x = 0;
+	trace->z = 0;
+	trace->failed = false;
+	trace->used = sizeof(LRU_TRACE_MAGIC) - 1;
+	memcpy(trace->buffer, LRU_TRACE_MAGIC, trace->used);
+	trace->buffer[trace->used++] = LRU_TRACE_VERSION;
+	trace->used += lru_cache_trace_varint(trace->buffer + trace->used, cache->capacity);
+	trace->used += lru_cache_trace_varint(trace->buffer + trace->used, cache->budget);
+	trace->buffer[trace->used++] = (uint8_t)cache->policy;
+
+	cache->trace = trace;
+	return true;
+#else
+	(void)cache;
+	(void)path;
+	return false;
+#endif
+}
+
+/** Writes out what is left of the log and closes it. Returns false if any write failed. */
+bool lru_cache_trace_stop(LRUCACHE *cache) {
+	assert(cache != NULL);
+
+#ifdef LRU_CACHE_TRACE
+	struct CacheTrace *trace = cache->trace;
+	assert(trace != NULL && "Cache is not being traced");
+
+	lru_cache_trace_flush(trace);
+	bool written = !trace->failed;
+	written = fclose(trace->file) == 0 && written;
+
+	free(trace);
+	cache->trace = NULL;
+	return written;
+#else
+	(void)cache;
+	return false;
+#endif
+}
+
+void *lru_cache_get(LRUCACHE *cache, int x, int z) {
+	assert(cache != NULL);
+
+	return lru_cache_get_hashed(cache, lru_cache_hash(x, z), x, z);
+}
+
+/**
+ * Looks up a value like lru_cache_get and pins it, so it stays cached until
+ * the matching lru_cache_unpin however many puts come in between. Pins nest.
+ * Returns NULL without pinning anything when the key is not cached.
+ */
+void *lru_cache_pin(LRUCACHE *cache, int x, int z) {
+	assert(cache != NULL);
+
+	LRU_CACHE_TRACED(lru_cache_trace(cache, LRU_TRACE_PIN, x, z, 0));
+
+	uint32_t hash = lru_cache_hash(x, z);
+	uint32_t index = lru_cache_index_find(cache, hash, x, z);
+	if (index == LRU_CACHE_NIL || cache->nodes[index].value == NULL) {
+		return NULL;
+	}
+
+	lru_cache_touch(cache, index, hash);
+
+	assert(cache->pins[index] < UINT32_MAX);
+	if (cache->pins[index]++ == 0) {
+		cache->pinned++;
+	}
+
+	return cache->nodes[index].value;
+}
+
+/** Drops one pin. The last unpin makes the value evictable again, as if it was just used. */
+void lru_cache_unpin(LRUCACHE *cache, int x, int z) {
+	assert(cache != NULL);
+
+	LRU_CACHE_TRACED(lru_cache_trace(cache, LRU_TRACE_UNPIN, x, z, 0));
+
+	uint32_t index = lru_cache_index_find(cache, lru_cache_hash(x, z), x, z);
+	assert(index != LRU_CACHE_NIL && cache->pins[index] > cache->claimed[index] && "Chunk is not pinned");
+
+	lru_cache_unpin_node(cache, index, false);
+}
+
+void lru_cache_pin_stats(LRUCACHE *cache, struct LRUCachePinStats *stats) {
+	assert(cache != NULL);
+	assert(stats != NULL);
+
+	stats->pinned = cache->pinned;
+	stats->skipped = cache->pin_skips;
+	stats->skipping_puts = cache->pin_skip_puts;
+}
+
+/** Makes a node Loading and pins it for the worker, returns its ticket */
+static uint32_t lru_cache_claim_node(LRUCACHE *cache, uint32_t index) {
+	atomic_store_explicit(&cache->states[index], LRU_CACHE_LOADING, memory_order_relaxed);
+	cache->claimed[index] = 1;
+
+	assert(cache->pins[index] < UINT32_MAX);
+	if (cache->pins[index]++ == 0) {
+		cache->pinned++;
+	}
+
+	return index;
+}
+
+/**
+ * Claims a chunk for generation. When the key is not cached, or cached but
+ * Dirty, the chunk becomes Loading with value as its storage and a ticket
+ * is returned for the worker to hand to lru_cache_publish once the value is
+ * filled in. A Dirty chunk keeps its old value, value is ignored then. While
+ * Loading the chunk is pinned, so the value outlives its eviction. Returns
+ * LRU_CACHE_NO_TICKET when the chunk is already Loading or Ready, so a chunk
+ * is never generated twice. Main thread only, like every call but publish.
+ */
+uint32_t lru_cache_claim(LRUCACHE *cache, int x, int z, void *value) {
+	assert(cache != NULL);
+	assert(value != NULL);
+
+	uint32_t hash = lru_cache_hash(x, z);
+	uint32_t index = lru_cache_index_find(cache, hash, x, z);
+
+	if (index != LRU_CACHE_NIL && cache->nodes[index].value != NULL) {
+		LRU_CACHE_TRACED(lru_cache_trace(cache, LRU_TRACE_GET, x, z, 0));
+		lru_cache_settle(cache, index);
+		lru_cache_touch(cache, index, hash);
+
+		if (atomic_load_explicit(&cache->states[index], memory_order_acquire) != LRU_CACHE_DIRTY) {
+			return LRU_CACHE_NO_TICKET;
+		}
+	} else {
+		LRU_CACHE_TRACED(lru_cache_trace(cache, LRU_TRACE_PUT, x, z, 0));
+		index = lru_cache_insert(cache, hash, x, z, value, false);
+	}
+
+	return lru_cache_claim_node(cache, index);
+}
+
+/**
+ * Claims a chunk that is not cached yet, like lru_cache_claim, for
+ * generating it before the player gets to it. It goes in cold: linked where
+ * eviction looks first and not counted as an access, so it never outranks a
+ * chunk in use until it is looked up itself. Returns LRU_CACHE_NO_TICKET
+ * when the chunk is cached in any state.
+ */
+uint32_t lru_cache_prefetch(LRUCACHE *cache, int x, int z, void *value) {
+	assert(cache != NULL);
+	assert(value != NULL);
+
+	uint32_t hash = lru_cache_hash(x, z);
+	uint32_t index = lru_cache_index_find(cache, hash, x, z);
+	if (index != LRU_CACHE_NIL && cache->nodes[index].value != NULL) {
+		return LRU_CACHE_NO_TICKET;
+	}
+
+	LRU_CACHE_TRACED(lru_cache_trace(cache, LRU_TRACE_PUT, x, z, 0));
+	return lru_cache_claim_node(cache, lru_cache_insert(cache, hash, x, z, value, true));
+}
+
+/**
+ * Marks a claimed chunk Ready. Called by the worker that generated it, from
+ * any thread; everything it wrote to the value before is visible to the main
+ * thread once it sees the chunk Ready.
+ */
+void lru_cache_publish(LRUCACHE *cache, uint32_t ticket) {
+	assert(cache != NULL);
+	assert(ticket < cache->node_count && "Not a ticket from lru_cache_claim");
+
+	uint8_t loading = LRU_CACHE_LOADING;
+	bool published = atomic_compare_exchange_strong_explicit(&cache->states[ticket], &loading, LRU_CACHE_READY,
+		memory_order_release, memory_order_relaxed);
+	assert(published && "Chunk is not loading");
+	(void)published;
+
+	atomic_fetch_add_explicit(&cache->published, 1, memory_order_relaxed);
+}
+
+/**
+ * Looks up a chunk like lru_cache_get and returns its state, storing its
+ * value to value (may be NULL). A Loading chunk's value is still being
+ * written by a worker and must not be read. Never waits on a worker.
+ */
+enum LRUCacheState lru_cache_get_state(LRUCACHE *cache, int x, int z, void **value) {
+	assert(cache != NULL);
+
+	LRU_CACHE_TRACED(lru_cache_trace(cache, LRU_TRACE_GET, x, z, 0));
+
+	uint32_t index = lru_cache_lookup(cache, lru_cache_hash(x, z), x, z, true);
+	if (index == LRU_CACHE_NIL) {
+		if (value != NULL) {
+			*value = NULL;
+		}
+		return LRU_CACHE_UNLOADED;
+	}
+
+	if (value != NULL) {
+		*value = cache->nodes[index].value;
+	}
+
+	return (enum LRUCacheState)atomic_load_explicit(&cache->states[index], memory_order_acquire);
+}
+
+/** Marks a Ready chunk Dirty so the next claim regenerates it. Returns false if it is not cached or still Loading. */
+bool lru_cache_mark_dirty(LRUCACHE *cache, int x, int z) {
+	assert(cache != NULL);
+
+	uint32_t index = lru_cache_index_find(cache, lru_cache_hash(x, z), x, z);
+	if (index == LRU_CACHE_NIL || cache->nodes[index].value == NULL) {
+		return false;
+	}
+
+	lru_cache_settle(cache, index);
+
+	uint8_t state = LRU_CACHE_READY;
+	return atomic_compare_exchange_strong_explicit(&cache->states[index], &state, LRU_CACHE_DIRTY,
+			   memory_order_relaxed, memory_order_relaxed) ||
+		state == LRU_CACHE_DIRTY;
+}
+
+/** Hashes a batch of keys and prefetches their home slots so the slot misses of the whole batch overlap */
+static inline void lru_cache_prefetch_batch(const LRUCACHE *cache, const struct LRUCacheKey *keys, size_t count, uint32_t *hashes) {
+	for (size_t i = 0; i < count; i++) {
+		hashes[i] = lru_cache_hash(keys[i].x, keys[i].z);
+		__builtin_prefetch(&cache->slots[hashes[i] & cache->slot_mask]);
+	}
+}
+
+/**
+ * Looks up count keys, writing each value or NULL to values. The result and
+ * the recency order are the same as calling lru_cache_get on each key in
+ * turn. Returns the number of hits.
+ */
+size_t lru_cache_get_many(LRUCACHE *cache, const struct LRUCacheKey *keys, size_t count, void **values) {
+	assert(cache != NULL);
+	assert((keys != NULL && values != NULL) || count == 0);
+
+	uint32_t hashes[LRU_CACHE_BATCH];
+	size_t hits = 0;
+
+	for (size_t base = 0; base < count; base += LRU_CACHE_BATCH) {
+		size_t batch = count - base < LRU_CACHE_BATCH ? count - base : LRU_CACHE_BATCH;
+		lru_cache_prefetch_batch(cache, keys + base, batch, hashes);
+
+		for (size_t i = 0; i < batch; i++) {
+			const struct LRUCacheKey *key = &keys[base + i];
+			values[base + i] = lru_cache_get_hashed(cache, hashes[i], key->x, key->z);
+			hits += values[base + i] != NULL;
+		}
+	}
+
+	return hits;
+}
+
+/** Puts count keys with their values, the same as calling lru_cache_put on each in turn */
+void lru_cache_put_many(LRUCACHE *cache, const struct LRUCacheKey *keys, size_t count, void *const *values) {
+	assert(cache != NULL);
+	assert((keys != NULL && values != NULL) || count == 0);
+
+	uint32_t hashes[LRU_CACHE_BATCH];
+
+	for (size_t base = 0; base < count; base += LRU_CACHE_BATCH) {
+		size_t batch = count - base < LRU_CACHE_BATCH ? count - base : LRU_CACHE_BATCH;
+
+		// Evictions shift slots around, so the prefetches are only a hint and every put probes again
+		lru_cache_prefetch_batch(cache, keys + base, batch, hashes);
+
+		for (size_t i = 0; i < batch; i++) {
+			assert(values[base + i] != NULL);
+			const struct LRUCacheKey *key = &keys[base + i];
+			lru_cache_put_hashed(cache, hashes[i], key->x, key->z, values[base + i], 0);
+		}
+	}
+}
+
+/** Where each part of a snapshot starts. The arrays are stored as they are in memory, in the order of the cache block. */
+struct CacheImageLayout {
+	size_t nodes;
+	size_t slots;
+	size_t costs;
+	size_t referenced;
+	size_t queue;
+	size_t states;
+	size_t sketch;
+	size_t values; // Page aligned, each value takes stride bytes
+	size_t stride;
+	size_t size;
+};
+
+static void lru_cache_image_layout(const struct CacheImageHeader *header, struct CacheImageLayout *layout) {
+	size_t nodeCount = (size_t)header->node_count;
+
+	layout->nodes = sizeof(struct CacheImageHeader);
+	layout->slots = layout->nodes + nodeCount * sizeof(struct CacheNode);
+	layout->costs = layout->slots + (size_t)header->slot_count * sizeof(CacheSlot);
+	layout->referenced = layout->costs + nodeCount * sizeof(size_t);
+	layout->queue = layout->referenced + nodeCount * sizeof(uint8_t);
+	layout->states = layout->queue + nodeCount * sizeof(uint8_t);
+	layout->sketch = (layout->states + nodeCount * sizeof(uint8_t) + 7) & ~(size_t)7;
+	layout->values = (layout->sketch + (size_t)header->sketch_size + LRU_CACHE_IMAGE_ALIGN - 1) &
+		~(size_t)(LRU_CACHE_IMAGE_ALIGN - 1);
+	layout->stride = ((size_t)header->value_size + LRU_CACHE_IMAGE_VALUE_ALIGN - 1) &
+		~(size_t)(LRU_CACHE_IMAGE_VALUE_ALIGN - 1);
+	layout->size = layout->values + (size_t)header->size * layout->stride;
+}
+
+/** Writes zeros up to offset */
+static bool lru_cache_image_pad(FILE *file, size_t *written, size_t offset) {
+	static const uint8_t zeros[LRU_CACHE_IMAGE_ALIGN];
+
+	size_t length = offset - *written;
+	*written = offset;
+	return fwrite(zeros, 1, length, file) == length;
+}
+
+/**
+ * Writes a snapshot of the cache to path: the index, the recency lists, the
+ * TinyLFU frequencies and every value, each valueSize bytes, so
+ * lru_cache_load can start a cache in the same state. Pointers are stored as
+ * file offsets, so the file can be mapped anywhere. It is written next to
+ * path and renamed over it, so a snapshot the cache was loaded from can be
+ * replaced. Returns false when a chunk is pinned or still loading, or the
+ * file cannot be written.
+ */
+bool lru_cache_save(LRUCACHE *cache, const char *path, size_t valueSize) {
 	assert(cache != NULL);
+	assert(path != NULL);
+	assert(valueSize > 0);
+
+	lru_cache_settle_all(cache);
+	if (cache->pinned > 0) {
+		return false;
+	}
+
+	struct CacheImageHeader header = {
+		.magic = LRU_CACHE_IMAGE_MAGIC,
+		.version = LRU_CACHE_IMAGE_VERSION,
+		.policy = (uint32_t)cache->policy,
+		.free_list = cache->free_list,
+		.node_count = cache->node_count,
+		.slot_count = cache->slot_mask + 1,
+		.max_capacity = cache->max_capacity,
+		.capacity = cache->capacity,
+		.size = cache->size,
+		.cost = cache->cost,
+		.hand = cache->hand,
+		.value_size = valueSize,
+		.sketch_size = cache->sketch != NULL ? frequency_sketch_state_size(cache->sketch) : 0,
+	};
+	memcpy(header.lists, cache->lists, sizeof(cache->lists));
+
+	struct CacheImageLayout layout;
+	lru_cache_image_layout(&header, &layout);
+
+	size_t length = strlen(path);
+	char *temporary = malloc(length + sizeof(LRU_CACHE_IMAGE_SUFFIX));
+	struct CacheNode *nodes = malloc(cache->node_count * sizeof(struct CacheNode));
+	void *sketch = header.sketch_size > 0 ? malloc((size_t)header.sketch_size) : NULL;
+	if (temporary == NULL || nodes == NULL || (header.sketch_size > 0 && sketch == NULL)) {
+		free(temporary);
+		free(nodes);
+		free(sketch);
+		return false;
+	}
+
+	memcpy(temporary, path, length);
+	memcpy(temporary + length, LRU_CACHE_IMAGE_SUFFIX, sizeof(LRU_CACHE_IMAGE_SUFFIX));
+
+	// Values are stored in node order, so each one's offset is known before any is written
+	size_t offset = layout.values;
+	for (size_t i = 0; i < cache->node_count; i++) {
+		nodes[i] = cache->nodes[i];
+		if (nodes[i].value != NULL) {
+			nodes[i].value = (void *)(uintptr_t)offset;
+			offset += layout.stride;
+		}
+	}
+
+	FILE *file = fopen(temporary, "wb");
+	bool written = file != NULL;
+	size_t position = layout.states + cache->node_count * sizeof(uint8_t);
+
+	if (written) {
+		written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+			fwrite(nodes, sizeof(struct CacheNode), cache->node_count, file) == cache->node_count &&
+			fwrite(cache->slots, sizeof(CacheSlot), cache->slot_mask + 1, file) == cache->slot_mask + 1 &&
+			fwrite(cache->costs, sizeof(size_t), cache->node_count, file) == cache->node_count &&
+			fwrite(cache->referenced, sizeof(uint8_t), cache->node_count, file) == cache->node_count &&
+			fwrite(cache->queue, sizeof(uint8_t), cache->node_count, file) == cache->node_count;
+
+		for (size_t i = 0; i < cache->node_count && written; i++) {
+			uint8_t state = atomic_load_explicit(&cache->states[i], memory_order_relaxed);
+			written = fputc(state, file) != EOF;
+		}
+
+		if (sketch != NULL) {
+			frequency_sketch_save_state(cache->sketch, sketch);
+			written = written && lru_cache_image_pad(file, &position, layout.sketch) &&
+				fwrite(sketch, 1, (size_t)header.sketch_size, file) == header.sketch_size;
+			position += (size_t)header.sketch_size;
+		}
+
+		written = written && lru_cache_image_pad(file, &position, layout.values);
+
+		for (size_t i = 0; i < cache->node_count && written; i++) {
+			if (cache->nodes[i].value != NULL) {
+				written = fwrite(cache->nodes[i].value, 1, valueSize, file) == valueSize;
+				position += valueSize;
+				written = written && lru_cache_image_pad(file, &position, position + layout.stride - valueSize);
+			}
+		}
+
+		written = fclose(file) == 0 && written;
+		written = written && rename(temporary, path) == 0;
+		if (!written) {
+			remove(temporary);
+		}
+	}
+
+	free(temporary);
+	free(nodes);
+	free(sketch);
+	return written;
+}
+
+/** What lru_cache_image_check found a node to be so far */
+enum CacheImageNode {
+	CACHE_IMAGE_UNSEEN,
+	CACHE_IMAGE_HELD, // Holds a key, on a list or, for CLOCK, a value
+	CACHE_IMAGE_FREE,
+	CACHE_IMAGE_INDEXED
+};
+
+/** Walks one list of a loaded snapshot, marking its nodes held. Returns the number of nodes, or SIZE_MAX if it is broken. */
+static size_t lru_cache_image_list(LRUCACHE *cache, enum CacheQueue queue, uint8_t *seen) {
+	const struct CacheList *list = &cache->lists[queue];
+	uint32_t previous = LRU_CACHE_NIL;
+	size_t length = 0;
+
+	// Every node is visited once at most, which also ends a cycle
+	for (uint32_t index = list->head; index != LRU_CACHE_NIL; index = cache->nodes[index].next) {
+		if (index >= cache->node_count || seen[index] != CACHE_IMAGE_UNSEEN || cache->queue[index] != queue ||
+			cache->nodes[index].prev != previous || (cache->nodes[index].value == NULL) != (queue == CACHE_QUEUE_GHOST)) {
+			return SIZE_MAX;
+		}
+
+		seen[index] = CACHE_IMAGE_HELD;
+		previous = index;
+		length++;
+	}
+
+	return previous == list->tail && length == list->size ? length : SIZE_MAX;
+}
+
+/**
+ * Checks what lru_cache_load copied from a snapshot before anything uses it,
+ * while values are still file offsets. Every value has to start on its own
+ * stride past the metadata. The lists, the free list and the index have to
+ * cover every node exactly once, with indices in range, and every index slot
+ * has to be reachable from its home slot, or a lookup could run out of the
+ * node array or never end.
+ */
+static bool lru_cache_image_check(LRUCACHE *cache, const struct CacheImageLayout *layout, size_t valueSize) {
+	if (cache->capacity == 0 || cache->capacity > cache->max_capacity || cache->size > cache->capacity ||
+		cache->hand >= cache->max_capacity) {
+		return false;
+	}
+
+	uint8_t *seen = calloc(cache->node_count, sizeof(uint8_t));
+	if (seen == NULL) {
+		return false;
+	}
+
+	bool valid = true;
+	size_t values = 0;
+	size_t cost = 0;
+
+	for (size_t i = 0; i < cache->node_count && valid; i++) {
+		uintptr_t offset = (uintptr_t)cache->nodes[i].value;
+		if (offset == 0) {
+			continue;
+		}
+
+		uint8_t state = atomic_load_explicit(&cache->states[i], memory_order_relaxed);
+		valid = offset >= layout->values && (offset - layout->values) % layout->stride == 0 &&
+			offset + valueSize <= layout->size && (state == LRU_CACHE_READY || state == LRU_CACHE_DIRTY);
+		values++;
+		cost += cache->costs[i];
+	}
+
+	valid = valid && values == cache->size && cost == cache->cost;
+
+	// CLOCK keeps its nodes off the lists
+	size_t held = 0;
+	for (int queue = 0; queue < CACHE_QUEUE_COUNT && valid; queue++) {
+		size_t length = lru_cache_image_list(cache, (enum CacheQueue)queue, seen);
+		valid = length != SIZE_MAX && (length == 0 || (cache->policy != LRU_CACHE_POLICY_CLOCK && queue != CACHE_QUEUE_PINNED));
+		held += length;
+	}
+
+	// Ghosts within their limit leave a free node for every value up to the capacity
+	valid = valid && cache->lists[CACHE_QUEUE_GHOST].size <= cache->lists[CACHE_QUEUE_GHOST].limit;
+
+	for (size_t i = 0; i < cache->node_count && valid; i++) {
+		if (cache->nodes[i].value != NULL && seen[i] == CACHE_IMAGE_UNSEEN) {
+			valid = cache->policy == LRU_CACHE_POLICY_CLOCK;
+			seen[i] = CACHE_IMAGE_HELD;
+			held++;
+		}
+	}
+
+	size_t unused = 0;
+	uint32_t index = cache->free_list;
+	while (valid && index != LRU_CACHE_NIL) {
+		valid = index < cache->node_count && seen[index] == CACHE_IMAGE_UNSEEN && cache->nodes[index].value == NULL;
+		if (valid) {
+			seen[index] = CACHE_IMAGE_FREE;
+			unused++;
+			index = cache->nodes[index].next;
+		}
+	}
+
+	valid = valid && held + unused == cache->node_count;
+
+	// Walked from an empty slot, so run is the number of slots a probe passes on its way to this one
+	size_t slotCount = cache->slot_mask + 1;
+	size_t empty = 0;
+	while (empty < slotCount && cache->slots[empty] != 0) {
+		empty++;
+	}
+
+	valid = valid && empty < slotCount;
+
+	size_t run = 0;
+	size_t indexed = 0;
+	for (size_t step = 1; step <= slotCount && valid; step++) {
+		size_t position = (empty + step) & cache->slot_mask;
+		CacheSlot slot = cache->slots[position];
+		if (slot == 0) {
+			run = 0;
+			continue;
+		}
 
-	struct CacheNode *node = hashmap_get(cache->hashmap, x, z);
-	if(node != NULL) {
-		lru_cache_remove_from_list(cache, node);
-		lru_cache_move_to_head(cache, node);
+		run++;
+		uint32_t node = lru_cache_slot_node(slot);
+		uint32_t hash = lru_cache_slot_hash(slot);
+		valid = node < cache->node_count && seen[node] == CACHE_IMAGE_HELD &&
+			hash == lru_cache_hash(cache->nodes[node].x, cache->nodes[node].z) &&
+			((position - (hash & cache->slot_mask)) & cache->slot_mask) < run;
+		if (valid) {
+			seen[node] = CACHE_IMAGE_INDEXED;
+			indexed++;
+		}
+	}
+
+	free(seen);
+	return valid && indexed == held;
+}
+
+/**
+ * Starts a cache from a snapshot written by lru_cache_save. The file is
+ * mapped copy on write and the restored values point into the mapping, so
+ * no value is read or copied until it is used. Changing them leaves the file
+ * as it was. The capacity and policy of config have to be the ones the
+ * snapshot was saved with, the rest is taken from config. Epochs start over
+ * at 0. Returns NULL when the file cannot be mapped, does not match config
+ * or fails the checks of a truncated or corrupted snapshot.
+ *
+ * Restored values are handed to on_evict like any other, but they belong to
+ * the mapping, which lru_cache_destroy unmaps after its last on_evict call.
+ * lru_cache_is_mapped tells them apart from values put since.
+ */
+LRUCACHE *lru_cache_load(const char *path, const struct LRUCacheConfig *config) {
+	assert(path != NULL);
+	assert(config != NULL);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct CacheImageHeader)) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t imageSize = (size_t)info.st_size;
+	uint8_t *image = mmap(NULL, imageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps the file
+	if (image == MAP_FAILED) {
+		return NULL;
+	}
+
+	const struct CacheImageHeader *header = (const struct CacheImageHeader *)image;
+
+	// Every count has to fit in the file before the layout is worked out from them, so it cannot overflow
+	bool fits = header->node_count <= imageSize / sizeof(struct CacheNode) &&
+		header->slot_count <= imageSize / sizeof(CacheSlot) && header->sketch_size <= imageSize &&
+		header->value_size > 0 && header->size <= header->node_count &&
+		header->value_size <= imageSize / (header->size > 0 ? header->size : 1);
+
+	struct CacheImageLayout layout;
+	if (fits) {
+		lru_cache_image_layout(header, &layout);
+	}
+
+	LRUCACHE *cache = NULL;
+	if (fits && header->magic == LRU_CACHE_IMAGE_MAGIC && header->version == LRU_CACHE_IMAGE_VERSION &&
+		header->policy == (uint32_t)config->policy && header->max_capacity == config->capacity &&
+		layout.size <= imageSize) {
+		cache = lru_cache_create_with(config);
+	}
 
-		return node->value;
+	size_t sketchSize = cache != NULL && cache->sketch != NULL ? frequency_sketch_state_size(cache->sketch) : 0;
+	if (cache == NULL || cache->node_count != header->node_count || cache->slot_mask + 1 != header->slot_count ||
+		sketchSize != header->sketch_size) {
+		if (cache != NULL) {
+			lru_cache_destroy(cache);
+		}
+		munmap(image, imageSize);
+		return NULL;
+	}
+
+	memcpy(cache->nodes, image + layout.nodes, cache->node_count * sizeof(struct CacheNode));
+	memcpy(cache->slots, image + layout.slots, (cache->slot_mask + 1) * sizeof(CacheSlot));
+	memcpy(cache->costs, image + layout.costs, cache->node_count * sizeof(size_t));
+	memcpy(cache->referenced, image + layout.referenced, cache->node_count * sizeof(uint8_t));
+	memcpy(cache->queue, image + layout.queue, cache->node_count * sizeof(uint8_t));
+	for (size_t i = 0; i < cache->node_count; i++) {
+		atomic_store_explicit(&cache->states[i], image[layout.states + i], memory_order_relaxed);
+	}
+
+	// The limits follow from the capacity, the ones in the file are not trusted
+	for (int queue = 0; queue < CACHE_QUEUE_COUNT; queue++) {
+		size_t limit = cache->lists[queue].limit;
+		cache->lists[queue] = header->lists[queue];
+		cache->lists[queue].limit = limit;
+	}
+
+	cache->free_list = header->free_list;
+	cache->capacity = (size_t)header->capacity;
+	cache->size = (size_t)header->size;
+	cache->cost = (size_t)header->cost;
+	cache->hand = (size_t)header->hand;
+
+	if (!lru_cache_image_check(cache, &layout, (size_t)header->value_size)) {
+		cache->on_evict = NULL; // Nothing restored is the caller's
+		lru_cache_destroy(cache);
+		munmap(image, imageSize);
+		return NULL;
 	}
 
-	return NULL;
+	lru_cache_set_limits(cache);
+	if (cache->sketch != NULL) {
+		frequency_sketch_load_state(cache->sketch, image + layout.sketch);
+	}
+
+	// Offsets back to pointers
+	for (size_t i = 0; i < cache->node_count; i++) {
+		if (cache->nodes[i].value != NULL) {
+			cache->nodes[i].value = image + (uintptr_t)cache->nodes[i].value;
+		}
+	}
+
+	cache->image = image;
+	cache->image_size = imageSize;
+	return cache;
+}
+
+/** Returns true for a value restored by lru_cache_load, which must not be freed */
+bool lru_cache_is_mapped(LRUCACHE *cache, const void *value) {
+	assert(cache != NULL);
+
+	uintptr_t start = (uintptr_t)cache->image;
+	return cache->image != NULL && (uintptr_t)value >= start && (uintptr_t)value < start + cache->image_size;
 }
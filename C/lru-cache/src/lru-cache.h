@@ -3,14 +3,113 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "block-memory.h"
 
 typedef struct LRUCache LRUCACHE;
 
+/** Receives a value that left the cache, either evicted, replaced by a put or still cached at destroy */
+typedef void (*LRUCacheEvictFn)(int x, int z, void *value, void *userdata);
+
+enum LRUCachePolicy {
+	LRU_CACHE_POLICY_LRU,	 // Strict LRU, every hit moves the entry to the head of the recency list
+	LRU_CACHE_POLICY_CLOCK,	 // Second chance, a hit only sets a reference bit and eviction sweeps a clock hand
+	LRU_CACHE_POLICY_2Q,	 // New keys go through a FIFO and only keys put again soon after leaving it reach the LRU
+	LRU_CACHE_POLICY_TINYLFU // W-TinyLFU, a small LRU window in front of a segmented LRU guarded by a frequency sketch
+};
+
+struct LRUCacheConfig {
+	size_t capacity;
+	enum LRUCachePolicy policy;
+	LRUCacheEvictFn on_evict; // May be NULL
+	void *userdata;
+	bool deferred; // Queue evicted values instead of calling on_evict from inside lru_cache_put
+	size_t budget; // Limit on the sum of the costs given to lru_cache_put_cost, 0 only limits the entry count
+	enum BlockMemory memory; // Where the cache's block is allocated, BLOCK_MEMORY_DEFAULT uses plain malloc
+};
+
+struct LRUCacheKey {
+	int x, z;
+};
+
+struct LRUCachePinStats {
+	size_t pinned;		  // Values pinned right now
+	size_t skipped;		  // Pinned values eviction had to pass over
+	size_t skipping_puts; // Puts whose eviction passed over at least one pinned value
+};
+
+#define LRU_CACHE_PROBE_BUCKETS 16
+
+/** Only counted when the cache is built with LRU_CACHE_STATS */
+struct LRUCacheStats {
+	size_t hits;
+	size_t misses;
+	size_t inserts;
+	size_t updates; // Puts of a key that was already cached
+	size_t evictions;
+
+	size_t lookups; // Index probes, including the ones made by puts
+	size_t max_probe;
+	double average_probe;
+	size_t probe_histogram[LRU_CACHE_PROBE_BUCKETS]; // Bucket i counts probes of i + 1 slots, the last one all longer probes
+};
+
+struct LRUCacheEvicted {
+	int x, z;
+	void *value;
+};
+
+/** Load state of a cached chunk, see lru_cache_claim */
+enum LRUCacheState {
+	LRU_CACHE_UNLOADED, // Not cached
+	LRU_CACHE_LOADING,	// Claimed, a worker is generating the value and has not published it yet
+	LRU_CACHE_READY,
+	LRU_CACHE_DIRTY // Changed since it was generated, the next claim regenerates it
+};
+
+/** Returned by lru_cache_claim when the chunk is already loading or loaded */
+#define LRU_CACHE_NO_TICKET UINT32_MAX
+
 LRUCACHE* lru_cache_create(size_t capacity);
+LRUCACHE* lru_cache_create_with(const struct LRUCacheConfig *config);
 void lru_cache_destroy(LRUCACHE* cache);
 
 void lru_cache_put(LRUCACHE*cache, int x, int z, void* value);
 void* lru_cache_get(LRUCACHE*cache, int x, int z);
+void lru_cache_put_cost(LRUCACHE *cache, int x, int z, void *value, size_t cost);
+
+void lru_cache_resize(LRUCACHE *cache, size_t capacity, size_t budget);
+size_t lru_cache_size(LRUCACHE *cache);
+size_t lru_cache_cost(LRUCACHE *cache);
+size_t lru_cache_memory(LRUCACHE *cache);
+
+void lru_cache_set_epoch(LRUCACHE *cache, uint32_t epoch);
+size_t lru_cache_expire_older_than(LRUCACHE *cache, uint32_t epoch, size_t budget);
+void lru_cache_stats(LRUCACHE *cache, struct LRUCacheStats *stats);
+void lru_cache_stats_reset(LRUCACHE *cache);
+
+bool lru_cache_trace_start(LRUCACHE *cache, const char *path);
+bool lru_cache_trace_stop(LRUCACHE *cache);
+
+void* lru_cache_pin(LRUCACHE *cache, int x, int z);
+void lru_cache_unpin(LRUCACHE *cache, int x, int z);
+void lru_cache_pin_stats(LRUCACHE *cache, struct LRUCachePinStats *stats);
+
+uint32_t lru_cache_claim(LRUCACHE *cache, int x, int z, void *value);
+uint32_t lru_cache_prefetch(LRUCACHE *cache, int x, int z, void *value);
+void lru_cache_publish(LRUCACHE *cache, uint32_t ticket);
+enum LRUCacheState lru_cache_get_state(LRUCACHE *cache, int x, int z, void **value);
+bool lru_cache_mark_dirty(LRUCACHE *cache, int x, int z);
+
+size_t lru_cache_get_many(LRUCACHE *cache, const struct LRUCacheKey *keys, size_t count, void **values);
+void lru_cache_put_many(LRUCACHE *cache, const struct LRUCacheKey *keys, size_t count, void *const *values);
+
+size_t lru_cache_flush_evicted(LRUCACHE *cache);
+size_t lru_cache_take_evicted(LRUCACHE *cache, struct LRUCacheEvicted *out, size_t max);
+
+bool lru_cache_save(LRUCACHE *cache, const char *path, size_t valueSize);
+LRUCACHE *lru_cache_load(const char *path, const struct LRUCacheConfig *config);
+bool lru_cache_is_mapped(LRUCACHE *cache, const void *value);
 
 
 #endif
@@ -0,0 +1,316 @@
+/**
+ * Fused LRU hashmap. Every slot of the linear probing table is also a node of
+ * the recency list, linked by slot index. Removes use backward shift
+ * deletion, and every slot that moves patches its list neighbours, so there
+ * are no tombstones and no second structure to keep in sync.
+ *
+ * Building with -DLRU_CACHE_FUSED (make CACHE=fused) also defines the core
+ * lru_cache_* functions on top of this map, as a drop-in replacement for
+ * lru-cache.c.
+ */
+
+#include "lru-map.h"
+#include "hashmap.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LRU_MAP_EMPTY UINT32_MAX	   // prev of a slot that holds no entry
+#define LRU_MAP_NIL	  (UINT32_MAX - 1) // End of the recency list
+
+struct LRUMapSlot {
+	int x, z;
+	void *value;
+	uint32_t prev;
+	uint32_t next;
+};
+
+struct LRUMap {
+	struct LRUMapSlot *slots;
+	size_t mask;
+	size_t capacity;
+	size_t size;
+
+	uint32_t head;
+	uint32_t tail;
+
+	LRUCacheEvictFn on_evict;
+	void *userdata;
+	enum BlockMemory memory;
+	size_t block_size;
+};
+
+LRUMAP *lru_map_create(const struct LRUCacheConfig *config) {
+	assert(config != NULL);
+	assert(config->capacity > 1 && "Cache capacity cannot be less then 1");
+
+	size_t slot_count = 1;
+	while (slot_count < config->capacity * 2) {
+		slot_count <<= 1;
+	}
+	assert(slot_count < LRU_MAP_NIL && "Slot count must fit a 32 bit index");
+
+	// The slots are not padded, an aligned block only starts them on a cache line
+	size_t slotsOffset = block_memory_align(config->memory, sizeof(LRUMAP));
+	size_t blockSize = slotsOffset + slot_count * sizeof(struct LRUMapSlot);
+	char *block = block_memory_alloc(config->memory, blockSize);
+	if (block == NULL) {
+		return NULL;
+	}
+
+	LRUMAP *map = (LRUMAP *)block;
+	memset(map, 0, sizeof(LRUMAP));
+
+	// All bits set marks every slot as LRU_MAP_EMPTY
+	map->slots = (struct LRUMapSlot *)(block + slotsOffset);
+	memset(map->slots, 0xFF, slot_count * sizeof(struct LRUMapSlot));
+
+	map->mask = slot_count - 1;
+	map->capacity = config->capacity;
+	map->head = LRU_MAP_NIL;
+	map->tail = LRU_MAP_NIL;
+	map->on_evict = config->on_evict;
+	map->userdata = config->userdata;
+	map->memory = config->memory;
+	map->block_size = blockSize;
+
+	return map;
+}
+
+void lru_map_destroy(LRUMAP *map) {
+	assert(map != NULL);
+
+	if (map->on_evict != NULL) {
+		for (uint32_t index = map->head; index != LRU_MAP_NIL; index = map->slots[index].next) {
+			struct LRUMapSlot *slot = &map->slots[index];
+			map->on_evict(slot->x, slot->z, slot->value, map->userdata);
+		}
+	}
+
+	block_memory_free(map->memory, map, map->block_size);
+}
+
+static inline void lru_map_unlink(LRUMAP *map, uint32_t index) {
+	struct LRUMapSlot *slot = &map->slots[index];
+
+	if (slot->prev != LRU_MAP_NIL) {
+		map->slots[slot->prev].next = slot->next;
+	} else {
+		map->head = slot->next;
+	}
+
+	if (slot->next != LRU_MAP_NIL) {
+		map->slots[slot->next].prev = slot->prev;
+	} else {
+		map->tail = slot->prev;
+	}
+}
+
+static inline void lru_map_link_head(LRUMAP *map, uint32_t index) {
+	struct LRUMapSlot *slot = &map->slots[index];
+
+	slot->prev = LRU_MAP_NIL;
+	slot->next = map->head;
+
+	if (map->head != LRU_MAP_NIL) {
+		map->slots[map->head].prev = index;
+	}
+
+	map->head = index;
+
+	if (map->tail == LRU_MAP_NIL) {
+		map->tail = index;
+	}
+}
+
+static inline void lru_map_touch(LRUMAP *map, uint32_t index) {
+	if (map->head != index) {
+		lru_map_unlink(map, index);
+		lru_map_link_head(map, index);
+	}
+}
+
+/** Moves an occupied slot into an empty one and points its list neighbours at the new position */
+static inline void lru_map_move(LRUMAP *map, size_t from, size_t to) {
+	struct LRUMapSlot *slot = &map->slots[to];
+	*slot = map->slots[from];
+
+	if (slot->prev != LRU_MAP_NIL) {
+		map->slots[slot->prev].next = (uint32_t)to;
+	} else {
+		map->head = (uint32_t)to;
+	}
+
+	if (slot->next != LRU_MAP_NIL) {
+		map->slots[slot->next].prev = (uint32_t)to;
+	} else {
+		map->tail = (uint32_t)to;
+	}
+}
+
+/**
+ * Evicts the least recently used entry and closes the gap it leaves with
+ * backward shift deletion. Returns the slot that ended up empty.
+ */
+static size_t lru_map_evict(LRUMAP *map) {
+	assert(map->tail != LRU_MAP_NIL);
+
+	size_t hole = map->tail;
+	struct LRUMapSlot victim = map->slots[hole];
+
+	lru_map_unlink(map, (uint32_t)hole);
+	map->slots[hole].prev = LRU_MAP_EMPTY;
+	map->size--;
+
+	size_t index = (hole + 1) & map->mask;
+	while (map->slots[index].prev != LRU_MAP_EMPTY) {
+		struct LRUMapSlot *slot = &map->slots[index];
+		size_t home = hashmap_hash_coords(slot->x, slot->z) & map->mask;
+
+		// The slot can only move back if its home is at or before the hole
+		if (((index - home) & map->mask) >= ((index - hole) & map->mask)) {
+			lru_map_move(map, index, hole);
+			slot->prev = LRU_MAP_EMPTY;
+			hole = index;
+		}
+
+		index = (index + 1) & map->mask;
+	}
+
+	if (map->on_evict != NULL) {
+		map->on_evict(victim.x, victim.z, victim.value, map->userdata);
+	}
+
+	return hole;
+}
+
+void **lru_map_entry(LRUMAP *map, int x, int z, bool *found) {
+	assert(map != NULL && found != NULL);
+
+	size_t home = hashmap_hash_coords(x, z) & map->mask;
+	size_t index = home;
+
+	while (map->slots[index].prev != LRU_MAP_EMPTY) {
+		struct LRUMapSlot *slot = &map->slots[index];
+		if (slot->x == x && slot->z == z) {
+			lru_map_touch(map, (uint32_t)index);
+			*found = true;
+			return &slot->value;
+		}
+
+		index = (index + 1) & map->mask;
+	}
+
+	// Miss, the first empty slot of the run is where the key goes. Unless an
+	// eviction shifts the run and opens up an earlier slot.
+	if (map->size == map->capacity) {
+		size_t hole = lru_map_evict(map);
+		if (((hole - home) & map->mask) < ((index - home) & map->mask)) {
+			index = hole;
+		}
+	}
+
+	struct LRUMapSlot *slot = &map->slots[index];
+	slot->x = x;
+	slot->z = z;
+	slot->value = NULL;
+	lru_map_link_head(map, (uint32_t)index);
+	map->size++;
+
+	*found = false;
+	return &slot->value;
+}
+
+void lru_map_put(LRUMAP *map, int x, int z, void *value) {
+	assert(map != NULL);
+	assert(value != NULL);
+
+	bool found = false;
+	void **entry = lru_map_entry(map, x, z, &found);
+
+	if (found && *entry != value && map->on_evict != NULL) {
+		map->on_evict(x, z, *entry, map->userdata);
+	}
+
+	*entry = value;
+}
+
+void *lru_map_get(LRUMAP *map, int x, int z) {
+	assert(map != NULL);
+
+	size_t index = hashmap_hash_coords(x, z) & map->mask;
+
+	while (map->slots[index].prev != LRU_MAP_EMPTY) {
+		struct LRUMapSlot *slot = &map->slots[index];
+		if (slot->x == x && slot->z == z) {
+			lru_map_touch(map, (uint32_t)index);
+			return slot->value;
+		}
+
+		index = (index + 1) & map->mask;
+	}
+
+	return NULL;
+}
+
+size_t lru_map_size(LRUMAP *map) {
+	assert(map != NULL);
+	return map->size;
+}
+
+#ifdef LRU_CACHE_FUSED
+
+//
+// Drop-in core LRU cache API backed by the fused map
+//
+
+struct LRUCache {
+	LRUMAP *map;
+};
+
+LRUCACHE *lru_cache_create(size_t capacity) {
+	struct LRUCacheConfig config = {
+		.capacity = capacity,
+	};
+
+	return lru_cache_create_with(&config);
+}
+
+LRUCACHE *lru_cache_create_with(const struct LRUCacheConfig *config) {
+	assert(config != NULL);
+	assert(config->policy == LRU_CACHE_POLICY_LRU && "The fused cache only implements strict LRU");
+	assert(!config->deferred && "The fused cache only releases evicted values immediately");
+
+	LRUCACHE *cache = malloc(sizeof(LRUCACHE));
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	cache->map = lru_map_create(config);
+	if (cache->map == NULL) {
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void lru_cache_destroy(LRUCACHE *cache) {
+	assert(cache != NULL);
+
+	lru_map_destroy(cache->map);
+	free(cache);
+}
+
+void lru_cache_put(LRUCACHE *cache, int x, int z, void *value) {
+	assert(cache != NULL);
+	lru_map_put(cache->map, x, z, value);
+}
+
+void *lru_cache_get(LRUCACHE *cache, int x, int z) {
+	assert(cache != NULL);
+	return lru_map_get(cache->map, x, z);
+}
+
+#endif
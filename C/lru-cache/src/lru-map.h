@@ -0,0 +1,33 @@
+#ifndef LRU_MAP_H
+#define LRU_MAP_H 1
+
+#include "lru-cache.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct LRUMap LRUMAP;
+
+/**
+ * Fused LRU cache: the open addressed slots are the recency list nodes, so a
+ * lookup, a put on miss and the eviction it causes share one probe sequence.
+ *
+ * Only config->capacity, on_evict and userdata are used. Eviction is always
+ * strict LRU and immediate.
+ */
+LRUMAP *lru_map_create(const struct LRUCacheConfig *config);
+void lru_map_destroy(LRUMAP *map);
+
+/**
+ * Finds the entry for (x, z) or claims a slot for it, evicting the least
+ * recently used entry when the map is full. Either way the entry becomes the
+ * most recently used one. A new entry's value is NULL and must be set to a
+ * non NULL value before the map is used again. The pointer is only valid
+ * until the next call into the map.
+ */
+void **lru_map_entry(LRUMAP *map, int x, int z, bool *found);
+
+void lru_map_put(LRUMAP *map, int x, int z, void *value);
+void *lru_map_get(LRUMAP *map, int x, int z);
+size_t lru_map_size(LRUMAP *map);
+
+#endif
@@ -0,0 +1,187 @@
+/**
+ * Reader for the access logs lru-cache.c records with LRU_CACHE_TRACE. The
+ * file is read through a buffer of its own, the records are small enough
+ * that going through stdio for every byte would dominate decoding.
+ */
+
+#include "lru-trace.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LRU_TRACE_READ_BUFFER (64 * 1024)
+
+struct LRUTrace {
+	FILE *file;
+	struct LRUTraceHeader header;
+	int x, z; // Coordinates of the previous record
+	bool failed;
+
+	size_t position;
+	size_t length;
+	uint8_t buffer[LRU_TRACE_READ_BUFFER];
+};
+
+/** Next byte of the log, or -1 at the end of the file */
+static int lru_trace_byte(LRUTRACE *trace) {
+	if (trace->position == trace->length) {
+		trace->length = fread(trace->buffer, 1, sizeof(trace->buffer), trace->file);
+		trace->position = 0;
+
+		if (trace->length == 0) {
+			return -1;
+		}
+	}
+
+	return trace->buffer[trace->position++];
+}
+
+static bool lru_trace_varint(LRUTRACE *trace, uint64_t *value) {
+	*value = 0;
+
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		int byte = lru_trace_byte(trace);
+		if (byte < 0) {
+			return false;
+		}
+
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool lru_trace_coordinate(LRUTRACE *trace, unsigned int code, int *coordinate) {
+	switch (code) {
+	case LRU_TRACE_DELTA_ZERO:
+		return true;
+	case LRU_TRACE_DELTA_PLUS:
+		*coordinate += 1;
+		return true;
+	case LRU_TRACE_DELTA_MINUS:
+		*coordinate -= 1;
+		return true;
+	default: {
+		uint64_t zigzag;
+		if (!lru_trace_varint(trace, &zigzag)) {
+			return false;
+		}
+
+		int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+		*coordinate = (int)((int64_t)*coordinate + delta);
+		return true;
+	}
+	}
+}
+
+LRUTRACE *lru_trace_open(const char *path) {
+	assert(path != NULL);
+
+	LRUTRACE *trace = calloc(1, sizeof(LRUTRACE));
+	if (trace == NULL) {
+		return NULL;
+	}
+
+	trace->file = fopen(path, "rb");
+	if (trace->file == NULL) {
+		free(trace);
+		return NULL;
+	}
+
+	char magic[sizeof(LRU_TRACE_MAGIC) - 1];
+	for (size_t i = 0; i < sizeof(magic); i++) {
+		magic[i] = (char)lru_trace_byte(trace);
+	}
+
+	uint64_t capacity, budget;
+	int version = lru_trace_byte(trace);
+	bool valid = memcmp(magic, LRU_TRACE_MAGIC, sizeof(magic)) == 0 && version == LRU_TRACE_VERSION &&
+		lru_trace_varint(trace, &capacity) && lru_trace_varint(trace, &budget);
+
+	int policy = valid ? lru_trace_byte(trace) : -1;
+	if (policy < LRU_CACHE_POLICY_LRU || policy > LRU_CACHE_POLICY_TINYLFU) {
+		lru_trace_close(trace);
+		return NULL;
+	}
+
+	trace->header.capacity = (size_t)capacity;
+	trace->header.budget = (size_t)budget;
+	trace->header.policy = (enum LRUCachePolicy)policy;
+
+	return trace;
+}
+
+void lru_trace_close(LRUTRACE *trace) {
+	assert(trace != NULL);
+
+	fclose(trace->file);
+	free(trace);
+}
+
+const struct LRUTraceHeader *lru_trace_header(const LRUTRACE *trace) {
+	assert(trace != NULL);
+
+	return &trace->header;
+}
+
+bool lru_trace_next(LRUTRACE *trace, struct LRUTraceRecord *record) {
+	assert(trace != NULL);
+	assert(record != NULL);
+
+	if (trace->failed) {
+		return false;
+	}
+
+	int tag = lru_trace_byte(trace);
+	if (tag < 0) {
+		return false;
+	}
+
+	memset(record, 0, sizeof(*record));
+
+	if (tag == LRU_TRACE_TAG_RESIZE) {
+		uint64_t capacity, budget;
+		if (!lru_trace_varint(trace, &capacity) || !lru_trace_varint(trace, &budget)) {
+			trace->failed = true;
+			return false;
+		}
+
+		record->op = LRU_TRACE_RESIZE;
+		record->capacity = (size_t)capacity;
+		record->cost = (size_t)budget;
+		return true;
+	}
+
+	if ((tag & LRU_TRACE_TAG_RESIZE) != 0 ||
+		!lru_trace_coordinate(trace, ((unsigned int)tag >> LRU_TRACE_X_SHIFT) & 3, &trace->x) ||
+		!lru_trace_coordinate(trace, ((unsigned int)tag >> LRU_TRACE_Z_SHIFT) & 3, &trace->z)) {
+		trace->failed = true;
+		return false;
+	}
+
+	record->op = (enum LRUTraceOp)(tag & LRU_TRACE_OP_MASK);
+	record->x = trace->x;
+	record->z = trace->z;
+
+	if ((tag & LRU_TRACE_COST) != 0) {
+		uint64_t cost;
+		if (!lru_trace_varint(trace, &cost)) {
+			trace->failed = true;
+			return false;
+		}
+
+		record->cost = (size_t)cost;
+	}
+
+	return true;
+}
+
+bool lru_trace_failed(const LRUTRACE *trace) {
+	assert(trace != NULL);
+
+	return trace->failed;
+}
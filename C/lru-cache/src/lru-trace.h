@@ -0,0 +1,74 @@
+#ifndef LRU_TRACE_H
+#define LRU_TRACE_H 1
+
+#include "lru-cache.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Access logs written by lru_cache_trace_start. A log starts with the magic,
+ * a version byte, the capacity and budget as varints and the policy byte.
+ * Every record then starts with a tag byte:
+ *
+ *   bits 0-1  operation: get, put, pin or unpin
+ *   bits 2-3  x delta from the previous record: 0, +1, -1 or a zigzag varint
+ *   bits 4-5  z delta, the same way
+ *   bit  6    a put cost follows as a varint
+ *
+ * Walking a spiral moves one chunk at a time and a put follows the get that
+ * missed on the same key, so most records are the tag byte alone. The tag
+ * LRU_TRACE_TAG_RESIZE is followed by the new capacity and budget.
+ */
+
+#define LRU_TRACE_MAGIC	  "LRUT"
+#define LRU_TRACE_VERSION 1
+
+#define LRU_TRACE_OP_MASK	   0x03
+#define LRU_TRACE_DELTA_ZERO   0
+#define LRU_TRACE_DELTA_PLUS   1
+#define LRU_TRACE_DELTA_MINUS  2
+#define LRU_TRACE_DELTA_VARINT 3
+#define LRU_TRACE_X_SHIFT	   2
+#define LRU_TRACE_Z_SHIFT	   4
+#define LRU_TRACE_COST		   0x40
+#define LRU_TRACE_TAG_RESIZE   0x80
+
+#define LRU_TRACE_MAX_RECORD 21 // Tag, two 5 byte coordinate varints and a 10 byte cost
+
+enum LRUTraceOp {
+	LRU_TRACE_GET,
+	LRU_TRACE_PUT,
+	LRU_TRACE_PIN,
+	LRU_TRACE_UNPIN,
+	LRU_TRACE_RESIZE
+};
+
+struct LRUTraceHeader {
+	size_t capacity;
+	size_t budget;
+	enum LRUCachePolicy policy;
+};
+
+struct LRUTraceRecord {
+	enum LRUTraceOp op;
+	int x, z;
+	size_t cost; // Put cost, or the new budget of a resize
+	size_t capacity; // New capacity of a resize
+};
+
+typedef struct LRUTrace LRUTRACE;
+
+/** Opens a log for reading. Returns NULL when it cannot be opened or does not start with a valid header. */
+LRUTRACE *lru_trace_open(const char *path);
+void lru_trace_close(LRUTRACE *trace);
+
+const struct LRUTraceHeader *lru_trace_header(const LRUTRACE *trace);
+
+/** Decodes the next record. Returns false at the end of the log or when the rest of it is malformed. */
+bool lru_trace_next(LRUTRACE *trace, struct LRUTraceRecord *record);
+
+/** True once lru_trace_next stopped on a malformed or truncated record rather than the end of the log */
+bool lru_trace_failed(const LRUTRACE *trace);
+
+#endif
@@ -1,19 +1,78 @@
+// nanosleep is POSIX, not part of -std=c11
+#define _POSIX_C_SOURCE 200809L
+
+#include "chunk-prefetch.h"
+#include "chunk-store.h"
 #include "lru-cache.h"
+#include "term-frame.h"
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
 #include <math.h>
 
+#ifndef LRU_CACHE_FUSED
+#include <pthread.h>
+#include <stdint.h>
+#endif
+
 #define CIRCLE_RADIUS 50.0f
 
 #define VISUAL_RADIUS 10
+#define SCREEN_HUD_ROWS 4 // Position readout above the grid
+#define SCREEN_ROWS		(SCREEN_HUD_ROWS + VISUAL_RADIUS * 2 + 1)
+#define SCREEN_COLS		((VISUAL_RADIUS * 2 + 1) * 2 + 8)
 
 #define CHUNK_WIDTH		   16
 #define CHUNK_HEIGHT	   128
 #define CHUNK_CACHE_MARGIN 2
 
+#define CHUNK_WORKERS		  2
+#define CHUNK_JOBS			  16   // Chunks claimed at once, well below the cache capacity so eviction always finds one unpinned
+#define CHUNK_PREFETCH_JOBS	  8	   // Prefetches only go out while fewer chunks than this are in flight
+#define CHUNK_PREFETCH_FRAMES 8	   // How far ahead the prefetcher predicts the player
+#define CHUNK_GENERATE_US	  2000 // Pretend generation is this slow
+#define CHUNK_EDIT_FRAMES	  25   // The player digs into the chunk they stand on this often
+#define CHUNK_DIG_DEPTH		  8
+
+struct Chunk {
+	unsigned char heights[CHUNK_WIDTH][CHUNK_WIDTH];
+};
+
+#ifndef LRU_CACHE_FUSED
+struct ChunkJob {
+	int x, z;
+	struct Chunk *chunk;
+	uint32_t ticket;
+	bool regenerate; // Dirty, generated again with the player's edit
+};
+
+/** Workers take every visible chunk before any prefetched one */
+enum ChunkPriority {
+	CHUNK_PRIORITY_VISIBLE,
+	CHUNK_PRIORITY_PREFETCH,
+	CHUNK_PRIORITY_COUNT
+};
+
+/** Generates claimed chunks off the main thread, the frame loop only queues jobs */
+struct ChunkWorkers {
+	pthread_t threads[CHUNK_WORKERS];
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+
+	struct ChunkJob jobs[CHUNK_PRIORITY_COUNT][CHUNK_JOBS];
+	size_t head[CHUNK_PRIORITY_COUNT];	 // Next job to hand out
+	size_t queued[CHUNK_PRIORITY_COUNT]; // Jobs waiting for a worker
+	size_t pending;						 // Jobs queued or being generated
+	bool stop;
+
+	LRUCACHE *cache;
+	CHUNKSTORE *store;
+};
+#endif
+
 struct Game {
 	struct {
 		float x;
@@ -25,10 +84,16 @@ struct Game {
 	int simulationDistance;
 
 	LRUCACHE *chunkCache;
+	CHUNKSTORE *chunkStore;
+	const char *regionPath; // Edited chunks are kept here across runs, NULL keeps them in a temporary file
+
+#ifndef LRU_CACHE_FUSED
+	struct ChunkWorkers workers;
+	CHUNKPREFETCH *prefetch;
+	struct LRUCacheKey *planned;
+#endif
 };
 
-#define GOTO(row, col) printf("\033[%d;%dH", (row), (col))
-#define CLEAR()		   printf("\033[2J")
 #define HIDE_CURSOR()  printf("\033[?25l")
 #define SHOW_CURSOR()  printf("\033[?25h")
 #define RESET_COLOR()  printf("\033[0m")
@@ -39,55 +104,42 @@ typedef enum {
 	CHUNK_COLOR_LOADED,
 	CHUNK_COLOR_UNLOADED,
 	CHUNK_COLOR_PENDING,
-	CHUNK_COLOR_ERROR
+	CHUNK_COLOR_ERROR,
+	CHUNK_COLOR_EMPTY, // Grid cell outside the render distance
+	CHUNK_COLOR_TEXT,
+	CHUNK_COLOR_COUNT
 } ChunkColor;
 
 /**
- * Returns ANSI color codes for the chosen chunk color.
+ * ANSI color codes of every chunk color, the framebuffer's style palette.
  * Uses bright foregrounds with dark or high-contrast backgrounds.
  */
-static inline const char *get_chunk_color(ChunkColor color) {
-	switch (color) {
-	case CHUNK_COLOR_PLAYER:
-		return "\033[1;30;46m"; // bright black on cyan
-	case CHUNK_COLOR_ACTIVE:
-		return "\033[1;37;42m"; // white on green
-	case CHUNK_COLOR_LOADED:
-		return "\033[1;30;43m"; // black on yellow
-	case CHUNK_COLOR_UNLOADED:
-		return "\033[1;37;40m"; // white on black
-	case CHUNK_COLOR_PENDING:
-		return "\033[1;30;44m"; // black on blue
-	case CHUNK_COLOR_ERROR:
-		return "\033[1;37;41m"; // white on red
-	default:
-		return "\033[0m"; // reset
-	}
-}
+static const char *const chunk_colors[CHUNK_COLOR_COUNT] = {
+	[CHUNK_COLOR_PLAYER] = "\033[1;30;46m",   // bright black on cyan
+	[CHUNK_COLOR_ACTIVE] = "\033[1;37;42m",   // white on green
+	[CHUNK_COLOR_LOADED] = "\033[1;30;43m",   // black on yellow
+	[CHUNK_COLOR_UNLOADED] = "\033[1;37;40m", // white on black
+	[CHUNK_COLOR_PENDING] = "\033[1;30;44m",  // black on blue
+	[CHUNK_COLOR_ERROR] = "\033[1;37;41m",	  // white on red
+	[CHUNK_COLOR_EMPTY] = "\033[47m",		  // white background
+	[CHUNK_COLOR_TEXT] = "\033[0m",			  // reset
+};
 
 /**
- * Draws a grid centered around the player (radius defines how far out).
- * Example: radius=2 produces a 5x5 grid of blank cells.
+ * Draws a grid of blank cells centered around the player into the back buffer.
+ * Example: a radius of 2 produces a 5x5 grid.
  */
-void draw_grid(void) {
-	CLEAR();
-
-	for (int z = -VISUAL_RADIUS; z <= VISUAL_RADIUS; z++) {
-		for (int x = -VISUAL_RADIUS; x <= VISUAL_RADIUS; x++) {
-			GOTO(z + VISUAL_RADIUS + 2, (x + VISUAL_RADIUS) * 2 + 2);
-
-			// Mark the world origin (0,0)
-			if (x == 0 && z == 0) {
-				printf("\033[1;37;41m●\033[0m"); // red dot
-			} else {
-				printf("\033[47m  \033[0m"); // normal empty cell
-			}
+void draw_grid(TERMFRAME *screen) {
+	for (int z = 0; z < VISUAL_RADIUS * 2 + 1; z++) {
+		for (int x = 0; x < (VISUAL_RADIUS * 2 + 1) * 2; x++) {
+			term_frame_put(screen, SCREEN_HUD_ROWS + z, x + 1, " ", CHUNK_COLOR_EMPTY);
 		}
 	}
-	fflush(stdout);
 }
 
-void draw_chunk_state(int chunkX, int chunkZ, ChunkColor color, char label, int playerChunkX, int playerChunkZ) {
+/** Draws a chunk's two column cell into the back buffer, nothing when it is outside the visual field */
+void draw_chunk_state(TERMFRAME *screen, int chunkX, int chunkZ, ChunkColor color, char label, int playerChunkX,
+	int playerChunkZ) {
 	// Relative to player
 	int relX = chunkX - playerChunkX;
 	int relZ = chunkZ - playerChunkZ;
@@ -96,22 +148,317 @@ void draw_chunk_state(int chunkX, int chunkZ, ChunkColor color, char label, int
 		return; // out of visual field
 	}
 
-	GOTO(relZ + VISUAL_RADIUS + 2, (relX + VISUAL_RADIUS) * 2 + 2);
-	printf("%s%c \033[0m", get_chunk_color(color), label);
-	fflush(stdout);
+	int row = SCREEN_HUD_ROWS + relZ + VISUAL_RADIUS;
+	int col = (relX + VISUAL_RADIUS) * 2 + 1;
+	term_frame_put(screen, row, col, (char[]){label, '\0'}, (uint8_t)color);
+	term_frame_put(screen, row, col + 1, " ", (uint8_t)color);
+}
+
+static void chunk_generate(struct Chunk *chunk, int chunkX, int chunkZ) {
+	struct timespec delay = {0, CHUNK_GENERATE_US * 1000L};
+	nanosleep(&delay, NULL);
+
+	for (int z = 0; z < CHUNK_WIDTH; z++) {
+		for (int x = 0; x < CHUNK_WIDTH; x++) {
+			float blockX = (float)(chunkX * CHUNK_WIDTH + x);
+			float blockZ = (float)(chunkZ * CHUNK_WIDTH + z);
+			float height = (sinf(blockX * 0.05F) + cosf(blockZ * 0.05F) + 2.0F) * 0.25F * (CHUNK_HEIGHT - 1);
+			chunk->heights[z][x] = (unsigned char)height;
+		}
+	}
+}
+
+/** The player's edit, a pit in the middle of the chunk */
+static void chunk_dig(struct Chunk *chunk) {
+	for (int z = CHUNK_WIDTH / 4; z < CHUNK_WIDTH * 3 / 4; z++) {
+		for (int x = CHUNK_WIDTH / 4; x < CHUNK_WIDTH * 3 / 4; x++) {
+			unsigned char height = chunk->heights[z][x];
+			chunk->heights[z][x] = height > CHUNK_DIG_DEPTH ? (unsigned char)(height - CHUNK_DIG_DEPTH) : 0;
+		}
+	}
+}
+
+static void chunk_free(int x, int z, void *value, void *userdata) {
+	(void)x;
+	(void)z;
+	(void)userdata;
+
+	free(value);
+}
+
+#ifdef LRU_CACHE_FUSED
+/** The fused cache has no load states, so chunks are loaded or generated on the spot */
+static void chunk_streaming_start(struct Game *game, size_t capacity) {
+	game->chunkStore = chunk_store_open(game->regionPath, sizeof(struct Chunk), chunk_free, NULL);
+	assert(game->chunkStore != NULL && "Region file failed to open.");
+
+	struct LRUCacheConfig config = {
+		.capacity = capacity,
+		.on_evict = chunk_store_evict,
+		.userdata = game->chunkStore,
+	};
+
+	game->chunkCache = lru_cache_create_with(&config);
+}
+
+static void chunk_streaming_stop(struct Game *game) {
+	lru_cache_destroy(game->chunkCache);
+	if (!chunk_store_close(game->chunkStore)) {
+		fprintf(stderr, "Some edited chunks could not be written to the region file\n");
+	}
+}
+
+/** Generating on the spot leaves nothing to prefetch */
+static void chunk_prefetch_stage(struct Game *game) {
+	(void)game;
+}
+
+static ChunkColor chunk_request(struct Game *game, int chunkX, int chunkZ, char *label) {
+	if (lru_cache_get(game->chunkCache, chunkX, chunkZ) != NULL) {
+		*label = 'L';
+		return CHUNK_COLOR_LOADED;
+	}
+
+	struct Chunk *chunk = malloc(sizeof(struct Chunk));
+	assert(chunk != NULL && "Chunk failed to allocate.");
+	if (!chunk_store_load(game->chunkStore, chunkX, chunkZ, chunk)) {
+		chunk_generate(chunk, chunkX, chunkZ);
+		chunk_store_mark_clean(game->chunkStore, chunkX, chunkZ, chunk);
+	}
+	lru_cache_put(game->chunkCache, chunkX, chunkZ, chunk);
+
+	*label = '?';
+	return CHUNK_COLOR_PENDING;
+}
+
+/** Edits a cached chunk in place, returns false when it is not cached */
+static bool chunk_edit(struct Game *game, int chunkX, int chunkZ) {
+	struct Chunk *chunk = lru_cache_get(game->chunkCache, chunkX, chunkZ);
+	if (chunk == NULL) {
+		return false;
+	}
+
+	chunk_dig(chunk);
+	chunk_store_mark_dirty(game->chunkStore, chunkX, chunkZ);
+	return true;
+}
+#else
+static void *chunk_worker(void *arg) {
+	struct ChunkWorkers *workers = arg;
+
+	pthread_mutex_lock(&workers->lock);
+	for (;;) {
+		while (workers->queued[CHUNK_PRIORITY_VISIBLE] + workers->queued[CHUNK_PRIORITY_PREFETCH] == 0 &&
+			!workers->stop) {
+			pthread_cond_wait(&workers->wake, &workers->lock);
+		}
+
+		// Jobs still queued are finished first, a claimed chunk left ungenerated would be written to the region file
+		if (workers->queued[CHUNK_PRIORITY_VISIBLE] + workers->queued[CHUNK_PRIORITY_PREFETCH] == 0) {
+			break;
+		}
+
+		int priority = workers->queued[CHUNK_PRIORITY_VISIBLE] > 0 ? CHUNK_PRIORITY_VISIBLE : CHUNK_PRIORITY_PREFETCH;
+		struct ChunkJob job = workers->jobs[priority][workers->head[priority]];
+		workers->head[priority] = (workers->head[priority] + 1) % CHUNK_JOBS;
+		workers->queued[priority]--;
+		pthread_mutex_unlock(&workers->lock);
+
+		// The claim keeps the chunk cached and every other thread away from it until it is published
+		// Only the edit has to be written back, a chunk generated as is comes out the same next time
+		if (job.regenerate) {
+			chunk_generate(job.chunk, job.x, job.z);
+			chunk_dig(job.chunk);
+			chunk_store_mark_dirty(workers->store, job.x, job.z);
+		} else if (!chunk_store_load(workers->store, job.x, job.z, job.chunk)) {
+			chunk_generate(job.chunk, job.x, job.z);
+			chunk_store_mark_clean(workers->store, job.x, job.z, job.chunk);
+		}
+		lru_cache_publish(workers->cache, job.ticket);
+
+		pthread_mutex_lock(&workers->lock);
+		workers->pending--;
+	}
+	pthread_mutex_unlock(&workers->lock);
+
+	return NULL;
+}
+
+static void chunk_streaming_start(struct Game *game, size_t capacity) {
+	game->chunkStore = chunk_store_open(game->regionPath, sizeof(struct Chunk), chunk_free, NULL);
+	assert(game->chunkStore != NULL && "Region file failed to open.");
+
+	struct LRUCacheConfig config = {
+		.capacity = capacity,
+		.on_evict = chunk_store_evict,
+		.userdata = game->chunkStore,
+	};
+
+	game->chunkCache = lru_cache_create_with(&config);
+	assert(game->chunkCache != NULL && "Chunk cache failed to allocate.");
+
+	struct ChunkWorkers *workers = &game->workers;
+	workers->cache = game->chunkCache;
+	workers->store = game->chunkStore;
+	pthread_mutex_init(&workers->lock, NULL);
+	pthread_cond_init(&workers->wake, NULL);
+
+	for (int i = 0; i < CHUNK_WORKERS; i++) {
+		int result = pthread_create(&workers->threads[i], NULL, chunk_worker, workers);
+		assert(result == 0 && "Chunk worker failed to start.");
+		(void)result;
+	}
+
+	int side = game->renderDistance * 2 + 1;
+	game->prefetch = chunk_prefetch_create(CHUNK_PREFETCH_FRAMES);
+	game->planned = malloc((size_t)side * (size_t)side * sizeof(struct LRUCacheKey));
+	assert(game->prefetch != NULL && game->planned != NULL && "Chunk prefetcher failed to allocate.");
+}
+
+/** Stops the workers before the cache goes, a chunk still being generated must not be freed or written under them */
+static void chunk_streaming_stop(struct Game *game) {
+	struct ChunkWorkers *workers = &game->workers;
+
+	pthread_mutex_lock(&workers->lock);
+	workers->stop = true;
+	pthread_cond_broadcast(&workers->wake);
+	pthread_mutex_unlock(&workers->lock);
+
+	for (int i = 0; i < CHUNK_WORKERS; i++) {
+		pthread_join(workers->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&workers->wake);
+	pthread_mutex_destroy(&workers->lock);
+
+	// Every chunk left goes through the store, which writes the dirty ones before it closes
+	lru_cache_destroy(game->chunkCache);
+	if (!chunk_store_close(game->chunkStore)) {
+		fprintf(stderr, "Some edited chunks could not be written to the region file\n");
+	}
+	chunk_prefetch_destroy(game->prefetch);
+	free(game->planned);
+}
+
+/**
+ * Queues generation of an unloaded or dirty chunk, or of an unloaded one
+ * ahead of the player at prefetch priority. Returns false when enough
+ * chunks of that priority are in flight already.
+ *
+ * The claim runs outside the workers lock, the eviction it may cause can
+ * block in the store, so a job slot is reserved before and filled after.
+ */
+static bool chunk_queue(struct Game *game, int chunkX, int chunkZ, struct Chunk *chunk, enum ChunkPriority priority) {
+	struct ChunkWorkers *workers = &game->workers;
+
+	pthread_mutex_lock(&workers->lock);
+	bool room = workers->pending < (priority == CHUNK_PRIORITY_VISIBLE ? CHUNK_JOBS : CHUNK_PREFETCH_JOBS);
+	workers->pending += room;
+	pthread_mutex_unlock(&workers->lock);
+
+	if (!room) {
+		return false;
+	}
+
+	struct Chunk *storage = chunk != NULL ? chunk : malloc(sizeof(struct Chunk));
+	assert(storage != NULL && "Chunk failed to allocate.");
+
+	// Claiming an unloaded chunk caches storage, a dirty chunk is regenerated in place
+	uint32_t ticket;
+	if (priority == CHUNK_PRIORITY_VISIBLE) {
+		ticket = lru_cache_claim(game->chunkCache, chunkX, chunkZ, storage);
+		assert(ticket != LRU_CACHE_NO_TICKET && "Chunk is already being generated");
+	} else {
+		ticket = lru_cache_prefetch(game->chunkCache, chunkX, chunkZ, storage);
+	}
+
+	pthread_mutex_lock(&workers->lock);
+	if (ticket != LRU_CACHE_NO_TICKET) {
+		size_t tail = (workers->head[priority] + workers->queued[priority]) % CHUNK_JOBS;
+		workers->jobs[priority][tail] = (struct ChunkJob){chunkX, chunkZ, storage, ticket, chunk != NULL};
+		workers->queued[priority]++;
+		pthread_cond_signal(&workers->wake);
+	} else {
+		workers->pending--;
+	}
+	pthread_mutex_unlock(&workers->lock);
+
+	if (ticket == LRU_CACHE_NO_TICKET) {
+		free(storage); // Cached already
+	}
+
+	return true;
 }
 
-int main(void) {
+/** Queues the chunks the player is heading for behind everything in view, while the workers have time to spare */
+static void chunk_prefetch_stage(struct Game *game) {
+	chunk_prefetch_observe(game->prefetch, game->player.x / CHUNK_WIDTH, game->player.z / CHUNK_WIDTH);
+
+	int side = game->renderDistance * 2 + 1;
+	size_t count = chunk_prefetch_plan(game->prefetch, game->renderDistance, game->planned, (size_t)side * (size_t)side);
+
+	for (size_t i = 0; i < count; i++) {
+		if (!chunk_queue(game, game->planned[i].x, game->planned[i].z, NULL, CHUNK_PRIORITY_PREFETCH)) {
+			break;
+		}
+	}
+}
+
+/** Never waits for a chunk, one that is not ready yet is drawn as pending and asked for again next frame */
+static ChunkColor chunk_request(struct Game *game, int chunkX, int chunkZ, char *label) {
+	void *chunk;
+
+	switch (lru_cache_get_state(game->chunkCache, chunkX, chunkZ, &chunk)) {
+	case LRU_CACHE_READY:
+		*label = 'L';
+		return CHUNK_COLOR_LOADED;
+	case LRU_CACHE_LOADING:
+		*label = '?';
+		return CHUNK_COLOR_PENDING;
+	case LRU_CACHE_DIRTY:
+		*label = 'D';
+		chunk_queue(game, chunkX, chunkZ, chunk, CHUNK_PRIORITY_VISIBLE);
+		return CHUNK_COLOR_LOADED; // Still drawable while it is regenerated
+	case LRU_CACHE_UNLOADED:
+	default:
+		if (!chunk_queue(game, chunkX, chunkZ, NULL, CHUNK_PRIORITY_VISIBLE)) {
+			*label = ' ';
+			return CHUNK_COLOR_UNLOADED;
+		}
+
+		*label = '?';
+		return CHUNK_COLOR_PENDING;
+	}
+}
+
+/**
+ * Marks a chunk Dirty, the next request regenerates it with the edit while
+ * the old copy is still drawn. Returns false when it is not Ready yet.
+ */
+static bool chunk_edit(struct Game *game, int chunkX, int chunkZ) {
+	return lru_cache_mark_dirty(game->chunkCache, chunkX, chunkZ);
+}
+#endif
+
+/** Usage: lrucache [region file], edited chunks only outlive the run when a region file is given */
+int main(int argc, char **argv) {
 	HIDE_CURSOR();
+	fflush(stdout); // Frames bypass stdio
 	srand(time(NULL));
 
+	TERMFRAME *screen = term_frame_create(STDOUT_FILENO, SCREEN_ROWS, SCREEN_COLS, chunk_colors, CHUNK_COLOR_COUNT);
+	assert(screen != NULL && "Screen failed to allocate.");
+
 	struct Game game = {
 		.player = {
 			.x = 18.0F,
 			.y = ((float)rand() / (float)RAND_MAX) * 128.0F,
 			.z = 0,
 		},
-		.renderDistance = 1};
+		.renderDistance = 1,
+		.regionPath = argc > 1 ? argv[1] : NULL};
+
+	bool editDue = false;
 
 	for (int t = 0; t < 1000; t++) {	// START GAME LOOP
 		float angle = (float)t * 0.5F; // speed of rotation
@@ -122,7 +469,7 @@ int main(void) {
 			size_t radius = game.renderDistance + CHUNK_CACHE_MARGIN;
 			size_t diameter = (radius * 2 + 1);
 			size_t cache_capacity = diameter * diameter;
-			game.chunkCache = lru_cache_create(cache_capacity);
+			chunk_streaming_start(&game, cache_capacity);
 
 			assert(game.chunkCache != NULL && "Chunk cache failed to allocate.");
 		}
@@ -133,19 +480,17 @@ int main(void) {
 		int playerChunkX = playerBlockX / CHUNK_WIDTH;
 		int playerChunkZ = playerBlockZ / CHUNK_WIDTH;
 
-		printf(
-			"XYZ: %0.4f / %0.04f / %0.4f\n"
-			"Block: %d %d %d\n"
-			"Chunk: %d 0 %d\n",
-			game.player.x, game.player.y, game.player.z,
-			playerBlockX, playerBlockY, playerBlockZ,
-			playerChunkX, playerChunkZ);
+		term_frame_clear(screen, CHUNK_COLOR_TEXT);
+		term_frame_text(screen, 0, 0, CHUNK_COLOR_TEXT, "XYZ: %0.4f / %0.04f / %0.4f", game.player.x, game.player.y,
+			game.player.z);
+		term_frame_text(screen, 1, 0, CHUNK_COLOR_TEXT, "Block: %d %d %d", playerBlockX, playerBlockY, playerBlockZ);
+		term_frame_text(screen, 2, 0, CHUNK_COLOR_TEXT, "Chunk: %d 0 %d", playerChunkX, playerChunkZ);
 
 		//
 		// Spiral around player for processing relevant chunks
 		//
 
-		draw_grid();
+		draw_grid(screen);
 
 		int x = 0;
 		int z = 0;
@@ -158,20 +503,17 @@ int main(void) {
 			int chunkX = playerChunkX + x;
 			int chunkZ = playerChunkZ + z;
 
-			void *chunk = lru_cache_get(game.chunkCache, chunkX, chunkZ);
-			if (chunk != NULL) {
+			char label;
+			ChunkColor color = chunk_request(&game, chunkX, chunkZ, &label);
+			if (color == CHUNK_COLOR_LOADED) {
 				// TODO calculate player distance from chunk center and assign distance to each chunk
 
 				// TODO if: chunk is within a specified distance of the player tick the chunk
 
 				// TODO if: chunk mesh is out of date or does not exist yet mark it for meshing(Done on a different thread so its async)
 				// TODO else: push chunk onto a list for rendering
-				draw_chunk_state(chunkX, chunkZ, CHUNK_COLOR_LOADED, 'L', playerChunkX, playerChunkZ);
-			} else {
-				chunk = "Placeholder Chunk!";
-				lru_cache_put(game.chunkCache, chunkX, chunkZ, chunk);
-				draw_chunk_state(chunkX, chunkZ, CHUNK_COLOR_PENDING, '?', playerChunkX, playerChunkZ);
 			}
+			draw_chunk_state(screen, chunkX, chunkZ, color, label, playerChunkX, playerChunkZ);
 
 			if (x == z || (x < 0 && x == -z) || (x > 0 && x == 1 - z)) {
 				int temp = dx;
@@ -182,13 +524,24 @@ int main(void) {
 			x += dx;
 			z += dz;
 
-			draw_chunk_state(playerChunkX, playerChunkZ, CHUNK_COLOR_PLAYER, 'P', playerChunkX, playerChunkZ);
-
-			draw_chunk_state(0, 0, CHUNK_COLOR_ERROR, '*', playerChunkX, playerChunkZ);
-
 			// usleep(50000);
 		};
 
+		// The edit waits until the chunk the player stands on has loaded
+		editDue = editDue || t % CHUNK_EDIT_FRAMES == 0;
+		if (editDue) {
+			editDue = !chunk_edit(&game, playerChunkX, playerChunkZ);
+		}
+
+		draw_chunk_state(screen, playerChunkX, playerChunkZ, CHUNK_COLOR_PLAYER, 'P', playerChunkX, playerChunkZ);
+		draw_chunk_state(screen, 0, 0, CHUNK_COLOR_ERROR, '*', playerChunkX, playerChunkZ);
+
+		//
+		// Prefetch stage, chunks the player is heading for at low priority
+		//
+
+		chunk_prefetch_stage(&game);
+
 		//
 		// Render stage
 		//
@@ -197,14 +550,19 @@ int main(void) {
 
 		//TODO render chunks
 
+		term_frame_present(screen);
+
 	} // END GAME LOOP
 
+	chunk_streaming_stop(&game);
+	term_frame_destroy(screen);
+
 	fflush(stdout);
 
 	sleep(100);
 
 	SHOW_CURSOR();
-	printf("\033[%d;0H", game.renderDistance * 2 + 3); // move cursor below grid
+	printf("\033[%d;0H", SCREEN_ROWS + 1); // move cursor below grid
 	RESET_COLOR();
 	printf("\n");
 	return EXIT_SUCCESS;
@@ -0,0 +1,137 @@
+/**
+ * Sharded LRU cache for chunk workers running next to the main thread.
+ *
+ * Shards are picked with the high bits of the coordinate hash, the shard's own
+ * hashmap indexes with the low bits, so keys of one shard still spread over
+ * its whole table.
+ */
+
+#include "sharded-cache.h"
+#include "hashmap.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct CacheShard {
+	pthread_mutex_t lock;
+	LRUCACHE *cache;
+};
+
+struct ShardedCache {
+	size_t shard_count;
+	unsigned int shard_shift;
+	struct CacheShard *shards;
+};
+
+SHARDEDCACHE *sharded_cache_create(size_t shard_count, const struct LRUCacheConfig *config) {
+	assert(config != NULL);
+	assert(shard_count > 0);
+
+	size_t count = 1;
+	unsigned int bits = 0;
+	while (count < shard_count) {
+		count <<= 1;
+		bits++;
+	}
+
+	SHARDEDCACHE *cache = calloc(1, sizeof(SHARDEDCACHE));
+	if (cache == NULL) {
+		return NULL;
+	}
+
+	cache->shards = calloc(count, sizeof(struct CacheShard));
+	if (cache->shards == NULL) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->shard_count = count;
+	cache->shard_shift = 64 - bits;
+
+	struct LRUCacheConfig shard_config = *config;
+	shard_config.capacity = (config->capacity + count - 1) / count;
+	if (shard_config.capacity < 2) {
+		shard_config.capacity = 2;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		struct CacheShard *shard = &cache->shards[i];
+
+		shard->cache = lru_cache_create_with(&shard_config);
+		if (shard->cache == NULL || pthread_mutex_init(&shard->lock, NULL) != 0) {
+			if (shard->cache != NULL) {
+				lru_cache_destroy(shard->cache);
+				shard->cache = NULL;
+			}
+
+			cache->shard_count = i;
+			sharded_cache_destroy(cache);
+			return NULL;
+		}
+	}
+
+	return cache;
+}
+
+void sharded_cache_destroy(SHARDEDCACHE *cache) {
+	assert(cache != NULL);
+
+	for (size_t i = 0; i < cache->shard_count; i++) {
+		lru_cache_destroy(cache->shards[i].cache);
+		pthread_mutex_destroy(&cache->shards[i].lock);
+	}
+
+	free(cache->shards);
+	free(cache);
+}
+
+static inline struct CacheShard *sharded_cache_shard(SHARDEDCACHE *cache, int x, int z) {
+	if (cache->shard_count == 1) {
+		return &cache->shards[0];
+	}
+
+	return &cache->shards[hashmap_hash_coords(x, z) >> cache->shard_shift];
+}
+
+void sharded_cache_put(SHARDEDCACHE *cache, int x, int z, void *value) {
+	assert(cache != NULL);
+
+	struct CacheShard *shard = sharded_cache_shard(cache, x, z);
+
+	pthread_mutex_lock(&shard->lock);
+	lru_cache_put(shard->cache, x, z, value);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Looks up and pins a value under the shard lock, so a put from another thread
+ * cannot evict it and hand it to on_evict while the caller still uses it.
+ * Every non-NULL result needs a matching sharded_cache_unpin.
+ */
+void *sharded_cache_pin(SHARDEDCACHE *cache, int x, int z) {
+	assert(cache != NULL);
+
+	struct CacheShard *shard = sharded_cache_shard(cache, x, z);
+
+	pthread_mutex_lock(&shard->lock);
+	void *value = lru_cache_pin(shard->cache, x, z);
+	pthread_mutex_unlock(&shard->lock);
+
+	return value;
+}
+
+void sharded_cache_unpin(SHARDEDCACHE *cache, int x, int z) {
+	assert(cache != NULL);
+
+	struct CacheShard *shard = sharded_cache_shard(cache, x, z);
+
+	pthread_mutex_lock(&shard->lock);
+	lru_cache_unpin(shard->cache, x, z);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+size_t sharded_cache_shard_count(SHARDEDCACHE *cache) {
+	assert(cache != NULL);
+	return cache->shard_count;
+}
@@ -0,0 +1,28 @@
+#ifndef SHARDED_CACHE_H
+#define SHARDED_CACHE_H 1
+
+#include "lru-cache.h"
+#include <stddef.h>
+
+typedef struct ShardedCache SHARDEDCACHE;
+
+/**
+ * Thread-safe chunk cache made of independently locked LRU caches. The key
+ * space is split by coordinate hash, so each shard keeps its own recency
+ * list and threads only contend when they touch the same shard.
+ *
+ * config->capacity is the total capacity, split evenly across shards.
+ * on_evict runs while the shard lock is held. Values are read through
+ * sharded_cache_pin, since another thread's put may evict anything that is
+ * not pinned.
+ */
+SHARDEDCACHE *sharded_cache_create(size_t shard_count, const struct LRUCacheConfig *config);
+void sharded_cache_destroy(SHARDEDCACHE *cache);
+
+void sharded_cache_put(SHARDEDCACHE *cache, int x, int z, void *value);
+void *sharded_cache_pin(SHARDEDCACHE *cache, int x, int z);
+void sharded_cache_unpin(SHARDEDCACHE *cache, int x, int z);
+
+size_t sharded_cache_shard_count(SHARDEDCACHE *cache);
+
+#endif
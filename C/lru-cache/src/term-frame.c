@@ -0,0 +1,261 @@
+/**
+ * Terminal framebuffer that only sends what changed. The header, both cell
+ * buffers and the output buffer live in one block sized for the worst case,
+ * a frame where every cell changed and needs its own cursor move and style,
+ * so presenting never allocates.
+ *
+ * Presenting walks the back buffer row by row. A changed cell right after
+ * the previous one written needs no cursor move, since the terminal cursor
+ * already moved past it, and a style is only sent when it differs from the
+ * last one sent. Every style switch resets the attributes first, so a bold
+ * style does not leak into the next. Once written the back buffer is copied
+ * to the front, the back keeps its contents and can be drawn over.
+ *
+ * The front buffer starts out invalid, so the first frame clears the screen
+ * and draws every cell. A failed write invalidates it again.
+ */
+
+// write is POSIX, not part of -std=c11
+#define _POSIX_C_SOURCE 200809L
+
+#include "term-frame.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TERM_FRAME_GLYPH	 4	// Longest UTF-8 encoding of a character
+#define TERM_FRAME_MOVE		 16 // "\033[row;colH" with up to 5 digits each, rounded up
+#define TERM_FRAME_MAX_SIDE	 99999
+#define TERM_FRAME_RESET	 "\033[0m"
+#define TERM_FRAME_CLEAR	 "\033[2J"
+#define TERM_FRAME_TEXT_SIZE 256
+
+struct TermCell {
+	char glyph[TERM_FRAME_GLYPH]; // Unused bytes are zero so cells compare with memcmp
+	uint8_t style;
+	uint8_t valid; // 0 in the front buffer until the cell was written
+};
+
+struct TermFrame {
+	int fd;
+	int rows;
+	int cols;
+	bool cleared; // The screen was cleared since the front buffer was invalidated
+
+	const char *const *styles;
+	size_t style_count;
+
+	struct TermCell *front;
+	struct TermCell *back;
+	char *out;
+	size_t out_capacity;
+};
+
+/** Bytes in the UTF-8 character starting with lead, 1 for anything that is not a valid lead byte */
+static inline size_t term_frame_glyph_length(unsigned char lead) {
+	if (lead >= 0xF0 && lead < 0xF8) {
+		return 4;
+	}
+	if (lead >= 0xE0) {
+		return lead < 0xF0 ? 3 : 1;
+	}
+	if (lead >= 0xC0) {
+		return 2;
+	}
+	return 1;
+}
+
+TERMFRAME *term_frame_create(int fd, int rows, int cols, const char *const *styles, size_t styleCount) {
+	assert(rows > 0 && cols > 0 && rows <= TERM_FRAME_MAX_SIDE && cols <= TERM_FRAME_MAX_SIDE);
+	assert(styles != NULL && styleCount > 0 && styleCount <= UINT8_MAX);
+
+	size_t longestStyle = 0;
+	for (size_t i = 0; i < styleCount; i++) {
+		size_t length = strlen(styles[i]);
+		longestStyle = length > longestStyle ? length : longestStyle;
+	}
+
+	size_t cellCount = (size_t)rows * (size_t)cols;
+	size_t cellOut = TERM_FRAME_MOVE + strlen(TERM_FRAME_RESET) + longestStyle + TERM_FRAME_GLYPH;
+	size_t outCapacity = strlen(TERM_FRAME_CLEAR) + cellCount * cellOut + strlen(TERM_FRAME_RESET);
+
+	size_t frontOffset = sizeof(TERMFRAME);
+	size_t backOffset = frontOffset + cellCount * sizeof(struct TermCell);
+	size_t outOffset = backOffset + cellCount * sizeof(struct TermCell);
+
+	char *block = calloc(1, outOffset + outCapacity);
+	if (block == NULL) {
+		return NULL;
+	}
+
+	TERMFRAME *frame = (TERMFRAME *)block;
+	frame->fd = fd;
+	frame->rows = rows;
+	frame->cols = cols;
+	frame->styles = styles;
+	frame->style_count = styleCount;
+	frame->front = (struct TermCell *)(block + frontOffset);
+	frame->back = (struct TermCell *)(block + backOffset);
+	frame->out = block + outOffset;
+	frame->out_capacity = outCapacity;
+
+	term_frame_clear(frame, 0);
+
+	return frame;
+}
+
+void term_frame_destroy(TERMFRAME *frame) {
+	assert(frame != NULL);
+
+	free(frame);
+}
+
+/** Fills the back buffer with spaces */
+void term_frame_clear(TERMFRAME *frame, uint8_t style) {
+	assert(frame != NULL && style < frame->style_count);
+
+	struct TermCell blank = {.glyph = {' '}, .style = style, .valid = 1};
+	size_t cellCount = (size_t)frame->rows * (size_t)frame->cols;
+	for (size_t i = 0; i < cellCount; i++) {
+		frame->back[i] = blank;
+	}
+}
+
+/** Draws the first character of glyph into a cell of the back buffer, cells outside the frame are ignored */
+void term_frame_put(TERMFRAME *frame, int row, int col, const char *glyph, uint8_t style) {
+	assert(frame != NULL && glyph != NULL && style < frame->style_count);
+
+	if (row < 0 || row >= frame->rows || col < 0 || col >= frame->cols) {
+		return;
+	}
+
+	struct TermCell cell = {.style = style, .valid = 1};
+
+	size_t length = term_frame_glyph_length((unsigned char)glyph[0]);
+	size_t copied = 0;
+	while (copied < length && glyph[copied] != '\0') {
+		cell.glyph[copied] = glyph[copied];
+		copied++;
+	}
+
+	// Empty or cut off characters would send fewer bytes than the lead byte promises
+	if (copied < length) {
+		memset(cell.glyph, 0, sizeof(cell.glyph));
+		cell.glyph[0] = ' ';
+	}
+
+	frame->back[(size_t)row * (size_t)frame->cols + (size_t)col] = cell;
+}
+
+/** Formats ASCII text into the back buffer starting at a cell, cut off at the right edge */
+void term_frame_text(TERMFRAME *frame, int row, int col, uint8_t style, const char *format, ...) {
+	assert(frame != NULL && format != NULL);
+
+	char text[TERM_FRAME_TEXT_SIZE];
+
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	for (size_t i = 0; text[i] != '\0' && col + (int)i < frame->cols; i++) {
+		term_frame_put(frame, row, col + (int)i, (char[]){text[i], '\0'}, style);
+	}
+}
+
+/** Forgets what the terminal shows, so the next present clears the screen and draws every cell */
+void term_frame_invalidate(TERMFRAME *frame) {
+	assert(frame != NULL);
+
+	memset(frame->front, 0, (size_t)frame->rows * (size_t)frame->cols * sizeof(struct TermCell));
+	frame->cleared = false;
+}
+
+static inline void term_frame_append(TERMFRAME *frame, size_t *used, const char *bytes, size_t length) {
+	assert(*used + length <= frame->out_capacity);
+
+	memcpy(frame->out + *used, bytes, length);
+	*used += length;
+}
+
+/** Writes the whole buffer, retrying short and interrupted writes. Returns false on any other error. */
+static bool term_frame_write(int fd, const char *bytes, size_t length) {
+	size_t written = 0;
+
+	while (written < length) {
+		ssize_t n = write(fd, bytes + written, length - written);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		written += (size_t)n;
+	}
+
+	return true;
+}
+
+/** Sends the cells that changed since the last present, returns the number of bytes written */
+size_t term_frame_present(TERMFRAME *frame) {
+	assert(frame != NULL);
+
+	size_t used = 0;
+	int style = -1; // Unknown until the first style is sent
+
+	if (!frame->cleared) {
+		term_frame_append(frame, &used, TERM_FRAME_CLEAR, strlen(TERM_FRAME_CLEAR));
+	}
+
+	for (int row = 0; row < frame->rows; row++) {
+		int cursor = -1; // Column the terminal cursor is at on this row, -1 after a skipped cell
+
+		for (int col = 0; col < frame->cols; col++) {
+			size_t index = (size_t)row * (size_t)frame->cols + (size_t)col;
+			const struct TermCell *cell = &frame->back[index];
+
+			if (memcmp(cell, &frame->front[index], sizeof(*cell)) == 0) {
+				cursor = -1;
+				continue;
+			}
+
+			if (cursor != col) {
+				char move[TERM_FRAME_MOVE];
+				int length = snprintf(move, sizeof(move), "\033[%d;%dH", row + 1, col + 1);
+				term_frame_append(frame, &used, move, (size_t)length);
+			}
+
+			if (cell->style != style) {
+				const char *sgr = frame->styles[cell->style];
+				term_frame_append(frame, &used, TERM_FRAME_RESET, strlen(TERM_FRAME_RESET));
+				term_frame_append(frame, &used, sgr, strlen(sgr));
+				style = cell->style;
+			}
+
+			term_frame_append(frame, &used, cell->glyph, term_frame_glyph_length((unsigned char)cell->glyph[0]));
+			cursor = col + 1;
+		}
+	}
+
+	if (used == 0) {
+		return 0;
+	}
+
+	if (style >= 0) {
+		term_frame_append(frame, &used, TERM_FRAME_RESET, strlen(TERM_FRAME_RESET));
+	}
+
+	if (!term_frame_write(frame->fd, frame->out, used)) {
+		term_frame_invalidate(frame);
+		return 0;
+	}
+
+	memcpy(frame->front, frame->back, (size_t)frame->rows * (size_t)frame->cols * sizeof(struct TermCell));
+	frame->cleared = true;
+
+	return used;
+}
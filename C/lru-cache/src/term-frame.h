@@ -0,0 +1,28 @@
+#ifndef TERM_FRAME_H
+#define TERM_FRAME_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct TermFrame TERMFRAME;
+
+/**
+ * Double buffered terminal framebuffer. Cells are drawn into the back
+ * buffer, and term_frame_present writes only the cells that differ from the
+ * front buffer, what the terminal shows, in a single write().
+ *
+ * Every cell holds one UTF-8 character one column wide and a style, an index
+ * into the palette of SGR escape sequences given at creation. The palette
+ * strings must outlive the frame.
+ */
+TERMFRAME *term_frame_create(int fd, int rows, int cols, const char *const *styles, size_t styleCount);
+void term_frame_destroy(TERMFRAME *frame);
+
+void term_frame_clear(TERMFRAME *frame, uint8_t style);
+void term_frame_put(TERMFRAME *frame, int row, int col, const char *glyph, uint8_t style);
+void term_frame_text(TERMFRAME *frame, int row, int col, uint8_t style, const char *format, ...);
+size_t term_frame_present(TERMFRAME *frame);
+void term_frame_invalidate(TERMFRAME *frame);
+
+#endif